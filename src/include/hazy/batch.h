@@ -0,0 +1,83 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#ifndef HAZY_BATCH_H
+#define HAZY_BATCH_H
+
+#include <datagram-transport/transport.h>
+#include <hazy/hazy.h>
+
+struct ImprintAllocator;
+struct ImprintAllocatorWithFree;
+
+typedef struct HazyBatchConfig {
+    HazyConfig hazyConfig;
+    const HazyScenario* scenario; // optional, restarted for each run
+    size_t runCount;
+    uint64_t baseSeed;
+    MonotonicTimeMs durationMs; // simulated time for each run
+    MonotonicTimeMs stepMs;     // simulated time between each step
+    Clog log;
+} HazyBatchConfig;
+
+/// One simulated session. The client transport sends through the out direction and receives from the in
+/// direction. The server transport is the other end: it receives what the out direction delivers, and
+/// sends through the in direction.
+typedef struct HazyBatchRun {
+    size_t index;
+    uint64_t seed;
+    Hazy* hazy;
+    DatagramTransport client;
+    DatagramTransport server;
+    MonotonicTimeMs now; // simulated time since the start of the run
+    MonotonicTimeMs startMs;
+    void* userState;
+} HazyBatchRun;
+
+/// Called on a worker thread. Must only use the run and its own state.
+typedef void* (*HazyBatchRunInitFn)(void* userData, HazyBatchRun* run);
+typedef int (*HazyBatchRunStepFn)(void* userData, HazyBatchRun* run);
+typedef void (*HazyBatchRunDestroyFn)(void* userData, HazyBatchRun* run);
+
+typedef struct HazyBatchCallbacks {
+    HazyBatchRunInitFn runInit;       // optional, returns the userState for the run
+    HazyBatchRunStepFn runStep;       // called every stepMs, a negative return value stops the run
+    HazyBatchRunDestroyFn runDestroy; // optional
+    void* userData;
+} HazyBatchCallbacks;
+
+/// The memory for one worker thread. The allocators are only used from that thread.
+typedef struct HazyBatchWorker {
+    struct ImprintAllocator* allocator;
+    struct ImprintAllocatorWithFree* allocatorWithFree;
+} HazyBatchWorker;
+
+typedef struct HazyBatchRunResult {
+    uint64_t seed;
+    HazyDirectionStats out;
+    HazyDirectionStats in;
+    int errorCode;
+} HazyBatchRunResult;
+
+typedef struct HazyBatchDirectionSummary {
+    uint64_t writtenPacketCount;
+    uint64_t deliveredPacketCount;
+    uint64_t droppedPacketCount;
+    double lossRatio; // dropped packets of all the delivered and dropped packets
+    double meanDelayMs;
+    MonotonicTimeMs maxDelayMs;
+} HazyBatchDirectionSummary;
+
+typedef struct HazyBatchResult {
+    size_t runCount;
+    size_t failedRunCount;
+    HazyBatchDirectionSummary out;
+    HazyBatchDirectionSummary in;
+} HazyBatchResult;
+
+int hazyBatchExecute(const HazyBatchConfig* config, HazyBatchCallbacks callbacks, const HazyBatchWorker* workers,
+                     size_t workerCount, HazyBatchRunResult* runResults, HazyBatchResult* result);
+uint64_t hazyBatchRunSeed(uint64_t baseSeed, size_t runIndex);
+
+#endif
@@ -0,0 +1,66 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#ifndef HAZY_BOTTLENECK_H
+#define HAZY_BOTTLENECK_H
+
+#include <clog/clog.h>
+#include <hazy/random.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum HazyBottleneckPolicy {
+    HazyBottleneckPolicyTailDrop,
+    HazyBottleneckPolicyRed,
+    HazyBottleneckPolicyCoDel,
+} HazyBottleneckPolicy;
+
+typedef struct HazyBottleneckConfig {
+    size_t octetsPerSecond; // zero disables the bottleneck
+    size_t queueOctetCapacity; // zero is unlimited
+    HazyBottleneckPolicy policy;
+    size_t redMinThresholdOctets;
+    size_t redMaxThresholdOctets;
+    size_t redMaxDropPerMille;
+    size_t codelTargetMs;
+    size_t codelIntervalMs;
+} HazyBottleneckConfig;
+
+typedef enum HazyBottleneckResult {
+    HazyBottleneckResultQueued,
+    HazyBottleneckResultTailDrop,
+    HazyBottleneckResultRedDrop,
+    HazyBottleneckResultCoDelDrop,
+} HazyBottleneckResult;
+
+/// A byte limited FIFO in front of a link that is drained at `octetsPerSecond`.
+/// Since the FIFO is drained at a constant rate, the queue is only kept as the time when
+/// the link has transmitted everything queued so far.
+typedef struct HazyBottleneck {
+    HazyBottleneckConfig config;
+    int64_t busyUntilUs;
+    float redAverageOctetCount;
+    bool codelIsDropping;
+    int64_t codelFirstAboveTimeUs;
+    int64_t codelDropNextUs;
+    size_t codelDropCount;
+    size_t codelLastDropCount;
+    HazyRandom random;
+    Clog log;
+} HazyBottleneck;
+
+void hazyBottleneckInit(HazyBottleneck* self, HazyBottleneckConfig config, Clog log);
+void hazyBottleneckReset(HazyBottleneck* self);
+void hazyBottleneckSetConfig(HazyBottleneck* self, HazyBottleneckConfig config);
+HazyBottleneckResult hazyBottleneckEnqueue(HazyBottleneck* self, size_t octetCount, int64_t arrivalUs,
+                                           int64_t* departureUs);
+size_t hazyBottleneckQueuedOctetCount(const HazyBottleneck* self, int64_t nowUs);
+
+HazyBottleneckConfig hazyBottleneckDisabled(void);
+HazyBottleneckConfig hazyBottleneckTailDrop(size_t octetsPerSecond, size_t queueOctetCapacity);
+HazyBottleneckConfig hazyBottleneckRed(size_t octetsPerSecond, size_t queueOctetCapacity);
+HazyBottleneckConfig hazyBottleneckCoDel(size_t octetsPerSecond, size_t queueOctetCapacity);
+
+#endif
@@ -0,0 +1,55 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#ifndef HAZY_CAPTURE_H
+#define HAZY_CAPTURE_H
+
+#include <monotonic-time/monotonic_time.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct ImprintAllocator;
+
+#if !defined HAZY_CAPTURE_SNAP_OCTET_COUNT
+#define HAZY_CAPTURE_SNAP_OCTET_COUNT (1472) // longer payloads are truncated in the capture
+#endif
+
+typedef enum HazyCaptureEventType {
+    HazyCaptureEventTypeArrived,   // value is the HazyDecision
+    HazyCaptureEventTypeDropBurst, // arrived during a drop burst
+    HazyCaptureEventTypeDelivered,
+    HazyCaptureEventTypeDropped, // value is the HazyTraceDropCause
+} HazyCaptureEventType;
+
+/// Stored in the ring, followed by the payload. The pcapng blocks are formatted when drained.
+typedef struct HazyCaptureRecord {
+    MonotonicTimeMs timeMs;
+    MonotonicTimeMs arrivedMs;
+    MonotonicTimeMs timeToActMs; // only for delivered packets
+    uint32_t sequence;
+    uint16_t octetCount; // before truncation
+    uint8_t type;        // HazyCaptureEventType
+    uint8_t value;
+    uint8_t interfaceId; // set with hazyDirectionSetCapture()
+    uint8_t padding[7];
+} HazyCaptureRecord;
+
+/// Lock-free byte ring with a single producer (the thread updating Hazy) and a single consumer, that
+/// writes the records as a pcapng file. When the ring is full, new records are dropped and counted.
+typedef struct HazyCapture {
+    uint8_t* octets;
+    size_t capacityMask;
+    size_t writeIndex;
+    size_t readIndex;
+    size_t lostRecordCount;
+    bool hasWrittenHeader;
+} HazyCapture;
+
+int hazyCaptureInit(HazyCapture* self, struct ImprintAllocator* allocator, size_t octetCapacity);
+void hazyCaptureAdd(HazyCapture* self, const HazyCaptureRecord* record, const uint8_t* payload);
+size_t hazyCaptureDrainToFile(HazyCapture* self, FILE* fp);
+
+#endif
@@ -0,0 +1,16 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#ifndef HAZY_CHECKPOINT_H
+#define HAZY_CHECKPOINT_H
+
+#include <hazy/hazy.h>
+
+#define HAZY_CHECKPOINT_VERSION (3)
+
+size_t hazyCheckpointOctetCount(const Hazy* self);
+int hazyCheckpointWrite(const Hazy* self, uint8_t* target, size_t capacity);
+int hazyCheckpointRestore(Hazy* self, const uint8_t* source, size_t octetCount);
+
+#endif
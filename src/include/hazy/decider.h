@@ -6,6 +6,7 @@
 #define HAZY_DECISION_H
 
 #include <clog/clog.h>
+#include <hazy/random.h>
 #include <stddef.h>
 
 typedef enum HazyDecision {
@@ -26,6 +27,7 @@ typedef struct HazyDecider {
     size_t rangeCount;
     HazyDecision decision;
     HazyDecisionRange ranges[5]; // NOTE: Must match number of fields in HazyDeciderConfig
+    HazyRandom random;
     Clog log;
 } HazyDecider;
 
@@ -44,5 +46,6 @@ HazyDeciderConfig hazyDeciderWorstCase(void);
 void hazyDeciderInit(HazyDecider* rangeCollection, HazyDeciderConfig config, Clog log);
 HazyDecision hazyDeciderDecide(HazyDecider* self);
 void hazyDeciderSetConfig(HazyDecider* self, HazyDeciderConfig config);
+void hazyDeciderCopyRanges(HazyDecider* self, const HazyDecider* prepared);
 
 #endif
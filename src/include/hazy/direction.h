@@ -7,8 +7,15 @@
 
 #include <clog/clog.h>
 #include <discoid/circular_buffer.h>
+#include <hazy/bottleneck.h>
+#include <hazy/capture.h>
 #include <hazy/latency.h>
 #include <hazy/packets.h>
+#include <hazy/random.h>
+#include <hazy/reorder.h>
+#include <hazy/trace.h>
+#include <hazy/truth.h>
+#include <hazy/wire.h>
 #include <monotonic-time/monotonic_time.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -17,17 +24,30 @@
 struct ImprintAllocatorWithFree;
 struct ImprintAllocator;
 
+#define HAZY_ERROR_WOULD_BLOCK (-46)
+
+/// What to do when a packet is written and the packet queue is full
+typedef enum HazyOverflowPolicy {
+    HazyOverflowPolicyDropNewest,    // the written packet is dropped
+    HazyOverflowPolicyDropOldestDue, // the queued packet that is due first is dropped
+    HazyOverflowPolicyWouldBlock,    // the write is refused with HAZY_ERROR_WOULD_BLOCK, and can be retried
+} HazyOverflowPolicy;
+
 typedef struct HazyDirectionOnlyConfig {
     size_t timeBetweenDropBurstSpanMs;
     size_t timeBetweenDropBurstMinimumMs;
     size_t dropBurstTimeSpanMs;
     size_t dropBurstTimeMinimumMs;
+    HazyOverflowPolicy overflowPolicy;
 } HazyDirectionOnlyConfig;
 
 typedef struct HazyDirectionConfig {
     HazyDeciderConfig decider;
     HazyLatencyConfig latency;
     HazyDirectionOnlyConfig direction;
+    HazyBottleneckConfig bottleneck;
+    HazyReorderConfig reorder;
+    HazyWireConfig wire;
 } HazyDirectionConfig;
 
 typedef enum HazyDirectionPhase {
@@ -35,15 +55,48 @@ typedef enum HazyDirectionPhase {
     HazyDirectionPhasePacketDropBurst,
 } HazyDirectionPhase;
 
+/// A direction config with the decider ranges and latency config precomputed,
+/// so it can be prepared on another thread and applied quickly.
+typedef struct HazyDirectionConfigSnapshot {
+    HazyDirectionConfig config;
+    HazyDecider decider;
+    HazyLatencyConfig latency;
+} HazyDirectionConfigSnapshot;
+
+typedef struct HazyDirectionStats {
+    uint64_t writtenPacketCount;
+    uint64_t writtenOctetCount;
+    uint64_t deliveredPacketCount;
+    uint64_t deliveredOctetCount;
+    uint64_t droppedPacketCount;
+    uint64_t droppedPacketCountByCause[HazyTraceDropCauseCount];
+    uint64_t wouldBlockCount; // writes refused with HAZY_ERROR_WOULD_BLOCK
+    uint64_t deliveredDelayMsSum; // from the write to the delivery
+    MonotonicTimeMs maxDeliveredDelayMs;
+} HazyDirectionStats;
+
 typedef struct HazyDirection {
     HazyDirectionPhase phase;
     HazyPackets packets;
     HazyLatency latency;
     char debugPrefix[32];
     HazyDecider decider;
+    HazyBottleneck bottleneck;
+    HazyReorder reorder;
+    HazyWire wire;
     MonotonicTimeMs nextPacketDropBurstMs;
     MonotonicTimeMs nextPacketDropBurstEndMs;
     HazyDirectionOnlyConfig config;
+    bool isPassthrough;
+    HazyTrace* trace;
+    uint8_t traceDirectionId;
+    HazyCapture* capture;
+    uint8_t captureInterfaceId;
+    HazyTruth* truth;
+    uint32_t nextSequence;
+    HazyLatencyPhase tracedLatencyPhase;
+    HazyDirectionStats stats;
+    HazyRandom random;
     Clog log;
 } HazyDirection;
 
@@ -51,8 +104,27 @@ void hazyDirectionInit(HazyDirection* self, size_t capacity, struct ImprintAlloc
                        HazyDirectionConfig config, Clog log);
 void hazyDirectionReset(HazyDirection* self);
 void hazyDirectionSetConfig(HazyDirection* self, HazyDirectionConfig config);
+void hazyDirectionAdjustConfig(HazyDirection* self, HazyDirectionConfig config);
+void hazyDirectionConfigSnapshotInit(HazyDirectionConfigSnapshot* self, HazyDirectionConfig config);
+void hazyDirectionApplySnapshot(HazyDirection* self, const HazyDirectionConfigSnapshot* snapshot);
 int hazyWriteDirection(HazyDirection* self, const uint8_t* data, size_t octetCount);
+int hazyWriteDirectionAt(HazyDirection* self, const uint8_t* data, size_t octetCount, MonotonicTimeMs now);
+int hazyWriteDirectionOwnedAt(HazyDirection* self, uint8_t* data, size_t octetCount, MonotonicTimeMs now);
+void hazyDirectionSetSeed(HazyDirection* self, uint64_t seed);
 void hazyDirectionUpdate(HazyDirection* self, MonotonicTimeMs now);
+bool hazyDirectionConfigIsPassthrough(const HazyDirectionConfig* config);
+bool hazyDirectionIsIdlePassthrough(const HazyDirection* self);
+size_t hazyDirectionQueuedPacketCount(const HazyDirection* self);
+size_t hazyDirectionFreePacketCount(const HazyDirection* self);
+bool hazyDirectionWouldBlock(const HazyDirection* self);
+void hazyDirectionSetTrace(HazyDirection* self, HazyTrace* trace, uint8_t directionId);
+void hazyDirectionSetCapture(HazyDirection* self, HazyCapture* capture, uint8_t interfaceId);
+void hazyDirectionSetTruth(HazyDirection* self, HazyTruth* truth);
+void hazyDirectionPacketDelivered(HazyDirection* self, const HazyPacket* packet, MonotonicTimeMs now);
+void hazyDirectionWriteDropped(HazyDirection* self, const uint8_t* data, size_t octetCount, HazyTraceDropCause cause,
+                               MonotonicTimeMs now);
+void hazyDirectionPacketDropped(HazyDirection* self, const HazyPacket* packet, HazyTraceDropCause cause,
+                                MonotonicTimeMs now);
 
 HazyDirectionConfig hazyDirectionConfigGoodCondition(void);
 HazyDirectionConfig hazyDirectionConfigRecommended(void);
@@ -11,6 +11,8 @@
 #include <hazy/direction.h>
 #include <hazy/latency.h>
 #include <hazy/packets.h>
+#include <hazy/sampler.h>
+#include <hazy/scenario.h>
 #include <monotonic-time/monotonic_time.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -20,15 +22,28 @@ struct DatagramTransport;
 struct ImprintAllocatorWithFree;
 struct ImprintAllocator;
 
+#define HAZY_TRACE_DIRECTION_OUT (0)
+#define HAZY_TRACE_DIRECTION_IN (1)
+
 typedef struct HazyConfig {
     HazyDirectionConfig in;
     HazyDirectionConfig out;
 } HazyConfig;
 
+/// A config prepared on a control thread, see hazyPublishConfig()
+typedef struct HazyConfigSnapshot {
+    HazyDirectionConfigSnapshot in;
+    HazyDirectionConfigSnapshot out;
+    int isConsumed;
+} HazyConfigSnapshot;
+
 typedef struct Hazy {
     HazyDirection out;
     HazyDirection in;
     DiscoidBuffer receiveBuffer;
+    HazyScenarioPlayer scenarioPlayer;
+    HazyConfigSnapshot* publishedConfig;
+    HazySampler* sampler;
     Clog log;
 } Hazy;
 
@@ -36,13 +51,29 @@ void hazyInit(Hazy* self, size_t capacity, struct ImprintAllocator* allocator,
               struct ImprintAllocatorWithFree* allocatorWithFree, HazyConfig config, Clog log);
 void hazyReset(Hazy* self);
 void hazyUpdate(Hazy* self);
+void hazyUpdateAt(Hazy* self, MonotonicTimeMs now);
 ssize_t hazyUpdateAndCommunicate(Hazy* self, struct DatagramTransport* socket);
+int hazyUpdateAndSend(Hazy* self, struct DatagramTransport* socket);
 int hazyRead(Hazy* self, uint8_t* data, size_t capacity);
 int hazyWrite(Hazy* self, const uint8_t* data, size_t octetCount);
+int hazyWriteAt(Hazy* self, const uint8_t* data, size_t octetCount, MonotonicTimeMs now);
 void hazySetConfig(Hazy* self, HazyConfig config);
+void hazySetSeed(Hazy* self, uint64_t seed);
+void hazySetScenario(Hazy* self, const HazyScenario* scenario);
+void hazySetTrace(Hazy* self, HazyTrace* trace);
+void hazySetCapture(Hazy* self, HazyCapture* capture);
+void hazySetTruth(Hazy* self, HazyTruth* out, HazyTruth* in);
+void hazySetSampler(Hazy* self, HazySampler* sampler);
+HazyConfigSnapshot* hazyPublishConfig(Hazy* self, HazyConfigSnapshot* snapshot);
+
+void hazyConfigSnapshotInit(HazyConfigSnapshot* self, HazyConfig config);
+bool hazyConfigSnapshotIsConsumed(const HazyConfigSnapshot* self);
 int hazyReadSend(Hazy* self, uint8_t* data, size_t capacity);
+int hazyReadSendAt(Hazy* self, uint8_t* data, size_t capacity, MonotonicTimeMs now);
 int hazyFeedRead(Hazy* self, const uint8_t* data, size_t capacity);
+int hazyFeedReadAt(Hazy* self, const uint8_t* data, size_t octetCount, MonotonicTimeMs now);
 
+bool hazyConfigIsPassthrough(const HazyConfig* config);
 HazyConfig hazyConfigGoodCondition(void);
 HazyConfig hazyConfigRecommended(void);
 HazyConfig hazyConfigWorstCase(void);
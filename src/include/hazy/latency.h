@@ -9,6 +9,7 @@
 #include <discoid/circular_buffer.h>
 #include <hazy/decider.h>
 #include <hazy/packets.h>
+#include <hazy/random.h>
 #include <monotonic-time/monotonic_time.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -28,22 +29,54 @@ typedef enum HazyLatencyPhase {
     HazyLatencyPhaseDrifting,
 } HazyLatencyPhase;
 
-typedef struct HazyLatency {
+/// What the next evaluation has to do before the drift cycles can be evaluated.
+/// Ordered so that a stronger request is not overwritten by a weaker one.
+typedef enum HazyLatencyPending {
+    HazyLatencyPendingNone,
+    HazyLatencyPendingAdjust, // the range changed, the cycles after the current one use the new range
+    HazyLatencyPendingLeadIn, // the target is outside the new range, drift quickly into it first
+    HazyLatencyPendingStart,  // the cycles start at the next evaluation, from the current latency
+} HazyLatencyPending;
+
+/// The latency at a point in time, see hazyLatencyAt()
+typedef struct HazyLatencyState {
     HazyLatencyMs latency;
-    float precisionLatency;
     HazyLatencyMs targetLatency;
-    MonotonicTimeMs nextDriftEstimationMs;
     float latencyDiffPerSecond;
+    HazyLatencyPhase phase;
+} HazyLatencyState;
+
+/// The latency drifts piecewise linearly towards a target latency, and then stays there for a while.
+/// The drifts start on a fixed cycle period from cycleOriginMs, and each cycle draws its target from the cycle
+/// start time, so the cycle that contains any point in time is evaluated directly, in closed form.
+typedef struct HazyLatency {
+    HazyLatencyMs latency; // at lastUpdateTimeMs
+    HazyLatencyMs startLatency;
+    HazyLatencyMs targetLatency;
+    MonotonicTimeMs driftStartMs;
+    MonotonicTimeMs driftEndMs;
+    float latencyDiffPerSecond;
+    HazyLatencyMs cycleStartLatency; // target of the drift that runs until cycleOriginMs
+    MonotonicTimeMs cycleOriginMs;
+    MonotonicTimeMs cyclePeriodMs;
+    HazyLatencyMs cycleMinLatency;
+    HazyLatencyMs cycleLatencyRange;
+    uint64_t cycleSeed;
+    HazyLatencyPending pending;
     HazyLatencyConfig config;
     HazyLatencyPhase phase;
     MonotonicTimeMs lastUpdateTimeMs;
+    HazyRandom random;
     Clog log;
 } HazyLatency;
 
 void hazyLatencyInit(HazyLatency* self, HazyLatencyConfig config, Clog log);
+void hazyLatencyReset(HazyLatency* self);
 void hazyLatencySetConfig(HazyLatency* self, HazyLatencyConfig config);
+void hazyLatencyAdjustConfig(HazyLatency* self, HazyLatencyConfig config);
 void hazyLatencyUpdate(HazyLatency* self, MonotonicTimeMs now);
-int hazyLatencyGetLatencyWithJitter(HazyLatency* self);
+HazyLatencyState hazyLatencyAt(const HazyLatency* self, MonotonicTimeMs now);
+int hazyLatencyGetLatencyWithJitter(HazyLatency* self, MonotonicTimeMs now);
 
 HazyLatencyConfig hazyLatencyGoodCondition(void);
 HazyLatencyConfig hazyLatencyRecommended(void);
@@ -0,0 +1,44 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#ifndef HAZY_LINK_H
+#define HAZY_LINK_H
+
+#include <datagram-transport/transport.h>
+#include <hazy/hazy.h>
+
+struct HazyLink;
+struct ImprintAllocatorWithFree;
+
+typedef struct HazyLinkEndpoint {
+    DatagramTransport transport;
+    struct HazyLink* link;
+    HazyDirection* sendDirection;
+    HazyDirection* receiveDirection;
+} HazyLinkEndpoint;
+
+/// Two transports in the same process, connected to each other through a direction each way.
+/// The client sends through the out direction of the config, and the server through the in direction.
+/// Must not be moved after hazyLinkInit(), the endpoints point into it.
+typedef struct HazyLink {
+    HazyDirection clientToServer;
+    HazyDirection serverToClient;
+    HazyLinkEndpoint client;
+    HazyLinkEndpoint server;
+    bool useVirtualClock;
+    MonotonicTimeMs virtualNow;
+    char debugPrefix[32];
+    Clog log;
+} HazyLink;
+
+void hazyLinkInit(HazyLink* self, struct ImprintAllocatorWithFree* allocatorWithFree, HazyConfig config, Clog log);
+void hazyLinkReset(HazyLink* self);
+void hazyLinkSetConfig(HazyLink* self, HazyConfig config);
+void hazyLinkSetSeed(HazyLink* self, uint64_t seed);
+void hazyLinkSetVirtualTime(HazyLink* self, MonotonicTimeMs now);
+void hazyLinkAdvance(HazyLink* self, MonotonicTimeMs deltaMs);
+void hazyLinkUpdate(HazyLink* self);
+MonotonicTimeMs hazyLinkNow(const HazyLink* self);
+
+#endif
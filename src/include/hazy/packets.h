@@ -12,32 +12,60 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/// A view of a packet in the queue
 typedef struct HazyPacket {
     uint8_t* data;
     size_t octetCount;
     MonotonicTimeMs timeToAct;
-    int indexForDebug;
     MonotonicTimeMs created;
+    uint32_t sequence;
+    size_t index;
 } HazyPacket;
 
-#define HAZY_PACKETS_CAPACITY (120)
+/// Milliseconds relative to HazyPackets.baseTimeMs
+typedef uint32_t HazyPacketTime;
 
+#define HAZY_PACKET_TIME_FREE (UINT32_MAX)
+
+#if !defined HAZY_PACKETS_CAPACITY
+#define HAZY_PACKETS_CAPACITY (120) // must be less than 256
+#endif
+
+// The free slots are kept in an uint8_t index stack
+typedef char hazyPacketsCapacityMustFitInFreeIndices[(HAZY_PACKETS_CAPACITY < 256) ? 1 : -1];
+
+/// Packet queue stored as a structure of arrays. The deadlines are kept in a dense array
+/// (free slots have HAZY_PACKET_TIME_FREE), so finding the packet to act on only touches a few cache lines.
+/// About 2.7 KiB with the default capacity.
 typedef struct HazyPackets {
-    HazyPacket packets[HAZY_PACKETS_CAPACITY];
+    HazyPacketTime timeToAct[HAZY_PACKETS_CAPACITY];
+    HazyPacketTime created[HAZY_PACKETS_CAPACITY];
+    uint32_t sequence[HAZY_PACKETS_CAPACITY];
+    uint16_t octetCount[HAZY_PACKETS_CAPACITY];
+    uint8_t freeIndices[HAZY_PACKETS_CAPACITY];
+    uint8_t* data[HAZY_PACKETS_CAPACITY];
+    size_t freeCount;
     size_t packetCount;
-    size_t capacity;
+    MonotonicTimeMs baseTimeMs;
     struct ImprintAllocatorWithFree* allocatorWithFree;
     MonotonicTimeMs lastTimeAdded;
+    uint32_t lastSequenceAdded;
     bool lastTimeIsValid;
 } HazyPackets;
 
 void hazyPacketsInit(HazyPackets* self, struct ImprintAllocatorWithFree* allocator);
-int hazyPacketsRead(HazyPackets* self, uint8_t* data, size_t capacity, Clog* log);
-HazyPacket* hazyPacketsWrite(HazyPackets* self, const uint8_t* buf, size_t octetsRead, MonotonicTimeMs timeToAct,
-                             Clog* log);
+void hazyPacketsReset(HazyPackets* self);
+int hazyPacketsWrite(HazyPackets* self, const uint8_t* buf, size_t octetsRead, uint32_t sequence,
+                     MonotonicTimeMs timeToAct, MonotonicTimeMs now, Clog* log);
+int hazyPacketsWriteOwned(HazyPackets* self, uint8_t* data, size_t octetCount, uint32_t sequence,
+                          MonotonicTimeMs timeToAct, MonotonicTimeMs now, Clog* log);
 
-void hazyPacketsDestroyPacket(HazyPackets* self, HazyPacket* packetToDiscard);
+void hazyPacketsDestroyPacket(HazyPackets* self, const HazyPacket* packetToDiscard);
+uint8_t* hazyPacketsTakePacket(HazyPackets* self, const HazyPacket* packet);
+int hazyPacketsPutBack(HazyPackets* self, const HazyPacket* packet, Clog* log);
 
-HazyPacket* hazyPacketsFindPacketToActOn(HazyPackets* self);
+bool hazyPacketsFindPacketToActOn(const HazyPackets* self, MonotonicTimeMs now, HazyPacket* packet);
+bool hazyPacketsSequenceIsBefore(uint32_t sequence, uint32_t other);
+bool hazyPacketsFindEarliest(const HazyPackets* self, HazyPacket* packet);
 
 #endif
@@ -0,0 +1,33 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#ifndef HAZY_PIPELINE_H
+#define HAZY_PIPELINE_H
+
+#include <hazy/direction.h>
+
+struct ImprintAllocatorWithFree;
+
+#if !defined HAZY_PIPELINE_MAX_STAGE_COUNT
+#define HAZY_PIPELINE_MAX_STAGE_COUNT (4)
+#endif
+
+/// A path of several hops, e.g. Wi-Fi, then the ISP, then a backbone. Each stage is a direction,
+/// and a packet that is due in one stage is handed over to the next without copying the payload.
+typedef struct HazyPipeline {
+    HazyDirection stages[HAZY_PIPELINE_MAX_STAGE_COUNT];
+    size_t stageCount;
+    char debugPrefixes[HAZY_PIPELINE_MAX_STAGE_COUNT][32];
+    Clog log;
+} HazyPipeline;
+
+int hazyPipelineInit(HazyPipeline* self, struct ImprintAllocatorWithFree* allocatorWithFree,
+                     const HazyDirectionConfig* stageConfigs, size_t stageCount, Clog log);
+void hazyPipelineReset(HazyPipeline* self);
+void hazyPipelineSetSeed(HazyPipeline* self, uint64_t seed);
+int hazyPipelineWriteAt(HazyPipeline* self, const uint8_t* data, size_t octetCount, MonotonicTimeMs now);
+void hazyPipelineUpdate(HazyPipeline* self, MonotonicTimeMs now);
+int hazyPipelineReadAt(HazyPipeline* self, uint8_t* data, size_t capacity, MonotonicTimeMs now);
+
+#endif
@@ -0,0 +1,21 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#ifndef HAZY_RANDOM_H
+#define HAZY_RANDOM_H
+
+#include <stdint.h>
+
+/// Small pseudo random generator (splitmix64). Each component has its own, so a simulation
+/// is reproducible from a seed and independent of other threads.
+typedef struct HazyRandom {
+    uint64_t state;
+} HazyRandom;
+
+void hazyRandomInit(HazyRandom* self, uint64_t seed);
+uint32_t hazyRandomNext(HazyRandom* self);
+uint32_t hazyRandomRange(HazyRandom* self, uint32_t count);
+uint64_t hazyRandomMix(uint64_t value);
+
+#endif
@@ -0,0 +1,61 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#ifndef HAZY_REORDER_H
+#define HAZY_REORDER_H
+
+#include <clog/clog.h>
+#include <hazy/random.h>
+#include <monotonic-time/monotonic_time.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct ImprintAllocatorWithFree;
+
+typedef struct HazyReorderConfig {
+    size_t minDepth; // number of later packets that overtake a held back packet
+    size_t maxDepth;
+    size_t maxHoldMs; // held back packets are released after this time, even if not overtaken
+} HazyReorderConfig;
+
+// Must be a power of two and greater than the max depth
+#define HAZY_REORDER_SLOT_COUNT (16)
+
+typedef struct HazyReorderSlot {
+    uint8_t* data;
+    size_t octetCount;
+    MonotonicTimeMs heldAtMs;
+    uint32_t sequence;
+} HazyReorderSlot;
+
+/// Holds back packets until a number of later packets have passed.
+/// A held back packet is stored in the slot for the sequence it should be released at,
+/// so finding the packet to release is O(1).
+typedef struct HazyReorder {
+    HazyReorderSlot slots[HAZY_REORDER_SLOT_COUNT];
+    size_t sequence;
+    size_t heldCount;
+    HazyReorderConfig config;
+    struct ImprintAllocatorWithFree* allocatorWithFree;
+    HazyRandom random;
+    Clog log;
+} HazyReorder;
+
+void hazyReorderInit(HazyReorder* self, HazyReorderConfig config, struct ImprintAllocatorWithFree* allocatorWithFree,
+                     Clog log);
+void hazyReorderReset(HazyReorder* self);
+void hazyReorderSetConfig(HazyReorder* self, HazyReorderConfig config);
+bool hazyReorderHold(HazyReorder* self, const uint8_t* data, size_t octetCount, uint8_t* ownedData,
+                     uint32_t sequence, MonotonicTimeMs now);
+HazyReorderSlot* hazyReorderAdvance(HazyReorder* self);
+HazyReorderSlot* hazyReorderFindExpired(HazyReorder* self, MonotonicTimeMs now);
+void hazyReorderRelease(HazyReorder* self, HazyReorderSlot* slot);
+uint8_t* hazyReorderTake(HazyReorder* self, HazyReorderSlot* slot);
+
+HazyReorderConfig hazyReorderGoodCondition(void);
+HazyReorderConfig hazyReorderRecommended(void);
+HazyReorderConfig hazyReorderWorstCase(void);
+
+#endif
@@ -0,0 +1,62 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#ifndef HAZY_SAMPLER_H
+#define HAZY_SAMPLER_H
+
+#include <hazy/direction.h>
+#include <monotonic-time/monotonic_time.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct ImprintAllocator;
+
+/// State of a direction at the time of the sample. The packet counts are for the interval since the previous sample.
+typedef struct HazyDirectionSample {
+    uint16_t latencyMs;
+    uint16_t targetLatencyMs;
+    float latencyDiffPerSecond;
+    uint8_t latencyPhase;   // HazyLatencyPhase
+    uint8_t dropBurstPhase; // HazyDirectionPhase
+    uint16_t queuedPacketCount;
+    uint32_t bottleneckQueuedOctetCount;
+    uint32_t writtenPacketCount;
+    uint32_t deliveredPacketCount;
+    uint32_t deliveredOctetCount;
+    uint32_t droppedPacketCount;
+} HazyDirectionSample;
+
+typedef struct HazySample {
+    MonotonicTimeMs timeMs;
+    MonotonicTimeMs elapsedMs; // since the previous sample
+    HazyDirectionSample out;
+    HazyDirectionSample in;
+} HazySample;
+
+/// Samples the simulated network at a fixed interval into a preallocated ring.
+/// When the ring is full, the oldest samples are overwritten.
+/// Must be updated and dumped from the same thread.
+typedef struct HazySampler {
+    HazySample* samples;
+    size_t capacity;
+    size_t writeCount;
+    size_t readCount;
+    size_t lostSampleCount;
+    MonotonicTimeMs intervalMs;
+    MonotonicTimeMs nextSampleMs;
+    MonotonicTimeMs lastSampleMs;
+    HazyDirectionStats previousOut;
+    HazyDirectionStats previousIn;
+    bool hasWrittenCsvHeader;
+} HazySampler;
+
+int hazySamplerInit(HazySampler* self, struct ImprintAllocator* allocator, size_t sampleCapacity,
+                    MonotonicTimeMs intervalMs);
+void hazySamplerUpdate(HazySampler* self, const HazyDirection* out, const HazyDirection* in, MonotonicTimeMs now);
+size_t hazySamplerDumpCsv(HazySampler* self, FILE* fp);
+size_t hazySamplerDumpBinary(HazySampler* self, FILE* fp);
+
+#endif
@@ -0,0 +1,50 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#ifndef HAZY_SCENARIO_H
+#define HAZY_SCENARIO_H
+
+#include <clog/clog.h>
+#include <hazy/direction.h>
+#include <monotonic-time/monotonic_time.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct ImprintAllocator;
+
+typedef enum HazyScenarioTransition {
+    HazyScenarioTransitionStep,
+    HazyScenarioTransitionLinear,
+} HazyScenarioTransition;
+
+/// A config that should be in effect at `timeMs` after the scenario started.
+/// `transition` tells how to get from the previous keyframe to this one.
+typedef struct HazyScenarioKeyframe {
+    MonotonicTimeMs timeMs;
+    HazyScenarioTransition transition;
+    HazyDirectionConfig in;
+    HazyDirectionConfig out;
+} HazyScenarioKeyframe;
+
+typedef struct HazyScenario {
+    HazyScenarioKeyframe* keyframes;
+    size_t keyframeCount;
+    Clog log;
+} HazyScenario;
+
+typedef struct HazyScenarioPlayer {
+    const HazyScenario* scenario;
+    MonotonicTimeMs startTimeMs;
+    size_t nextKeyframeIndex;
+    bool hasStarted;
+} HazyScenarioPlayer;
+
+int hazyScenarioInitFromString(HazyScenario* self, struct ImprintAllocator* allocator, const char* text, Clog log);
+int hazyScenarioInitFromFile(HazyScenario* self, struct ImprintAllocator* allocator, const char* filename, Clog log);
+
+void hazyScenarioPlayerInit(HazyScenarioPlayer* self, const HazyScenario* scenario);
+bool hazyScenarioPlayerUpdate(HazyScenarioPlayer* self, MonotonicTimeMs now, HazyDirectionConfig* in,
+                              HazyDirectionConfig* out);
+
+#endif
@@ -0,0 +1,45 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#ifndef HAZY_SHM_H
+#define HAZY_SHM_H
+
+#include <clog/clog.h>
+#include <datagram-transport/transport.h>
+#include <hazy/direction.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct HazyShmRing;
+struct ImprintAllocatorWithFree;
+
+/// One end of a shared memory segment with a lock-free single producer, single consumer ring in each
+/// direction, so processes on the same machine can exchange datagrams without any syscalls per datagram.
+/// The sent datagrams go through a direction before they are pushed into the ring, so the impairment is
+/// applied by the sending process. Only supported on POSIX systems.
+typedef struct HazyShm {
+    DatagramTransport transport;
+    HazyDirection sendDirection;
+    struct HazyShmRing* sendRing;
+    struct HazyShmRing* receiveRing;
+    void* memory;
+    size_t memoryOctetCount;
+    size_t slotCount;
+    size_t slotOctetCount;
+    size_t ringFullDropCount; // dropped since the receiving process did not keep up
+    int fd;
+    bool isOwner;
+    char name[64];
+    char debugPrefix[32];
+    Clog log;
+} HazyShm;
+
+int hazyShmCreate(HazyShm* self, const char* name, size_t slotCount, size_t slotOctetCount,
+                  struct ImprintAllocatorWithFree* allocatorWithFree, HazyDirectionConfig config, Clog log);
+int hazyShmOpen(HazyShm* self, const char* name, struct ImprintAllocatorWithFree* allocatorWithFree,
+                HazyDirectionConfig config, Clog log);
+void hazyShmUpdate(HazyShm* self, MonotonicTimeMs now);
+void hazyShmClose(HazyShm* self);
+
+#endif
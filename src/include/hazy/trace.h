@@ -0,0 +1,65 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#ifndef HAZY_TRACE_H
+#define HAZY_TRACE_H
+
+#include <monotonic-time/monotonic_time.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct ImprintAllocator;
+
+typedef enum HazyTraceEventType {
+    HazyTraceEventTypeDecision,       // value is the HazyDecision
+    HazyTraceEventTypeEnqueue,        // value is the scheduled delay, detail is the wire and bottleneck delay (ms)
+    HazyTraceEventTypeDeliver,        // value is the actual delay, detail is how late it was delivered (ms)
+    HazyTraceEventTypeDrop,           // value is the HazyTraceDropCause
+    HazyTraceEventTypeDropBurstPhase, // value is the new HazyDirectionPhase
+    HazyTraceEventTypeLatencyPhase,   // value is the new HazyLatencyPhase, detail is the target latency
+} HazyTraceEventType;
+
+typedef enum HazyTraceDropCause {
+    HazyTraceDropCauseDecision,
+    HazyTraceDropCauseDropBurst,
+    HazyTraceDropCauseTailDrop,
+    HazyTraceDropCauseRedDrop,
+    HazyTraceDropCauseCoDelDrop,
+    HazyTraceDropCausePacketCapacity,
+    HazyTraceDropCauseReceiveBuffer,
+    HazyTraceDropCauseOverflowOldest, // dropped to make room, see HazyOverflowPolicyDropOldestDue
+    HazyTraceDropCauseSendFailed,     // the socket refused the datagram, e.g. in hazy-proxy
+    HazyTraceDropCauseCount,
+} HazyTraceDropCause;
+
+/// Fixed size event, without padding, so it can be written to a file as is.
+typedef struct HazyTraceEvent {
+    MonotonicTimeMs timeMs;
+    uint32_t sequence; // packet sequence within the direction, zero for phase events
+    uint16_t octetCount;
+    uint8_t type;        // HazyTraceEventType
+    uint8_t directionId; // set with hazyDirectionSetTrace()
+    int32_t value;
+    int32_t detail;
+} HazyTraceEvent;
+
+/// Lock-free ring with a single producer (the thread updating Hazy) and a single consumer.
+/// When the ring is full, new events are dropped and counted in lostEventCount.
+typedef struct HazyTrace {
+    HazyTraceEvent* events;
+    size_t capacityMask;
+    size_t writeIndex;
+    size_t readIndex;
+    size_t lostEventCount;
+} HazyTrace;
+
+typedef void (*HazyTraceDrainFn)(void* userData, const HazyTraceEvent* events, size_t eventCount);
+
+int hazyTraceInit(HazyTrace* self, struct ImprintAllocator* allocator, size_t eventCapacity);
+void hazyTraceAdd(HazyTrace* self, const HazyTraceEvent* event);
+size_t hazyTraceDrain(HazyTrace* self, HazyTraceDrainFn fn, void* userData);
+size_t hazyTraceDrainToFile(HazyTrace* self, FILE* fp);
+
+#endif
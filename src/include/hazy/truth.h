@@ -0,0 +1,64 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#ifndef HAZY_TRUTH_H
+#define HAZY_TRUTH_H
+
+#include <monotonic-time/monotonic_time.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct ImprintAllocator;
+
+typedef enum HazyTruthFate {
+    HazyTruthFateUnknown, // not written yet, or overwritten by a later sequence
+    HazyTruthFatePending, // queued, held back or still on the wire
+    HazyTruthFateDelivered,
+    HazyTruthFateDropped,
+} HazyTruthFate;
+
+/// What actually happened to one written datagram
+typedef struct HazyTruthRecord {
+    MonotonicTimeMs writtenMs;
+    MonotonicTimeMs deliveredMs; // first delivered copy
+    uint32_t sequence;
+    uint8_t fate;           // HazyTruthFate
+    uint8_t dropCause;      // HazyTraceDropCause, for dropped packets
+    uint8_t deliveredCount;   // more than one for duplicated packets
+    uint8_t outstandingCount; // copies that are not delivered or dropped yet
+} HazyTruthRecord;
+
+typedef struct HazyTruthWindow {
+    uint32_t packetCount; // known packets in the window
+    uint32_t deliveredCount;
+    uint32_t droppedCount;
+    uint32_t pendingCount;
+    double lossRatio; // dropped packets of the delivered and dropped packets
+    double meanDelayMs;
+    MonotonicTimeMs minDelayMs;
+    MonotonicTimeMs maxDelayMs;
+    double jitterMs; // RFC 3550 interarrival jitter
+} HazyTruthWindow;
+
+/// The true one-way delay and fate of the packets of one direction, indexed by the packet sequence.
+/// The sequence is the order in which the datagrams were written to the direction, starting from zero
+/// after a reset. Holds the records for the latest recordCapacity sequences.
+/// Must only be used from the thread updating Hazy.
+typedef struct HazyTruth {
+    HazyTruthRecord* records;
+    size_t capacityMask;
+    uint32_t nextSequence; // one past the highest written sequence
+} HazyTruth;
+
+int hazyTruthInit(HazyTruth* self, struct ImprintAllocator* allocator, size_t recordCapacity);
+void hazyTruthReset(HazyTruth* self);
+void hazyTruthWritten(HazyTruth* self, uint32_t sequence, MonotonicTimeMs now);
+void hazyTruthDuplicated(HazyTruth* self, uint32_t sequence, size_t extraCopyCount);
+void hazyTruthDelivered(HazyTruth* self, uint32_t sequence, MonotonicTimeMs now);
+void hazyTruthDropped(HazyTruth* self, uint32_t sequence, uint8_t cause);
+const HazyTruthRecord* hazyTruthFind(const HazyTruth* self, uint32_t sequence);
+void hazyTruthWindow(const HazyTruth* self, uint32_t firstSequence, uint32_t count, HazyTruthWindow* window);
+void hazyTruthRecentWindow(const HazyTruth* self, uint32_t count, HazyTruthWindow* window);
+
+#endif
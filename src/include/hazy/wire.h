@@ -0,0 +1,33 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#ifndef HAZY_WIRE_H
+#define HAZY_WIRE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct HazyWireConfig {
+    size_t octetsPerSecond;    // link speed, zero sends instantly
+    size_t overheadOctetCount; // added to each packet, e.g. 28 for the IPv4 and UDP headers
+} HazyWireConfig;
+
+/// The link the packets are sent on. Each packet takes time proportional to its size to serialize,
+/// and a packet can not start until the previous one has been sent.
+typedef struct HazyWire {
+    HazyWireConfig config;
+    int64_t busyUntilUs;
+} HazyWire;
+
+void hazyWireInit(HazyWire* self, HazyWireConfig config);
+void hazyWireReset(HazyWire* self);
+void hazyWireSetConfig(HazyWire* self, HazyWireConfig config);
+int64_t hazyWireTransmit(HazyWire* self, size_t octetCount, int64_t nowUs);
+
+HazyWireConfig hazyWireDisabled(void);
+HazyWireConfig hazyWireGoodCondition(void);
+HazyWireConfig hazyWireRecommended(void);
+HazyWireConfig hazyWireWorstCase(void);
+
+#endif
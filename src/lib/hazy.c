@@ -2,13 +2,11 @@
  *  Copyright (c) Peter Bjorklund. All rights reserved.
  *  Licensed under the MIT License. See LICENSE in the project root for license information.
  *--------------------------------------------------------------------------------------------*/
+#include "hazy_atomic.h"
 #include <clog/clog.h>
 #include <datagram-transport/transport.h>
 #include <hazy/hazy.h>
 #include <imprint/allocator.h>
-#include <inttypes.h>
-
-#define HAZY_LOG_ENABLE (0)
 
 void hazyInit(Hazy* self, size_t capacity, ImprintAllocator* allocator, ImprintAllocatorWithFree* allocatorWithFree,
               HazyConfig config, Clog log)
@@ -24,14 +22,37 @@ void hazyInit(Hazy* self, size_t capacity, ImprintAllocator* allocator, ImprintA
     hazyDirectionInit(&self->in, capacity, allocatorWithFree, config.in, self->in.log);
 
     discoidBufferInit(&self->receiveBuffer, allocator, 32 * 1024);
+    hazyScenarioPlayerInit(&self->scenarioPlayer, 0);
+    self->sampler = 0;
+    self->publishedConfig = 0;
 
     self->log = log;
 }
 
+/// Discards all queued packets, including the ones that are ready to be read
+/// @param self hazy
 void hazyReset(Hazy* self)
 {
     hazyDirectionReset(&self->out);
     hazyDirectionReset(&self->in);
+
+    uint8_t discard[256];
+    while (discoidBufferReadAvailable(&self->receiveBuffer) > 0) {
+        size_t count = discoidBufferReadAvailable(&self->receiveBuffer);
+        if (count > sizeof(discard)) {
+            count = sizeof(discard);
+        }
+        discoidBufferRead(&self->receiveBuffer, discard, count);
+    }
+}
+
+/// Seeds the random generators, so the simulation is reproducible
+/// @param self hazy
+/// @param seed seed
+void hazySetSeed(Hazy* self, uint64_t seed)
+{
+    hazyDirectionSetSeed(&self->out, seed);
+    hazyDirectionSetSeed(&self->in, hazyRandomMix(seed));
 }
 
 void hazySetConfig(Hazy* self, HazyConfig config)
@@ -40,48 +61,138 @@ void hazySetConfig(Hazy* self, HazyConfig config)
     hazyDirectionSetConfig(&self->out, config.out);
 }
 
-static int hazySend(HazyPackets* self, DatagramTransport* socket, Clog* log)
+/// Plays the scenario from the next update. The scenario config changes are applied without
+/// resetting the latency drift, so changes are smooth. Set to NULL to stop the scenario.
+/// @param self hazy
+/// @param scenario scenario to play. Must be kept alive while playing.
+void hazySetScenario(Hazy* self, const HazyScenario* scenario)
 {
-    (void) log;
+    hazyScenarioPlayerInit(&self->scenarioPlayer, scenario);
+}
 
-    while (1) {
-        HazyPacket* packet = hazyPacketsFindPacketToActOn(self);
-        if (packet == 0) {
-            break;
-        }
+/// Samples the simulated network state on each hazyUpdate(), see HazySampler
+/// @param self hazy
+/// @param sampler sampler, or NULL to stop sampling
+void hazySetSampler(Hazy* self, HazySampler* sampler)
+{
+    self->sampler = sampler;
+}
 
-        CLOG_C_VERBOSE(log, "send index:%d %" PRId64 " ms %zu", packet->indexForDebug, packet->timeToAct,
-                       packet->octetCount)
-        int errorCode = datagramTransportSend(socket, packet->data, packet->octetCount);
-        if (errorCode < 0) {
-            return errorCode;
-        }
-        hazyPacketsDestroyPacket(self, (HazyPacket*) packet);
+/// Records the events for both directions into a trace ring. The events have directionId
+/// HAZY_TRACE_DIRECTION_OUT or HAZY_TRACE_DIRECTION_IN.
+/// @param self hazy
+/// @param trace trace ring, or NULL to stop tracing
+void hazySetTrace(Hazy* self, HazyTrace* trace)
+{
+    hazyDirectionSetTrace(&self->out, trace, HAZY_TRACE_DIRECTION_OUT);
+    hazyDirectionSetTrace(&self->in, trace, HAZY_TRACE_DIRECTION_IN);
+}
+
+/// Records the packets of both directions into a capture ring. The out direction is pcapng interface 0
+/// and the in direction is interface 1.
+/// @param self hazy
+/// @param capture capture ring, or NULL to stop capturing
+void hazySetCapture(Hazy* self, HazyCapture* capture)
+{
+    hazyDirectionSetCapture(&self->out, capture, HAZY_TRACE_DIRECTION_OUT);
+    hazyDirectionSetCapture(&self->in, capture, HAZY_TRACE_DIRECTION_IN);
+}
+
+/// Records the true delay and fate of each packet, for scoring the estimates of an application
+/// @param self hazy
+/// @param out truth records for the out direction, or NULL
+/// @param in truth records for the in direction, or NULL
+void hazySetTruth(Hazy* self, HazyTruth* out, HazyTruth* in)
+{
+    hazyDirectionSetTruth(&self->out, out);
+    hazyDirectionSetTruth(&self->in, in);
+}
+
+void hazyConfigSnapshotInit(HazyConfigSnapshot* self, HazyConfig config)
+{
+    hazyDirectionConfigSnapshotInit(&self->in, config.in);
+    hazyDirectionConfigSnapshotInit(&self->out, config.out);
+    self->isConsumed = 0;
+}
+
+/// Checks if the update thread is done with the snapshot, so it can be reused or freed.
+/// @param self snapshot
+/// @return true if consumed
+bool hazyConfigSnapshotIsConsumed(const HazyConfigSnapshot* self)
+{
+    return hazyAtomicLoadInt(&self->isConsumed) != 0;
+}
+
+/// Publishes a config from another thread than the one updating Hazy. It is picked up
+/// at the next write or update, without resetting the latency drift.
+/// The snapshot must be kept alive until hazyConfigSnapshotIsConsumed() returns true.
+/// @param self hazy
+/// @param snapshot snapshot initialized with hazyConfigSnapshotInit()
+/// @return a previously published snapshot that was never picked up (and can be reused), or NULL
+HazyConfigSnapshot* hazyPublishConfig(Hazy* self, HazyConfigSnapshot* snapshot)
+{
+    return hazyAtomicExchangePointer((void**) &self->publishedConfig, snapshot);
+}
+
+static void hazyPickUpPublishedConfig(Hazy* self)
+{
+    if (hazyAtomicLoadPointer((void* const*) &self->publishedConfig) == 0) {
+        return;
     }
 
-    return 0;
+    HazyConfigSnapshot* snapshot = hazyAtomicExchangePointer((void**) &self->publishedConfig, 0);
+    if (snapshot == 0) {
+        return;
+    }
+
+    hazyDirectionApplySnapshot(&self->in, &snapshot->in);
+    hazyDirectionApplySnapshot(&self->out, &snapshot->out);
+    hazyAtomicStoreInt(&snapshot->isConsumed, 1);
 }
 
-static int hazyPacketsFeed(HazyPackets* self, const uint8_t* buf, size_t octetsRead, MonotonicTimeMs proposedTime,
-                           Clog* log)
+static void hazyUpdateScenario(Hazy* self, MonotonicTimeMs now)
 {
-    HazyPacket* packet = hazyPacketsWrite(self, buf, octetsRead, proposedTime, log);
+    HazyDirectionConfig in;
+    HazyDirectionConfig out;
 
-#if HAZY_LOG_ENABLE
+    if (!hazyScenarioPlayerUpdate(&self->scenarioPlayer, now, &in, &out)) {
+        return;
+    }
 
-    CLOG_C_VERBOSE(log, "feed packet %d octetCount: %zu, latency: %lu time:%lu", packet->indexForDebug,
-                   packet->octetCount, randomMillisecondsLatency, now)
+    hazyDirectionAdjustConfig(&self->in, in);
+    hazyDirectionAdjustConfig(&self->out, out);
+}
 
-#else
-    (void) packet;
-#endif
+static int hazySend(HazyDirection* self, DatagramTransport* socket, MonotonicTimeMs now)
+{
+    HazyPacket packet;
+    while (hazyPacketsFindPacketToActOn(&self->packets, now, &packet)) {
+        int errorCode = datagramTransportSend(socket, packet.data, packet.octetCount);
+        if (errorCode < 0) {
+            return errorCode;
+        }
+        hazyDirectionPacketDelivered(self, &packet, now);
+        hazyPacketsDestroyPacket(&self->packets, &packet);
+    }
 
     return 0;
 }
 
 int hazyWrite(Hazy* self, const uint8_t* data, size_t octetLength)
 {
-    return hazyWriteDirection(&self->out, data, octetLength);
+    return hazyWriteAt(self, data, octetLength, monotonicTimeMsNow());
+}
+
+/// Writes an outgoing packet at an explicit time, e.g. from a virtual clock
+/// @param self hazy
+/// @param data packet payload
+/// @param octetLength packet size
+/// @param now current time
+/// @return negative on error
+int hazyWriteAt(Hazy* self, const uint8_t* data, size_t octetLength, MonotonicTimeMs now)
+{
+    hazyPickUpPublishedConfig(self);
+    return hazyWriteDirectionAt(&self->out, data, octetLength, now);
 }
 
 static ssize_t hazyReadFromUdp(HazyDirection* self, DatagramTransport* socket)
@@ -92,53 +203,69 @@ static ssize_t hazyReadFromUdp(HazyDirection* self, DatagramTransport* socket)
         return octetsRead;
     }
 
-#if HAZY_LOG_ENABLE || 1
-    CLOG_C_VERBOSE(&self->log, "read from transport %zd", octetsRead)
-#endif
-
     return hazyWriteDirection(self, buf, (size_t) octetsRead);
 }
 
-static void movePacketsToIncomingBuffer(Hazy* self)
+static void movePacketsToIncomingBuffer(Hazy* self, MonotonicTimeMs now)
 {
-    while (1) {
-        HazyPacket* packet = hazyPacketsFindPacketToActOn(&self->in.packets);
-        if (packet == 0) {
-            return;
-        }
+    HazyPacket packet;
+    while (hazyPacketsFindPacketToActOn(&self->in.packets, now, &packet)) {
         DiscoidBuffer* receiveBuffer = &self->receiveBuffer;
 
         const size_t headerSize = 2;
-        size_t neededOctetCount = packet->octetCount + headerSize;
+        size_t neededOctetCount = packet.octetCount + headerSize;
         if (discoidBufferWriteAvailable(receiveBuffer) < neededOctetCount) {
             CLOG_C_NOTICE(&self->log, "receive buffer is full, so intentionally dropping package")
+            hazyDirectionPacketDropped(&self->in, &packet, HazyTraceDropCauseReceiveBuffer, now);
         } else {
-            uint16_t serializeOctetCount = (uint16_t) packet->octetCount;
+            uint16_t serializeOctetCount = (uint16_t) packet.octetCount;
             //            int64_t monotonicTime = packet->timeToAct;
             discoidBufferWrite(receiveBuffer, (const uint8_t*) &serializeOctetCount, 2);
-            discoidBufferWrite(receiveBuffer, packet->data, packet->octetCount);
+            discoidBufferWrite(receiveBuffer, packet.data, packet.octetCount);
+            hazyDirectionPacketDelivered(&self->in, &packet, now);
         }
 
-        hazyPacketsDestroyPacket(&self->in.packets, packet);
+        hazyPacketsDestroyPacket(&self->in.packets, &packet);
     }
 }
 
 void hazyUpdate(Hazy* self)
 {
-    MonotonicTimeMs now = monotonicTimeMsNow();
-    hazyLatencyUpdate(&self->in.latency, now);
-    hazyDirectionUpdate(&self->in, now);
+    hazyUpdateAt(self, monotonicTimeMsNow());
+}
 
-    hazyLatencyUpdate(&self->out.latency, now);
+/// Updates at an explicit time, e.g. from a virtual clock. The time must not go backwards.
+/// @param self hazy
+/// @param now current time
+void hazyUpdateAt(Hazy* self, MonotonicTimeMs now)
+{
+    hazyPickUpPublishedConfig(self);
+    hazyUpdateScenario(self, now);
+
+    hazyDirectionUpdate(&self->in, now);
     hazyDirectionUpdate(&self->out, now);
 
-    movePacketsToIncomingBuffer(self);
+    movePacketsToIncomingBuffer(self, now);
+
+    if (self->sampler != 0) {
+        hazySamplerUpdate(self->sampler, &self->out, &self->in, now);
+    }
+}
+
+/// Updates and sends the outgoing packets that are due, but does not receive.
+/// @param self hazy
+/// @param socket transport to send to
+/// @return negative on error
+int hazyUpdateAndSend(Hazy* self, DatagramTransport* socket)
+{
+    MonotonicTimeMs now = monotonicTimeMsNow();
+    hazyUpdateAt(self, now);
+    return hazySend(&self->out, socket, now);
 }
 
 ssize_t hazyUpdateAndCommunicate(Hazy* self, DatagramTransport* socket)
 {
-    hazyUpdate(self);
-    hazySend(&self->out.packets, socket, &self->out.log);
+    hazyUpdateAndSend(self, socket);
 
     for (size_t i = 0; i < 30; ++i) {
         ssize_t result = hazyReadFromUdp(&self->in, socket);
@@ -152,7 +279,19 @@ ssize_t hazyUpdateAndCommunicate(Hazy* self, DatagramTransport* socket)
 
 int hazyFeedRead(Hazy* self, const uint8_t* data, size_t capacity)
 {
-    return hazyPacketsFeed(&self->in.packets, data, capacity, self->in.latency.latency, &self->in.log);
+    return hazyFeedReadAt(self, data, capacity, monotonicTimeMsNow());
+}
+
+/// Feeds an incoming packet through the in direction, at an explicit time
+/// @param self hazy
+/// @param data packet payload
+/// @param octetCount packet size
+/// @param now current time
+/// @return negative on error
+int hazyFeedReadAt(Hazy* self, const uint8_t* data, size_t octetCount, MonotonicTimeMs now)
+{
+    hazyPickUpPublishedConfig(self);
+    return hazyWriteDirectionAt(&self->in, data, octetCount, now);
 }
 
 int hazyRead(Hazy* self, uint8_t* data, size_t capacity)
@@ -178,7 +317,41 @@ int hazyRead(Hazy* self, uint8_t* data, size_t capacity)
 
 int hazyReadSend(Hazy* self, uint8_t* data, size_t capacity)
 {
-    return hazyPacketsRead(&self->out.packets, data, capacity, &self->log);
+    return hazyReadSendAt(self, data, capacity, monotonicTimeMsNow());
+}
+
+/// Reads an outgoing packet that is due at an explicit time
+/// @param self hazy
+/// @param data target buffer
+/// @param capacity target buffer size
+/// @param now current time
+/// @return the packet size, zero if no packet is due, or negative on error
+int hazyReadSendAt(Hazy* self, uint8_t* data, size_t capacity, MonotonicTimeMs now)
+{
+    HazyPacket packet;
+    if (!hazyPacketsFindPacketToActOn(&self->out.packets, now, &packet)) {
+        return 0;
+    }
+
+    int returnValue = (int) packet.octetCount;
+    if (packet.octetCount <= capacity) {
+        tc_memcpy_octets(data, packet.data, packet.octetCount);
+        hazyDirectionPacketDelivered(&self->out, &packet, now);
+    } else {
+        CLOG_C_WARN(&self->log, "couldn't copy to target, capacity too small")
+        returnValue = -4;
+    }
+    hazyPacketsDestroyPacket(&self->out.packets, &packet);
+
+    return returnValue;
+}
+
+/// Checks if a config has no impairment in either direction
+/// @param config config
+/// @return true if datagrams can be forwarded as is
+bool hazyConfigIsPassthrough(const HazyConfig* config)
+{
+    return hazyDirectionConfigIsPassthrough(&config->in) && hazyDirectionConfigIsPassthrough(&config->out);
 }
 
 HazyConfig hazyConfigGoodCondition(void)
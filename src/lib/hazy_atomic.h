@@ -0,0 +1,114 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#ifndef HAZY_ATOMIC_H
+#define HAZY_ATOMIC_H
+
+#include <stddef.h>
+
+// C99 has no atomics, so use the compiler intrinsics
+
+#if defined _MSC_VER
+
+#include <intrin.h>
+
+// Plain loads and stores are acquire and release on x86 and x64, so only the compiler has to be kept from
+// reordering them. ARM needs a hardware barrier as well.
+static inline void hazyAtomicFence(void)
+{
+    _ReadWriteBarrier();
+#if defined _M_ARM64
+    __dmb(_ARM64_BARRIER_ISH);
+#elif defined _M_ARM
+    __dmb(_ARM_BARRIER_ISH);
+#endif
+}
+
+static inline void* hazyAtomicExchangePointer(void** target, void* value)
+{
+    return _InterlockedExchangePointer((void* volatile*) target, value);
+}
+
+static inline void* hazyAtomicLoadPointer(void* const* target)
+{
+    void* value = *(void* const volatile*) target;
+    hazyAtomicFence();
+    return value;
+}
+
+static inline int hazyAtomicLoadInt(const int* target)
+{
+    int value = *(const volatile int*) target;
+    hazyAtomicFence();
+    return value;
+}
+
+static inline void hazyAtomicStoreInt(int* target, int value)
+{
+    hazyAtomicFence();
+    *(volatile int*) target = value;
+}
+
+static inline size_t hazyAtomicLoadSize(const size_t* target)
+{
+    size_t value = *(const volatile size_t*) target;
+    hazyAtomicFence();
+    return value;
+}
+
+static inline void hazyAtomicStoreSize(size_t* target, size_t value)
+{
+    hazyAtomicFence();
+    *(volatile size_t*) target = value;
+}
+
+static inline size_t hazyAtomicFetchAddSize(size_t* target, size_t value)
+{
+#if defined _WIN64
+    return (size_t) _InterlockedExchangeAdd64((volatile __int64*) target, (__int64) value);
+#else
+    return (size_t) _InterlockedExchangeAdd((volatile long*) target, (long) value);
+#endif
+}
+
+#else
+
+static inline void* hazyAtomicExchangePointer(void** target, void* value)
+{
+    return __atomic_exchange_n(target, value, __ATOMIC_ACQ_REL);
+}
+
+static inline void* hazyAtomicLoadPointer(void* const* target)
+{
+    return __atomic_load_n(target, __ATOMIC_ACQUIRE);
+}
+
+static inline int hazyAtomicLoadInt(const int* target)
+{
+    return __atomic_load_n(target, __ATOMIC_ACQUIRE);
+}
+
+static inline void hazyAtomicStoreInt(int* target, int value)
+{
+    __atomic_store_n(target, value, __ATOMIC_RELEASE);
+}
+
+static inline size_t hazyAtomicLoadSize(const size_t* target)
+{
+    return __atomic_load_n(target, __ATOMIC_ACQUIRE);
+}
+
+static inline void hazyAtomicStoreSize(size_t* target, size_t value)
+{
+    __atomic_store_n(target, value, __ATOMIC_RELEASE);
+}
+
+static inline size_t hazyAtomicFetchAddSize(size_t* target, size_t value)
+{
+    return __atomic_fetch_add(target, value, __ATOMIC_ACQ_REL);
+}
+
+#endif
+
+#endif
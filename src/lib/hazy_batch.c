@@ -0,0 +1,245 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include "hazy_atomic.h"
+#include <hazy/batch.h>
+#include <imprint/allocator.h>
+#include <inttypes.h>
+
+#if defined TORNADO_OS_WINDOWS || defined __EMSCRIPTEN__
+#define HAZY_BATCH_USE_THREADS (0)
+#else
+#define HAZY_BATCH_USE_THREADS (1)
+#include <pthread.h>
+#endif
+
+#define HAZY_BATCH_MAX_WORKER_COUNT (64)
+
+// Simulated time between two runs on the same worker, so nothing from the previous run is due
+#define HAZY_BATCH_TIME_BETWEEN_RUNS_MS (60 * 1000)
+
+typedef struct HazyBatchShared {
+    const HazyBatchConfig* config;
+    HazyBatchCallbacks callbacks;
+    HazyBatchRunResult* runResults;
+    size_t nextRunIndex;
+} HazyBatchShared;
+
+typedef struct HazyBatchWorkerState {
+    HazyBatchShared* shared;
+    Hazy* hazy;
+    MonotonicTimeMs clockMs;
+} HazyBatchWorkerState;
+
+/// The seed for a run only depends on the base seed and the run index, not on the worker that runs it
+/// @param baseSeed the seed for the batch
+/// @param runIndex run index
+/// @return seed for the run
+uint64_t hazyBatchRunSeed(uint64_t baseSeed, size_t runIndex)
+{
+    return hazyRandomMix(baseSeed + (uint64_t) runIndex);
+}
+
+static MonotonicTimeMs hazyBatchRunTime(const HazyBatchRun* run)
+{
+    return run->startMs + run->now;
+}
+
+static int hazyBatchClientSend(void* self_, const uint8_t* data, size_t size)
+{
+    HazyBatchRun* run = self_;
+    return hazyWriteAt(run->hazy, data, size, hazyBatchRunTime(run));
+}
+
+static ssize_t hazyBatchClientReceive(void* self_, uint8_t* data, size_t size)
+{
+    HazyBatchRun* run = self_;
+    return hazyRead(run->hazy, data, size);
+}
+
+static int hazyBatchServerSend(void* self_, const uint8_t* data, size_t size)
+{
+    HazyBatchRun* run = self_;
+    return hazyFeedReadAt(run->hazy, data, size, hazyBatchRunTime(run));
+}
+
+static ssize_t hazyBatchServerReceive(void* self_, uint8_t* data, size_t size)
+{
+    HazyBatchRun* run = self_;
+    return hazyReadSendAt(run->hazy, data, size, hazyBatchRunTime(run));
+}
+
+static void hazyBatchExecuteRun(HazyBatchWorkerState* worker, size_t runIndex)
+{
+    const HazyBatchConfig* config = worker->shared->config;
+    const HazyBatchCallbacks* callbacks = &worker->shared->callbacks;
+    Hazy* hazy = worker->hazy;
+
+    HazyBatchRun run;
+    run.index = runIndex;
+    run.seed = hazyBatchRunSeed(config->baseSeed, runIndex);
+    run.hazy = hazy;
+    run.client.self = &run;
+    run.client.send = hazyBatchClientSend;
+    run.client.receive = hazyBatchClientReceive;
+    run.server.self = &run;
+    run.server.send = hazyBatchServerSend;
+    run.server.receive = hazyBatchServerReceive;
+    run.now = 0;
+    run.startMs = worker->clockMs;
+    run.userState = 0;
+
+    hazySetConfig(hazy, config->hazyConfig);
+    hazyReset(hazy);
+    hazySetSeed(hazy, run.seed);
+    hazySetScenario(hazy, config->scenario);
+    tc_memset_octets(&hazy->out.stats, 0, sizeof(hazy->out.stats));
+    tc_memset_octets(&hazy->in.stats, 0, sizeof(hazy->in.stats));
+
+    if (callbacks->runInit != 0) {
+        run.userState = callbacks->runInit(callbacks->userData, &run);
+    }
+
+    int errorCode = 0;
+    for (; run.now < config->durationMs; run.now += config->stepMs) {
+        hazyUpdateAt(hazy, hazyBatchRunTime(&run));
+        errorCode = callbacks->runStep(callbacks->userData, &run);
+        if (errorCode < 0) {
+            CLOG_C_NOTICE(&hazy->log, "run %zu stopped at %" PRId64 " ms: %d", runIndex, run.now, errorCode)
+            break;
+        }
+    }
+
+    if (callbacks->runDestroy != 0) {
+        callbacks->runDestroy(callbacks->userData, &run);
+    }
+
+    HazyBatchRunResult* result = &worker->shared->runResults[runIndex];
+    result->seed = run.seed;
+    result->out = hazy->out.stats;
+    result->in = hazy->in.stats;
+    result->errorCode = errorCode < 0 ? errorCode : 0;
+
+    worker->clockMs = hazyBatchRunTime(&run) + HAZY_BATCH_TIME_BETWEEN_RUNS_MS;
+}
+
+static void* hazyBatchWorkerThread(void* self_)
+{
+    HazyBatchWorkerState* worker = self_;
+    HazyBatchShared* shared = worker->shared;
+
+    while (true) {
+        size_t runIndex = hazyAtomicFetchAddSize(&shared->nextRunIndex, 1);
+        if (runIndex >= shared->config->runCount) {
+            break;
+        }
+        hazyBatchExecuteRun(worker, runIndex);
+    }
+
+    return 0;
+}
+
+static void hazyBatchSummarize(HazyBatchDirectionSummary* summary, const HazyDirectionStats* stats)
+{
+    summary->writtenPacketCount += stats->writtenPacketCount;
+    summary->deliveredPacketCount += stats->deliveredPacketCount;
+    summary->droppedPacketCount += stats->droppedPacketCount;
+    summary->meanDelayMs += (double) stats->deliveredDelayMsSum;
+    if (stats->maxDeliveredDelayMs > summary->maxDelayMs) {
+        summary->maxDelayMs = stats->maxDeliveredDelayMs;
+    }
+}
+
+static void hazyBatchSummaryFinish(HazyBatchDirectionSummary* summary)
+{
+    if (summary->deliveredPacketCount > 0) {
+        summary->meanDelayMs /= (double) summary->deliveredPacketCount;
+    }
+
+    // Duplicated packets can make more packets be delivered than were written, so compare to the dropped ones
+    uint64_t handledPacketCount = summary->deliveredPacketCount + summary->droppedPacketCount;
+    if (handledPacketCount > 0) {
+        summary->lossRatio = (double) summary->droppedPacketCount / (double) handledPacketCount;
+    }
+}
+
+/// Runs many independent simulations on a simulated clock, spread over one thread per worker.
+/// Each worker allocates one Hazy from its allocators, which is reused for all the runs it takes.
+/// A run gets the same seed and the same result, regardless of the worker count.
+/// @param config batch config
+/// @param callbacks called on the worker threads for each run
+/// @param workers the allocators for each worker
+/// @param workerCount number of workers, and threads
+/// @param runResults array of config->runCount results
+/// @param result the aggregated result of all runs
+/// @return negative on error
+int hazyBatchExecute(const HazyBatchConfig* config, HazyBatchCallbacks callbacks, const HazyBatchWorker* workers,
+                     size_t workerCount, HazyBatchRunResult* runResults, HazyBatchResult* result)
+{
+    if (workerCount == 0 || workerCount > HAZY_BATCH_MAX_WORKER_COUNT || config->stepMs <= 0 ||
+        callbacks.runStep == 0) {
+        return -2;
+    }
+
+#if !HAZY_BATCH_USE_THREADS
+    workerCount = 1;
+#endif
+
+    HazyBatchShared shared;
+    shared.config = config;
+    shared.callbacks = callbacks;
+    shared.runResults = runResults;
+    shared.nextRunIndex = 0;
+
+    HazyBatchWorkerState workerStates[HAZY_BATCH_MAX_WORKER_COUNT];
+    for (size_t i = 0; i < workerCount; ++i) {
+        HazyBatchWorkerState* worker = &workerStates[i];
+        worker->shared = &shared;
+        worker->hazy = IMPRINT_ALLOC_TYPE(workers[i].allocator, Hazy);
+        worker->clockMs = 1;
+        hazyInit(worker->hazy, HAZY_PACKETS_CAPACITY, workers[i].allocator, workers[i].allocatorWithFree, config->hazyConfig,
+                 config->log);
+    }
+
+#if HAZY_BATCH_USE_THREADS
+    pthread_t threads[HAZY_BATCH_MAX_WORKER_COUNT];
+    bool isStarted[HAZY_BATCH_MAX_WORKER_COUNT];
+    for (size_t i = 1; i < workerCount; ++i) {
+        isStarted[i] = pthread_create(&threads[i], 0, hazyBatchWorkerThread, &workerStates[i]) == 0;
+        if (!isStarted[i]) {
+            CLOG_C_WARN(&config->log, "could not start batch worker %zu", i)
+        }
+    }
+#endif
+
+    // The calling thread is the first worker
+    hazyBatchWorkerThread(&workerStates[0]);
+
+#if HAZY_BATCH_USE_THREADS
+    for (size_t i = 1; i < workerCount; ++i) {
+        if (isStarted[i]) {
+            pthread_join(threads[i], 0);
+        }
+    }
+#endif
+
+    for (size_t i = 0; i < workerCount; ++i) {
+        hazyReset(workerStates[i].hazy);
+    }
+
+    tc_memset_octets(result, 0, sizeof(*result));
+    result->runCount = config->runCount;
+    for (size_t i = 0; i < config->runCount; ++i) {
+        const HazyBatchRunResult* runResult = &runResults[i];
+        if (runResult->errorCode < 0) {
+            result->failedRunCount++;
+        }
+        hazyBatchSummarize(&result->out, &runResult->out);
+        hazyBatchSummarize(&result->in, &runResult->in);
+    }
+    hazyBatchSummaryFinish(&result->out);
+    hazyBatchSummaryFinish(&result->in);
+
+    return 0;
+}
@@ -0,0 +1,208 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include <hazy/bottleneck.h>
+#include <math.h>
+
+void hazyBottleneckInit(HazyBottleneck* self, HazyBottleneckConfig config, Clog log)
+{
+    self->log = log;
+    self->config = config;
+    hazyRandomInit(&self->random, 0);
+    hazyBottleneckReset(self);
+}
+
+void hazyBottleneckReset(HazyBottleneck* self)
+{
+    self->busyUntilUs = 0;
+    self->redAverageOctetCount = 0.0f;
+    self->codelIsDropping = false;
+    self->codelFirstAboveTimeUs = 0;
+    self->codelDropNextUs = 0;
+    self->codelDropCount = 0;
+    self->codelLastDropCount = 0;
+}
+
+/// Changes the config, the octets already in the queue are kept.
+/// @param self bottleneck
+/// @param config new config
+void hazyBottleneckSetConfig(HazyBottleneck* self, HazyBottleneckConfig config)
+{
+    self->config = config;
+}
+
+static int64_t transmitTimeUs(const HazyBottleneck* self, size_t octetCount)
+{
+    return (int64_t) (((uint64_t) octetCount * 1000000u) / self->config.octetsPerSecond);
+}
+
+size_t hazyBottleneckQueuedOctetCount(const HazyBottleneck* self, int64_t nowUs)
+{
+    if (self->config.octetsPerSecond == 0 || self->busyUntilUs <= nowUs) {
+        return 0;
+    }
+
+    return (size_t) (((uint64_t) (self->busyUntilUs - nowUs) * self->config.octetsPerSecond) / 1000000u);
+}
+
+/// Random Early Detection. Drops with a chance that grows with the average queue size.
+static bool redShouldDrop(HazyBottleneck* self, size_t queuedOctetCount, int64_t arrivalUs)
+{
+    const float weight = 0.002f;
+    const size_t typicalPacketOctetCount = 500;
+
+    if (self->config.redMaxThresholdOctets == 0) {
+        return false;
+    }
+
+    if (queuedOctetCount == 0) {
+        // The average should decay while idle, as if small packets had been arriving to an empty queue
+        int64_t typicalTransmitUs = transmitTimeUs(self, typicalPacketOctetCount) + 1;
+        float idlePacketCount = (float) (arrivalUs - self->busyUntilUs) / (float) typicalTransmitUs;
+        self->redAverageOctetCount *= powf(1.0f - weight, idlePacketCount);
+    } else {
+        self->redAverageOctetCount += weight * ((float) queuedOctetCount - self->redAverageOctetCount);
+    }
+
+    float minThreshold = (float) self->config.redMinThresholdOctets;
+    float maxThreshold = (float) self->config.redMaxThresholdOctets;
+
+    if (self->redAverageOctetCount < minThreshold) {
+        return false;
+    }
+
+    if (self->redAverageOctetCount >= maxThreshold) {
+        return true;
+    }
+
+    float dropPerMille = (float) self->config.redMaxDropPerMille * (self->redAverageOctetCount - minThreshold) /
+                         (maxThreshold - minThreshold);
+
+    return (float) hazyRandomRange(&self->random, 1000) < dropPerMille;
+}
+
+static int64_t codelControlLaw(const HazyBottleneck* self, int64_t timeUs, int64_t intervalUs)
+{
+    return timeUs + (int64_t) ((float) intervalUs / sqrtf((float) self->codelDropCount));
+}
+
+/// CoDel (RFC 8289). Since the queue is drained at a constant rate, the sojourn time is known
+/// when the packet is enqueued, so the dequeue decision can be made up front.
+static bool codelShouldDrop(HazyBottleneck* self, int64_t sojournUs, size_t queuedOctetCount, int64_t dequeueUs)
+{
+    const size_t maxPacketOctetCount = 1500;
+    int64_t targetUs = (int64_t) self->config.codelTargetMs * 1000;
+    int64_t intervalUs = (int64_t) self->config.codelIntervalMs * 1000;
+
+    bool okToDrop = false;
+    if (sojournUs < targetUs || queuedOctetCount <= maxPacketOctetCount) {
+        self->codelFirstAboveTimeUs = 0;
+    } else if (self->codelFirstAboveTimeUs == 0) {
+        self->codelFirstAboveTimeUs = dequeueUs + intervalUs;
+    } else if (dequeueUs >= self->codelFirstAboveTimeUs) {
+        okToDrop = true;
+    }
+
+    if (self->codelIsDropping) {
+        if (!okToDrop) {
+            self->codelIsDropping = false;
+            return false;
+        }
+        if (dequeueUs < self->codelDropNextUs) {
+            return false;
+        }
+        self->codelDropCount++;
+        self->codelDropNextUs = codelControlLaw(self, self->codelDropNextUs, intervalUs);
+        return true;
+    }
+
+    if (!okToDrop) {
+        return false;
+    }
+
+    self->codelIsDropping = true;
+    size_t delta = self->codelDropCount > self->codelLastDropCount
+                       ? self->codelDropCount - self->codelLastDropCount
+                       : 0;
+    bool recentlyDropping = dequeueUs - self->codelDropNextUs < 16 * intervalUs;
+    self->codelDropCount = (delta > 1 && recentlyDropping) ? delta : 1;
+    self->codelDropNextUs = codelControlLaw(self, dequeueUs, intervalUs);
+    self->codelLastDropCount = self->codelDropCount;
+
+    return true;
+}
+
+/// Enqueues a packet into the bottleneck queue.
+/// @param self bottleneck
+/// @param octetCount packet size
+/// @param arrivalUs the time the packet arrives at the queue
+/// @param departureUs the time the packet has been transmitted on the link
+/// @return HazyBottleneckResultQueued if the packet was queued, otherwise the reason for the drop
+HazyBottleneckResult hazyBottleneckEnqueue(HazyBottleneck* self, size_t octetCount, int64_t arrivalUs,
+                                           int64_t* departureUs)
+{
+    if (self->config.octetsPerSecond == 0) {
+        *departureUs = arrivalUs;
+        return HazyBottleneckResultQueued;
+    }
+
+    size_t queuedOctetCount = hazyBottleneckQueuedOctetCount(self, arrivalUs);
+    int64_t dequeueUs = self->busyUntilUs > arrivalUs ? self->busyUntilUs : arrivalUs;
+
+    switch (self->config.policy) {
+        case HazyBottleneckPolicyTailDrop:
+            break;
+        case HazyBottleneckPolicyRed:
+            if (redShouldDrop(self, queuedOctetCount, arrivalUs)) {
+                return HazyBottleneckResultRedDrop;
+            }
+            break;
+        case HazyBottleneckPolicyCoDel:
+            if (self->config.queueOctetCapacity == 0 ||
+                queuedOctetCount + octetCount <= self->config.queueOctetCapacity) {
+                if (codelShouldDrop(self, dequeueUs - arrivalUs, queuedOctetCount, dequeueUs)) {
+                    return HazyBottleneckResultCoDelDrop;
+                }
+            }
+            break;
+    }
+
+    if (self->config.queueOctetCapacity != 0 && queuedOctetCount + octetCount > self->config.queueOctetCapacity) {
+        return HazyBottleneckResultTailDrop;
+    }
+
+    self->busyUntilUs = dequeueUs + transmitTimeUs(self, octetCount);
+    *departureUs = self->busyUntilUs;
+
+    return HazyBottleneckResultQueued;
+}
+
+HazyBottleneckConfig hazyBottleneckDisabled(void)
+{
+    HazyBottleneckConfig config = {0, 0, HazyBottleneckPolicyTailDrop, 0, 0, 0, 0, 0};
+
+    return config;
+}
+
+HazyBottleneckConfig hazyBottleneckTailDrop(size_t octetsPerSecond, size_t queueOctetCapacity)
+{
+    HazyBottleneckConfig config = {octetsPerSecond, queueOctetCapacity, HazyBottleneckPolicyTailDrop, 0, 0, 0, 0, 0};
+
+    return config;
+}
+
+HazyBottleneckConfig hazyBottleneckRed(size_t octetsPerSecond, size_t queueOctetCapacity)
+{
+    HazyBottleneckConfig config = {octetsPerSecond,        queueOctetCapacity, HazyBottleneckPolicyRed,
+                                   queueOctetCapacity / 4, queueOctetCapacity * 3 / 4, 100, 0, 0};
+
+    return config;
+}
+
+HazyBottleneckConfig hazyBottleneckCoDel(size_t octetsPerSecond, size_t queueOctetCapacity)
+{
+    HazyBottleneckConfig config = {octetsPerSecond, queueOctetCapacity, HazyBottleneckPolicyCoDel, 0, 0, 0, 5, 100};
+
+    return config;
+}
@@ -0,0 +1,327 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include "hazy_atomic.h"
+#include <clog/clog.h>
+#include <hazy/capture.h>
+#include <hazy/decider.h>
+#include <hazy/trace.h>
+#include <imprint/allocator.h>
+#include <inttypes.h>
+
+// pcapng, see https://www.ietf.org/archive/id/draft-ietf-opsawg-pcapng-01.html
+#define HAZY_PCAPNG_SECTION_HEADER_BLOCK (0x0A0D0D0Au)
+#define HAZY_PCAPNG_INTERFACE_DESCRIPTION_BLOCK (1u)
+#define HAZY_PCAPNG_ENHANCED_PACKET_BLOCK (6u)
+#define HAZY_PCAPNG_BYTE_ORDER_MAGIC (0x1A2B3C4Du)
+#define HAZY_PCAPNG_LINKTYPE_RAW (101u) // the packet starts with an IPv4 header
+#define HAZY_PCAPNG_OPTION_COMMENT (1u)
+#define HAZY_PCAPNG_OPTION_IF_NAME (2u)
+
+#define HAZY_CAPTURE_IP_UDP_HEADER_OCTET_COUNT (28)
+#define HAZY_CAPTURE_COMMENT_CAPACITY (160)
+
+/// Initializes the capture ring
+/// @param self capture
+/// @param allocator allocator for the ring
+/// @param octetCapacity ring size, must be a power of two
+/// @return negative on error
+int hazyCaptureInit(HazyCapture* self, struct ImprintAllocator* allocator, size_t octetCapacity)
+{
+    if (octetCapacity < sizeof(HazyCaptureRecord) || (octetCapacity & (octetCapacity - 1)) != 0) {
+        return -2;
+    }
+
+    self->octets = IMPRINT_ALLOC_TYPE_COUNT(allocator, uint8_t, octetCapacity);
+    self->capacityMask = octetCapacity - 1;
+    self->writeIndex = 0;
+    self->readIndex = 0;
+    self->lostRecordCount = 0;
+    self->hasWrittenHeader = false;
+
+    return 0;
+}
+
+static size_t capturedOctetCount(const HazyCaptureRecord* record)
+{
+    return record->octetCount < HAZY_CAPTURE_SNAP_OCTET_COUNT ? record->octetCount : HAZY_CAPTURE_SNAP_OCTET_COUNT;
+}
+
+static size_t recordOctetCount(size_t payloadOctetCount)
+{
+    return sizeof(HazyCaptureRecord) + ((payloadOctetCount + 7u) & ~(size_t) 7u);
+}
+
+static void copyToRing(HazyCapture* self, size_t index, const void* source, size_t octetCount)
+{
+    size_t start = index & self->capacityMask;
+    size_t countUntilWrap = self->capacityMask + 1 - start;
+    if (octetCount <= countUntilWrap) {
+        tc_memcpy_octets(self->octets + start, source, octetCount);
+        return;
+    }
+    tc_memcpy_octets(self->octets + start, source, countUntilWrap);
+    tc_memcpy_octets(self->octets, (const uint8_t*) source + countUntilWrap, octetCount - countUntilWrap);
+}
+
+static void copyFromRing(const HazyCapture* self, size_t index, void* target, size_t octetCount)
+{
+    size_t start = index & self->capacityMask;
+    size_t countUntilWrap = self->capacityMask + 1 - start;
+    if (octetCount <= countUntilWrap) {
+        tc_memcpy_octets(target, self->octets + start, octetCount);
+        return;
+    }
+    tc_memcpy_octets(target, self->octets + start, countUntilWrap);
+    tc_memcpy_octets((uint8_t*) target + countUntilWrap, self->octets, octetCount - countUntilWrap);
+}
+
+/// Copies a record and its payload into the ring. Must only be called from the producer thread.
+/// @param self capture
+/// @param record record
+/// @param payload the datagram, truncated to HAZY_CAPTURE_SNAP_OCTET_COUNT
+void hazyCaptureAdd(HazyCapture* self, const HazyCaptureRecord* record, const uint8_t* payload)
+{
+    size_t payloadOctetCount = capturedOctetCount(record);
+    size_t octetCount = recordOctetCount(payloadOctetCount);
+
+    size_t writeIndex = self->writeIndex;
+    size_t readIndex = hazyAtomicLoadSize(&self->readIndex);
+    if (self->capacityMask + 1 - (writeIndex - readIndex) < octetCount) {
+        self->lostRecordCount++;
+        return;
+    }
+
+    copyToRing(self, writeIndex, record, sizeof(*record));
+    copyToRing(self, writeIndex + sizeof(*record), payload, payloadOctetCount);
+    hazyAtomicStoreSize(&self->writeIndex, writeIndex + octetCount);
+}
+
+static size_t put16(uint8_t* target, uint16_t value)
+{
+    tc_memcpy_octets(target, &value, sizeof(value));
+    return sizeof(value);
+}
+
+static size_t put32(uint8_t* target, uint32_t value)
+{
+    tc_memcpy_octets(target, &value, sizeof(value));
+    return sizeof(value);
+}
+
+static void putNetwork16(uint8_t* target, uint16_t value)
+{
+    target[0] = (uint8_t) (value >> 8);
+    target[1] = (uint8_t) value;
+}
+
+static size_t padTo32(size_t octetCount)
+{
+    return (octetCount + 3u) & ~(size_t) 3u;
+}
+
+/// Writes an option with the value padded to 32 bits
+static size_t putOption(uint8_t* target, uint16_t code, const void* value, size_t octetCount)
+{
+    size_t pos = put16(target, code);
+    pos += put16(target + pos, (uint16_t) octetCount);
+    tc_memcpy_octets(target + pos, value, octetCount);
+    tc_memset_octets(target + pos + octetCount, 0, padTo32(octetCount) - octetCount);
+
+    return pos + padTo32(octetCount);
+}
+
+static void writeInterfaceDescription(FILE* fp, const char* name)
+{
+    uint8_t block[64];
+    size_t pos = put32(block, HAZY_PCAPNG_INTERFACE_DESCRIPTION_BLOCK);
+    pos += put32(block + pos, 0);
+    pos += put16(block + pos, HAZY_PCAPNG_LINKTYPE_RAW);
+    pos += put16(block + pos, 0);
+    pos += put32(block + pos, 0); // no snap length
+    pos += putOption(block + pos, HAZY_PCAPNG_OPTION_IF_NAME, name, tc_strlen(name));
+    pos += put32(block + pos, 0); // opt_endofopt
+    pos += put32(block + pos, (uint32_t) (pos + 4));
+    put32(block + 4, (uint32_t) pos);
+
+    fwrite(block, 1, pos, fp);
+}
+
+static void writeHeader(FILE* fp)
+{
+    uint8_t block[28];
+    size_t pos = put32(block, HAZY_PCAPNG_SECTION_HEADER_BLOCK);
+    pos += put32(block + pos, sizeof(block));
+    pos += put32(block + pos, HAZY_PCAPNG_BYTE_ORDER_MAGIC);
+    pos += put16(block + pos, 1);
+    pos += put16(block + pos, 0);
+    pos += put32(block + pos, UINT32_MAX); // unknown section length, as a 64 bit -1
+    pos += put32(block + pos, UINT32_MAX);
+    put32(block + pos, sizeof(block));
+    fwrite(block, 1, sizeof(block), fp);
+
+    // The interface ids match HAZY_TRACE_DIRECTION_OUT and HAZY_TRACE_DIRECTION_IN
+    writeInterfaceDescription(fp, "hazy-out");
+    writeInterfaceDescription(fp, "hazy-in");
+}
+
+/// Synthesizes IPv4 and UDP headers, from 10.0.0.1:50000 to 10.0.0.2:50001 for the out direction.
+/// Datagrams that do not fit in an IPv4 packet get the largest lengths instead of wrapped ones.
+static void putIpUdpHeaders(uint8_t* target, const HazyCaptureRecord* record)
+{
+    size_t ipOctetCount = HAZY_CAPTURE_IP_UDP_HEADER_OCTET_COUNT + (size_t) record->octetCount;
+    if (ipOctetCount > UINT16_MAX) {
+        ipOctetCount = UINT16_MAX;
+    }
+    size_t udpOctetCount = ipOctetCount - 20;
+    bool isOut = record->interfaceId == 0;
+
+    tc_memset_octets(target, 0, HAZY_CAPTURE_IP_UDP_HEADER_OCTET_COUNT);
+    target[0] = 0x45;
+    putNetwork16(target + 2, (uint16_t) ipOctetCount);
+    putNetwork16(target + 4, (uint16_t) record->sequence);
+    target[8] = 64;
+    target[9] = 17;
+    uint8_t client[4] = {10, 0, 0, 1};
+    uint8_t server[4] = {10, 0, 0, 2};
+    tc_memcpy_octets(target + 12, isOut ? client : server, 4);
+    tc_memcpy_octets(target + 16, isOut ? server : client, 4);
+
+    uint32_t sum = 0;
+    for (size_t i = 0; i < 20; i += 2) {
+        sum += (uint32_t) ((target[i] << 8) | target[i + 1]);
+    }
+    while (sum > 0xffff) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    putNetwork16(target + 10, (uint16_t) ~sum);
+
+    putNetwork16(target + 20, isOut ? 50000 : 50001);
+    putNetwork16(target + 22, isOut ? 50001 : 50000);
+    putNetwork16(target + 24, (uint16_t) udpOctetCount);
+}
+
+static const char* decisionName(uint8_t decision)
+{
+    switch ((HazyDecision) decision) {
+        case HazyDecisionDuplicate:
+            return "duplicate";
+        case HazyDecisionDrop:
+            return "drop";
+        case HazyDecisionTamper:
+            return "tamper";
+        case HazyDecisionOriginal:
+            return "original";
+        case HazyDecisionOutOfOrder:
+            return "reorder";
+    }
+
+    return "unknown";
+}
+
+static const char* dropCauseName(uint8_t cause)
+{
+    static const char* names[] = {"decision",       "dropBurst",     "tailDrop",       "redDrop",   "codelDrop",
+                                  "packetCapacity", "receiveBuffer", "overflowOldest", "sendFailed"};
+
+    return cause < sizeof(names) / sizeof(names[0]) ? names[cause] : "unknown";
+}
+
+static size_t formatComment(char* target, const HazyCaptureRecord* record)
+{
+    int count = 0;
+    switch ((HazyCaptureEventType) record->type) {
+        case HazyCaptureEventTypeArrived:
+            count = tc_snprintf(target, HAZY_CAPTURE_COMMENT_CAPACITY, "seq=%u arrived decision=%s",
+                                record->sequence, decisionName(record->value));
+            break;
+        case HazyCaptureEventTypeDropBurst:
+            count = tc_snprintf(target, HAZY_CAPTURE_COMMENT_CAPACITY, "seq=%u arrived during dropBurst",
+                                record->sequence);
+            break;
+        case HazyCaptureEventTypeDelivered:
+            count = tc_snprintf(target, HAZY_CAPTURE_COMMENT_CAPACITY,
+                                "seq=%u delivered arrivedMs=%" PRId64 " timeToActMs=%" PRId64 " deliveredMs=%" PRId64
+                                " delayMs=%" PRId64,
+                                record->sequence, record->arrivedMs, record->timeToActMs, record->timeMs,
+                                record->timeMs - record->arrivedMs);
+            break;
+        case HazyCaptureEventTypeDropped:
+            count = tc_snprintf(target, HAZY_CAPTURE_COMMENT_CAPACITY, "seq=%u dropped cause=%s", record->sequence,
+                                dropCauseName(record->value));
+            break;
+    }
+
+    if (count < 0) {
+        return 0;
+    }
+
+    return (size_t) count < HAZY_CAPTURE_COMMENT_CAPACITY ? (size_t) count : HAZY_CAPTURE_COMMENT_CAPACITY - 1;
+}
+
+static void writeEnhancedPacket(FILE* fp, const HazyCaptureRecord* record, const uint8_t* payload)
+{
+    uint8_t block[32 + HAZY_CAPTURE_IP_UDP_HEADER_OCTET_COUNT + HAZY_CAPTURE_SNAP_OCTET_COUNT + 4 +
+                  HAZY_CAPTURE_COMMENT_CAPACITY + 16];
+
+    size_t payloadOctetCount = capturedOctetCount(record);
+    size_t packetOctetCount = HAZY_CAPTURE_IP_UDP_HEADER_OCTET_COUNT + payloadOctetCount;
+    uint64_t timestampUs = (uint64_t) record->timeMs * 1000u;
+
+    size_t pos = put32(block, HAZY_PCAPNG_ENHANCED_PACKET_BLOCK);
+    pos += put32(block + pos, 0);
+    pos += put32(block + pos, record->interfaceId);
+    pos += put32(block + pos, (uint32_t) (timestampUs >> 32));
+    pos += put32(block + pos, (uint32_t) timestampUs);
+    pos += put32(block + pos, (uint32_t) packetOctetCount);
+    pos += put32(block + pos, (uint32_t) (HAZY_CAPTURE_IP_UDP_HEADER_OCTET_COUNT + record->octetCount));
+
+    putIpUdpHeaders(block + pos, record);
+    tc_memcpy_octets(block + pos + HAZY_CAPTURE_IP_UDP_HEADER_OCTET_COUNT, payload, payloadOctetCount);
+    tc_memset_octets(block + pos + packetOctetCount, 0, padTo32(packetOctetCount) - packetOctetCount);
+    pos += padTo32(packetOctetCount);
+
+    char comment[HAZY_CAPTURE_COMMENT_CAPACITY];
+    size_t commentOctetCount = formatComment(comment, record);
+    pos += putOption(block + pos, HAZY_PCAPNG_OPTION_COMMENT, comment, commentOctetCount);
+    pos += put32(block + pos, 0); // opt_endofopt
+    pos += put32(block + pos, (uint32_t) (pos + 4));
+    put32(block + 4, (uint32_t) pos);
+
+    fwrite(block, 1, pos, fp);
+}
+
+/// Writes the available records as pcapng blocks. The section header is written on the first drain.
+/// Must only be called from the consumer thread.
+/// @param self capture
+/// @param fp file opened in binary mode
+/// @return number of written packets
+size_t hazyCaptureDrainToFile(HazyCapture* self, FILE* fp)
+{
+    if (!self->hasWrittenHeader) {
+        writeHeader(fp);
+        self->hasWrittenHeader = true;
+    }
+
+    size_t readIndex = self->readIndex;
+    size_t writeIndex = hazyAtomicLoadSize(&self->writeIndex);
+
+    size_t writtenCount = 0;
+    while (readIndex != writeIndex) {
+        HazyCaptureRecord record;
+        copyFromRing(self, readIndex, &record, sizeof(record));
+
+        uint8_t payload[HAZY_CAPTURE_SNAP_OCTET_COUNT];
+        size_t payloadOctetCount = capturedOctetCount(&record);
+        copyFromRing(self, readIndex + sizeof(record), payload, payloadOctetCount);
+
+        writeEnhancedPacket(fp, &record, payload);
+        readIndex += recordOctetCount(payloadOctetCount);
+        writtenCount++;
+    }
+
+    hazyAtomicStoreSize(&self->readIndex, readIndex);
+
+    return writtenCount;
+}
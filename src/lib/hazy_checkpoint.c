@@ -0,0 +1,463 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include <hazy/checkpoint.h>
+#include <imprint/allocator.h>
+
+// The blob is a copy of the in-memory state, so it is only valid for the same build and platform
+
+#define HAZY_CHECKPOINT_MAGIC (0x50434b48u)
+
+typedef struct HazyCheckpointWriter {
+    uint8_t* target;
+    size_t capacity;
+    size_t position;
+} HazyCheckpointWriter;
+
+typedef struct HazyCheckpointReader {
+    const uint8_t* source;
+    size_t octetCount;
+    size_t position;
+    bool hasFailed;
+} HazyCheckpointReader;
+
+#define HAZY_CHECKPOINT_WRITE(writer, field) writeOctets(writer, &(field), sizeof(field))
+#define HAZY_CHECKPOINT_READ(reader, field) readOctets(reader, &(field), sizeof(field))
+
+/// Writes as much as fits, but always counts the octets, so the same code finds the needed size
+static void writeOctets(HazyCheckpointWriter* self, const void* data, size_t octetCount)
+{
+    if (self->position + octetCount <= self->capacity) {
+        tc_memcpy_octets(self->target + self->position, data, octetCount);
+    }
+    self->position += octetCount;
+}
+
+static void readOctets(HazyCheckpointReader* self, void* data, size_t octetCount)
+{
+    if (self->hasFailed || self->position + octetCount > self->octetCount) {
+        self->hasFailed = true;
+        tc_memset_octets(data, 0, octetCount);
+        return;
+    }
+    tc_memcpy_octets(data, self->source + self->position, octetCount);
+    self->position += octetCount;
+}
+
+static uint8_t* readPayload(HazyCheckpointReader* self, struct ImprintAllocatorWithFree* allocatorWithFree,
+                            size_t octetCount)
+{
+    // The length comes from the checkpoint, so compare it without adding to the position
+    if (self->hasFailed || octetCount > self->octetCount - self->position) {
+        self->hasFailed = true;
+        return 0;
+    }
+
+    uint8_t* data = IMPRINT_ALLOC_TYPE_COUNT(&allocatorWithFree->allocator, uint8_t, octetCount);
+    readOctets(self, data, octetCount);
+
+    return data;
+}
+
+static void writeHeader(HazyCheckpointWriter* writer)
+{
+    uint32_t magic = HAZY_CHECKPOINT_MAGIC;
+    uint16_t version = HAZY_CHECKPOINT_VERSION;
+    uint16_t packetCapacity = HAZY_PACKETS_CAPACITY;
+    uint16_t reorderSlotCount = HAZY_REORDER_SLOT_COUNT;
+    uint16_t directionOctetCount = (uint16_t) sizeof(HazyDirection);
+
+    HAZY_CHECKPOINT_WRITE(writer, magic);
+    HAZY_CHECKPOINT_WRITE(writer, version);
+    HAZY_CHECKPOINT_WRITE(writer, packetCapacity);
+    HAZY_CHECKPOINT_WRITE(writer, reorderSlotCount);
+    HAZY_CHECKPOINT_WRITE(writer, directionOctetCount);
+}
+
+static bool readHeader(HazyCheckpointReader* reader)
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t packetCapacity;
+    uint16_t reorderSlotCount;
+    uint16_t directionOctetCount;
+
+    HAZY_CHECKPOINT_READ(reader, magic);
+    HAZY_CHECKPOINT_READ(reader, version);
+    HAZY_CHECKPOINT_READ(reader, packetCapacity);
+    HAZY_CHECKPOINT_READ(reader, reorderSlotCount);
+    HAZY_CHECKPOINT_READ(reader, directionOctetCount);
+
+    return !reader->hasFailed && magic == HAZY_CHECKPOINT_MAGIC && version == HAZY_CHECKPOINT_VERSION &&
+           packetCapacity == HAZY_PACKETS_CAPACITY && reorderSlotCount == HAZY_REORDER_SLOT_COUNT &&
+           directionOctetCount == (uint16_t) sizeof(HazyDirection);
+}
+
+static void writeLatency(HazyCheckpointWriter* writer, const HazyLatency* latency)
+{
+    HAZY_CHECKPOINT_WRITE(writer, latency->latency);
+    HAZY_CHECKPOINT_WRITE(writer, latency->startLatency);
+    HAZY_CHECKPOINT_WRITE(writer, latency->targetLatency);
+    HAZY_CHECKPOINT_WRITE(writer, latency->driftStartMs);
+    HAZY_CHECKPOINT_WRITE(writer, latency->driftEndMs);
+    HAZY_CHECKPOINT_WRITE(writer, latency->latencyDiffPerSecond);
+    HAZY_CHECKPOINT_WRITE(writer, latency->cycleStartLatency);
+    HAZY_CHECKPOINT_WRITE(writer, latency->cycleOriginMs);
+    HAZY_CHECKPOINT_WRITE(writer, latency->cyclePeriodMs);
+    HAZY_CHECKPOINT_WRITE(writer, latency->cycleMinLatency);
+    HAZY_CHECKPOINT_WRITE(writer, latency->cycleLatencyRange);
+    HAZY_CHECKPOINT_WRITE(writer, latency->cycleSeed);
+    HAZY_CHECKPOINT_WRITE(writer, latency->pending);
+    HAZY_CHECKPOINT_WRITE(writer, latency->config);
+    HAZY_CHECKPOINT_WRITE(writer, latency->phase);
+    HAZY_CHECKPOINT_WRITE(writer, latency->lastUpdateTimeMs);
+    HAZY_CHECKPOINT_WRITE(writer, latency->random);
+}
+
+static void readLatency(HazyCheckpointReader* reader, HazyLatency* latency)
+{
+    HAZY_CHECKPOINT_READ(reader, latency->latency);
+    HAZY_CHECKPOINT_READ(reader, latency->startLatency);
+    HAZY_CHECKPOINT_READ(reader, latency->targetLatency);
+    HAZY_CHECKPOINT_READ(reader, latency->driftStartMs);
+    HAZY_CHECKPOINT_READ(reader, latency->driftEndMs);
+    HAZY_CHECKPOINT_READ(reader, latency->latencyDiffPerSecond);
+    HAZY_CHECKPOINT_READ(reader, latency->cycleStartLatency);
+    HAZY_CHECKPOINT_READ(reader, latency->cycleOriginMs);
+    HAZY_CHECKPOINT_READ(reader, latency->cyclePeriodMs);
+    HAZY_CHECKPOINT_READ(reader, latency->cycleMinLatency);
+    HAZY_CHECKPOINT_READ(reader, latency->cycleLatencyRange);
+    HAZY_CHECKPOINT_READ(reader, latency->cycleSeed);
+    HAZY_CHECKPOINT_READ(reader, latency->pending);
+    HAZY_CHECKPOINT_READ(reader, latency->config);
+    HAZY_CHECKPOINT_READ(reader, latency->phase);
+    HAZY_CHECKPOINT_READ(reader, latency->lastUpdateTimeMs);
+    HAZY_CHECKPOINT_READ(reader, latency->random);
+
+    // The cycles divide by the period and the range, once they have started
+    bool hasStarted = latency->pending != HazyLatencyPendingStart;
+    if ((unsigned) latency->pending > HazyLatencyPendingStart ||
+        (hasStarted && (latency->cyclePeriodMs <= 0 || latency->cycleLatencyRange == 0 ||
+                        !(latency->latencyDiffPerSecond > 0.0f)))) {
+        reader->hasFailed = true;
+    }
+}
+
+static void writeDecider(HazyCheckpointWriter* writer, const HazyDecider* decider)
+{
+    HAZY_CHECKPOINT_WRITE(writer, decider->max);
+    HAZY_CHECKPOINT_WRITE(writer, decider->rangeCount);
+    HAZY_CHECKPOINT_WRITE(writer, decider->decision);
+    HAZY_CHECKPOINT_WRITE(writer, decider->ranges);
+    HAZY_CHECKPOINT_WRITE(writer, decider->random);
+}
+
+static void readDecider(HazyCheckpointReader* reader, HazyDecider* decider)
+{
+    HAZY_CHECKPOINT_READ(reader, decider->max);
+    HAZY_CHECKPOINT_READ(reader, decider->rangeCount);
+    HAZY_CHECKPOINT_READ(reader, decider->decision);
+    HAZY_CHECKPOINT_READ(reader, decider->ranges);
+    HAZY_CHECKPOINT_READ(reader, decider->random);
+
+    // hazyDeciderDecide() draws in [0, max) and must land in one of the ascending ranges
+    size_t rangeCapacity = sizeof(decider->ranges) / sizeof(decider->ranges[0]);
+    if (decider->rangeCount > rangeCapacity) {
+        reader->hasFailed = true;
+        return;
+    }
+    size_t last = 0;
+    for (size_t i = 0; i < decider->rangeCount; ++i) {
+        if (decider->ranges[i].max <= last) {
+            reader->hasFailed = true;
+            return;
+        }
+        last = decider->ranges[i].max;
+    }
+    if (last != decider->max) {
+        reader->hasFailed = true;
+    }
+}
+
+static void writeBottleneck(HazyCheckpointWriter* writer, const HazyBottleneck* bottleneck)
+{
+    HAZY_CHECKPOINT_WRITE(writer, bottleneck->config);
+    HAZY_CHECKPOINT_WRITE(writer, bottleneck->busyUntilUs);
+    HAZY_CHECKPOINT_WRITE(writer, bottleneck->redAverageOctetCount);
+    HAZY_CHECKPOINT_WRITE(writer, bottleneck->codelIsDropping);
+    HAZY_CHECKPOINT_WRITE(writer, bottleneck->codelFirstAboveTimeUs);
+    HAZY_CHECKPOINT_WRITE(writer, bottleneck->codelDropNextUs);
+    HAZY_CHECKPOINT_WRITE(writer, bottleneck->codelDropCount);
+    HAZY_CHECKPOINT_WRITE(writer, bottleneck->codelLastDropCount);
+    HAZY_CHECKPOINT_WRITE(writer, bottleneck->random);
+}
+
+static void readBottleneck(HazyCheckpointReader* reader, HazyBottleneck* bottleneck)
+{
+    HAZY_CHECKPOINT_READ(reader, bottleneck->config);
+    HAZY_CHECKPOINT_READ(reader, bottleneck->busyUntilUs);
+    HAZY_CHECKPOINT_READ(reader, bottleneck->redAverageOctetCount);
+    HAZY_CHECKPOINT_READ(reader, bottleneck->codelIsDropping);
+    HAZY_CHECKPOINT_READ(reader, bottleneck->codelFirstAboveTimeUs);
+    HAZY_CHECKPOINT_READ(reader, bottleneck->codelDropNextUs);
+    HAZY_CHECKPOINT_READ(reader, bottleneck->codelDropCount);
+    HAZY_CHECKPOINT_READ(reader, bottleneck->codelLastDropCount);
+    HAZY_CHECKPOINT_READ(reader, bottleneck->random);
+}
+
+static void writeReorder(HazyCheckpointWriter* writer, const HazyReorder* reorder)
+{
+    HAZY_CHECKPOINT_WRITE(writer, reorder->sequence);
+    HAZY_CHECKPOINT_WRITE(writer, reorder->config);
+    HAZY_CHECKPOINT_WRITE(writer, reorder->random);
+
+    for (size_t i = 0; i < HAZY_REORDER_SLOT_COUNT; ++i) {
+        const HazyReorderSlot* slot = &reorder->slots[i];
+        bool isHeld = slot->data != 0;
+        HAZY_CHECKPOINT_WRITE(writer, isHeld);
+        if (isHeld) {
+            HAZY_CHECKPOINT_WRITE(writer, slot->octetCount);
+            HAZY_CHECKPOINT_WRITE(writer, slot->heldAtMs);
+            HAZY_CHECKPOINT_WRITE(writer, slot->sequence);
+            writeOctets(writer, slot->data, slot->octetCount);
+        }
+    }
+}
+
+static void readReorder(HazyCheckpointReader* reader, HazyReorder* reorder)
+{
+    HAZY_CHECKPOINT_READ(reader, reorder->sequence);
+    HAZY_CHECKPOINT_READ(reader, reorder->config);
+    HAZY_CHECKPOINT_READ(reader, reorder->random);
+
+    reorder->heldCount = 0;
+    for (size_t i = 0; i < HAZY_REORDER_SLOT_COUNT; ++i) {
+        HazyReorderSlot* slot = &reorder->slots[i];
+        slot->data = 0;
+        slot->octetCount = 0;
+        bool isHeld;
+        HAZY_CHECKPOINT_READ(reader, isHeld);
+        if (!isHeld) {
+            continue;
+        }
+        size_t octetCount;
+        HAZY_CHECKPOINT_READ(reader, octetCount);
+        HAZY_CHECKPOINT_READ(reader, slot->heldAtMs);
+        HAZY_CHECKPOINT_READ(reader, slot->sequence);
+        // A held back packet is queued later, so it must fit in the packet queue
+        if (octetCount == 0 || octetCount > UINT16_MAX) {
+            reader->hasFailed = true;
+            return;
+        }
+        slot->data = readPayload(reader, reorder->allocatorWithFree, octetCount);
+        if (slot->data != 0) {
+            slot->octetCount = octetCount;
+            reorder->heldCount++;
+        }
+    }
+}
+
+static void writePackets(HazyCheckpointWriter* writer, const HazyPackets* packets)
+{
+    HAZY_CHECKPOINT_WRITE(writer, packets->timeToAct);
+    HAZY_CHECKPOINT_WRITE(writer, packets->created);
+    HAZY_CHECKPOINT_WRITE(writer, packets->sequence);
+    HAZY_CHECKPOINT_WRITE(writer, packets->octetCount);
+    HAZY_CHECKPOINT_WRITE(writer, packets->baseTimeMs);
+    HAZY_CHECKPOINT_WRITE(writer, packets->lastTimeAdded);
+    HAZY_CHECKPOINT_WRITE(writer, packets->lastSequenceAdded);
+    HAZY_CHECKPOINT_WRITE(writer, packets->lastTimeIsValid);
+
+    for (size_t i = 0; i < HAZY_PACKETS_CAPACITY; ++i) {
+        if (packets->timeToAct[i] != HAZY_PACKET_TIME_FREE) {
+            writeOctets(writer, packets->data[i], packets->octetCount[i]);
+        }
+    }
+}
+
+static void readPackets(HazyCheckpointReader* reader, HazyPackets* packets)
+{
+    HAZY_CHECKPOINT_READ(reader, packets->timeToAct);
+    HAZY_CHECKPOINT_READ(reader, packets->created);
+    HAZY_CHECKPOINT_READ(reader, packets->sequence);
+    HAZY_CHECKPOINT_READ(reader, packets->octetCount);
+    HAZY_CHECKPOINT_READ(reader, packets->baseTimeMs);
+    HAZY_CHECKPOINT_READ(reader, packets->lastTimeAdded);
+    HAZY_CHECKPOINT_READ(reader, packets->lastSequenceAdded);
+    HAZY_CHECKPOINT_READ(reader, packets->lastTimeIsValid);
+
+    // The free list and the counts are rebuilt from the used slots, so they always agree with them.
+    // Pushed from the highest index, so the low indices are popped first, like after hazyPacketsInit().
+    packets->freeCount = 0;
+    packets->packetCount = 0;
+    for (size_t i = HAZY_PACKETS_CAPACITY; i > 0; --i) {
+        size_t index = i - 1;
+        packets->data[index] = 0;
+        if (packets->timeToAct[index] == HAZY_PACKET_TIME_FREE) {
+            packets->octetCount[index] = 0;
+            packets->freeIndices[packets->freeCount++] = (uint8_t) index;
+        }
+    }
+
+    for (size_t i = 0; i < HAZY_PACKETS_CAPACITY && !reader->hasFailed; ++i) {
+        if (packets->timeToAct[i] != HAZY_PACKET_TIME_FREE) {
+            if (packets->octetCount[i] == 0) {
+                reader->hasFailed = true;
+                return;
+            }
+            packets->data[i] = readPayload(reader, packets->allocatorWithFree, packets->octetCount[i]);
+            if (packets->data[i] != 0) {
+                packets->packetCount++;
+            }
+        }
+    }
+}
+
+static void writeDirection(HazyCheckpointWriter* writer, const HazyDirection* direction)
+{
+    HAZY_CHECKPOINT_WRITE(writer, direction->phase);
+    HAZY_CHECKPOINT_WRITE(writer, direction->nextPacketDropBurstMs);
+    HAZY_CHECKPOINT_WRITE(writer, direction->nextPacketDropBurstEndMs);
+    HAZY_CHECKPOINT_WRITE(writer, direction->config);
+    HAZY_CHECKPOINT_WRITE(writer, direction->isPassthrough);
+    HAZY_CHECKPOINT_WRITE(writer, direction->nextSequence);
+    HAZY_CHECKPOINT_WRITE(writer, direction->tracedLatencyPhase);
+    HAZY_CHECKPOINT_WRITE(writer, direction->stats);
+    HAZY_CHECKPOINT_WRITE(writer, direction->random);
+    HAZY_CHECKPOINT_WRITE(writer, direction->wire.config);
+    HAZY_CHECKPOINT_WRITE(writer, direction->wire.busyUntilUs);
+    writeLatency(writer, &direction->latency);
+    writeDecider(writer, &direction->decider);
+    writeBottleneck(writer, &direction->bottleneck);
+    writeReorder(writer, &direction->reorder);
+    writePackets(writer, &direction->packets);
+}
+
+static void readDirection(HazyCheckpointReader* reader, HazyDirection* direction)
+{
+    HAZY_CHECKPOINT_READ(reader, direction->phase);
+    HAZY_CHECKPOINT_READ(reader, direction->nextPacketDropBurstMs);
+    HAZY_CHECKPOINT_READ(reader, direction->nextPacketDropBurstEndMs);
+    HAZY_CHECKPOINT_READ(reader, direction->config);
+    HAZY_CHECKPOINT_READ(reader, direction->isPassthrough);
+    HAZY_CHECKPOINT_READ(reader, direction->nextSequence);
+    HAZY_CHECKPOINT_READ(reader, direction->tracedLatencyPhase);
+    HAZY_CHECKPOINT_READ(reader, direction->stats);
+    HAZY_CHECKPOINT_READ(reader, direction->random);
+    HAZY_CHECKPOINT_READ(reader, direction->wire.config);
+    HAZY_CHECKPOINT_READ(reader, direction->wire.busyUntilUs);
+    readLatency(reader, &direction->latency);
+    readDecider(reader, &direction->decider);
+    readBottleneck(reader, &direction->bottleneck);
+    readReorder(reader, &direction->reorder);
+    readPackets(reader, &direction->packets);
+}
+
+/// Writes the packets that are ready to be read, without consuming them
+static void writeReceiveBuffer(HazyCheckpointWriter* writer, const DiscoidBuffer* receiveBuffer)
+{
+    DiscoidBuffer peek = *receiveBuffer;
+    uint32_t octetCount = (uint32_t) discoidBufferReadAvailable(&peek);
+    HAZY_CHECKPOINT_WRITE(writer, octetCount);
+
+    uint8_t chunk[256];
+    while (octetCount > 0) {
+        uint32_t chunkOctetCount = octetCount < sizeof(chunk) ? octetCount : (uint32_t) sizeof(chunk);
+        discoidBufferRead(&peek, chunk, chunkOctetCount);
+        writeOctets(writer, chunk, chunkOctetCount);
+        octetCount -= chunkOctetCount;
+    }
+}
+
+static void readReceiveBuffer(HazyCheckpointReader* reader, DiscoidBuffer* receiveBuffer)
+{
+    uint32_t octetCount;
+    HAZY_CHECKPOINT_READ(reader, octetCount);
+    if (reader->hasFailed || octetCount > reader->octetCount - reader->position ||
+        octetCount > discoidBufferWriteAvailable(receiveBuffer)) {
+        reader->hasFailed = true;
+        return;
+    }
+
+    discoidBufferWrite(receiveBuffer, reader->source + reader->position, octetCount);
+    reader->position += octetCount;
+}
+
+static void writeHazy(HazyCheckpointWriter* writer, const Hazy* self)
+{
+    writeHeader(writer);
+    writeDirection(writer, &self->out);
+    writeDirection(writer, &self->in);
+    HAZY_CHECKPOINT_WRITE(writer, self->scenarioPlayer.startTimeMs);
+    HAZY_CHECKPOINT_WRITE(writer, self->scenarioPlayer.nextKeyframeIndex);
+    HAZY_CHECKPOINT_WRITE(writer, self->scenarioPlayer.hasStarted);
+    writeReceiveBuffer(writer, &self->receiveBuffer);
+}
+
+/// Calculates the size of the checkpoint of the current state
+/// @param self hazy
+/// @return the octet count needed for hazyCheckpointWrite()
+size_t hazyCheckpointOctetCount(const Hazy* self)
+{
+    HazyCheckpointWriter writer = {0, 0, 0};
+    writeHazy(&writer, self);
+
+    return writer.position;
+}
+
+/// Writes the simulation state, including the queued packets, the latency drift, the drop burst phase and
+/// the random generators. The config that is in use is included, the scenario, trace, capture, truth and sampler
+/// are not.
+/// @param self hazy
+/// @param target target buffer
+/// @param capacity target buffer size
+/// @return the number of octets written, or negative if the target is too small
+int hazyCheckpointWrite(const Hazy* self, uint8_t* target, size_t capacity)
+{
+    HazyCheckpointWriter writer = {target, capacity, 0};
+    writeHazy(&writer, self);
+    if (writer.position > capacity) {
+        CLOG_C_WARN(&self->log, "checkpoint needs %zu octets, but capacity is %zu", writer.position, capacity)
+        return -4;
+    }
+
+    return (int) writer.position;
+}
+
+/// Restores a checkpoint. The same checkpoint can be restored into any number of instances, to fork a
+/// simulation. Each instance keeps its own allocators, log, scenario, trace, capture, truth and
+/// sampler.
+/// @param self hazy, initialized with hazyInit()
+/// @param source checkpoint from hazyCheckpointWrite()
+/// @param octetCount checkpoint size
+/// @return negative on error. The instance then has no queued packets, and should be restored or configured again.
+int hazyCheckpointRestore(Hazy* self, const uint8_t* source, size_t octetCount)
+{
+    hazyReset(self);
+
+    HazyCheckpointReader reader = {source, octetCount, 0, false};
+    if (!readHeader(&reader)) {
+        CLOG_C_WARN(&self->log, "checkpoint is not from this version or build")
+        return -2;
+    }
+
+    readDirection(&reader, &self->out);
+    readDirection(&reader, &self->in);
+    HAZY_CHECKPOINT_READ(&reader, self->scenarioPlayer.startTimeMs);
+    HAZY_CHECKPOINT_READ(&reader, self->scenarioPlayer.nextKeyframeIndex);
+    size_t keyframeCount = self->scenarioPlayer.scenario != 0 ? self->scenarioPlayer.scenario->keyframeCount : 0;
+    if (self->scenarioPlayer.nextKeyframeIndex > keyframeCount) {
+        reader.hasFailed = true;
+    }
+    HAZY_CHECKPOINT_READ(&reader, self->scenarioPlayer.hasStarted);
+    readReceiveBuffer(&reader, &self->receiveBuffer);
+
+    if (reader.hasFailed || reader.position != octetCount) {
+        CLOG_C_WARN(&self->log, "checkpoint is truncated or corrupt")
+        hazyReset(self);
+        return -3;
+    }
+
+    return 0;
+}
@@ -34,6 +34,7 @@ static void recalculateRanges(HazyDecider* self, HazyDeciderConfig config)
 void hazyDeciderInit(HazyDecider* self, HazyDeciderConfig config, Clog log)
 {
     self->log = log;
+    hazyRandomInit(&self->random, 0);
     recalculateRanges(self, config);
 }
 
@@ -42,12 +43,28 @@ void hazyDeciderSetConfig(HazyDecider* self, HazyDeciderConfig config)
     recalculateRanges(self, config);
 }
 
+/// Copies the ranges from a decider that has been set up on another thread.
+/// @param self decider
+/// @param prepared decider to copy the ranges from
+void hazyDeciderCopyRanges(HazyDecider* self, const HazyDecider* prepared)
+{
+    self->max = prepared->max;
+    self->rangeCount = prepared->rangeCount;
+    for (size_t i = 0; i < prepared->rangeCount; ++i) {
+        self->ranges[i] = prepared->ranges[i];
+    }
+}
+
 /// decide
 /// @param self decider
 /// @return the decision made
 HazyDecision hazyDeciderDecide(HazyDecider* self)
 {
-    size_t value = ((size_t)rand() % self->max);
+    if (self->rangeCount == 1) {
+        return self->ranges[0].decision;
+    }
+
+    size_t value = hazyRandomRange(&self->random, (uint32_t) self->max);
 
     for (size_t i = 0; i < self->rangeCount; ++i) {
         if (value < self->ranges[i].max) {
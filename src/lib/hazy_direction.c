@@ -3,6 +3,19 @@
  *  Licensed under the MIT License. See LICENSE in the project root for license information.
  *--------------------------------------------------------------------------------------------*/
 #include <hazy/direction.h>
+#include <imprint/allocator.h>
+
+#if !defined HAZY_FEATURE_TAMPER
+#define HAZY_FEATURE_TAMPER (1)
+#endif
+
+#if !defined HAZY_FEATURE_DUPLICATE
+#define HAZY_FEATURE_DUPLICATE (1)
+#endif
+
+#if !defined HAZY_FEATURE_DROP_BURST
+#define HAZY_FEATURE_DROP_BURST (1)
+#endif
 
 static HazyLatencyConfig halfConfig(HazyLatencyConfig config)
 {
@@ -23,170 +36,671 @@ void hazyDirectionInit(HazyDirection* self, size_t capacity, struct ImprintAlloc
     hazyPacketsInit(&self->packets, allocatorWithFree);
     hazyDeciderInit(&self->decider, config.decider, log);
     hazyLatencyInit(&self->latency, halfConfig(config.latency), log);
+    hazyBottleneckInit(&self->bottleneck, config.bottleneck, log);
+    hazyReorderInit(&self->reorder, config.reorder, allocatorWithFree, log);
+    hazyWireInit(&self->wire, config.wire);
     self->config = config.direction;
+    self->isPassthrough = hazyDirectionConfigIsPassthrough(&config);
     self->phase = HazyDirectionPhaseNormal;
+    self->trace = 0;
+    self->traceDirectionId = 0;
+    self->capture = 0;
+    self->captureInterfaceId = 0;
+    self->truth = 0;
+    self->nextSequence = 0;
+    self->tracedLatencyPhase = self->latency.phase;
+    tc_memset_octets(&self->stats, 0, sizeof(self->stats));
+    hazyDirectionSetSeed(self, (uint64_t) rand());
 }
 
+/// Seeds the random generators of the direction and its components
+/// @param self direction
+/// @param seed seed
+void hazyDirectionSetSeed(HazyDirection* self, uint64_t seed)
+{
+    hazyRandomInit(&self->random, hazyRandomMix(seed));
+    hazyRandomInit(&self->decider.random, hazyRandomMix(seed + 1));
+    hazyRandomInit(&self->latency.random, hazyRandomMix(seed + 2));
+    hazyRandomInit(&self->bottleneck.random, hazyRandomMix(seed + 3));
+    hazyRandomInit(&self->reorder.random, hazyRandomMix(seed + 4));
+}
+
+/// Discards all queued and held back packets, ends any drop burst and starts the sequences over
+/// @param self direction
 void hazyDirectionReset(HazyDirection* self)
 {
-    hazyPacketsInit(&self->packets, self->packets.allocatorWithFree);
+    self->phase = HazyDirectionPhaseNormal;
+    self->nextSequence = 0;
+    self->nextPacketDropBurstMs = 0;
+    self->nextPacketDropBurstEndMs = 0;
+    hazyPacketsReset(&self->packets);
+    hazyLatencyReset(&self->latency);
+    hazyBottleneckReset(&self->bottleneck);
+    hazyReorderReset(&self->reorder);
+    hazyWireReset(&self->wire);
+    if (self->truth != 0) {
+        hazyTruthReset(self->truth);
+    }
+}
+
+/// A burst that is in progress would otherwise never end, since no new burst timing is drawn when bursts are off
+static void hazyDirectionStopDisabledDropBurst(HazyDirection* self)
+{
+    if (self->config.dropBurstTimeSpanMs == 0 && self->phase == HazyDirectionPhasePacketDropBurst) {
+        self->phase = HazyDirectionPhaseNormal;
+        self->nextPacketDropBurstMs = 0;
+        self->nextPacketDropBurstEndMs = 0;
+    }
 }
 
 void hazyDirectionSetConfig(HazyDirection* self, HazyDirectionConfig config)
 {
     hazyDeciderSetConfig(&self->decider, config.decider);
     hazyLatencySetConfig(&self->latency, halfConfig(config.latency));
+    hazyBottleneckSetConfig(&self->bottleneck, config.bottleneck);
+    hazyReorderSetConfig(&self->reorder, config.reorder);
+    hazyWireSetConfig(&self->wire, config.wire);
     self->config = config.direction;
+    self->isPassthrough = hazyDirectionConfigIsPassthrough(&config);
+    hazyDirectionStopDisabledDropBurst(self);
+}
+
+void hazyDirectionConfigSnapshotInit(HazyDirectionConfigSnapshot* self, HazyDirectionConfig config)
+{
+    tc_memset_octets(self, 0, sizeof(*self));
+    self->config = config;
+    hazyDeciderSetConfig(&self->decider, config.decider);
+    self->latency = halfConfig(config.latency);
+}
+
+/// Applies a config snapshot without resetting the latency drift.
+/// @param self direction
+/// @param snapshot config snapshot
+void hazyDirectionApplySnapshot(HazyDirection* self, const HazyDirectionConfigSnapshot* snapshot)
+{
+    hazyDeciderCopyRanges(&self->decider, &snapshot->decider);
+    hazyLatencyAdjustConfig(&self->latency, snapshot->latency);
+    hazyBottleneckSetConfig(&self->bottleneck, snapshot->config.bottleneck);
+    hazyReorderSetConfig(&self->reorder, snapshot->config.reorder);
+    hazyWireSetConfig(&self->wire, snapshot->config.wire);
+    self->config = snapshot->config.direction;
+    self->isPassthrough = hazyDirectionConfigIsPassthrough(&snapshot->config);
+    hazyDirectionStopDisabledDropBurst(self);
+}
+
+void hazyDirectionAdjustConfig(HazyDirection* self, HazyDirectionConfig config)
+{
+    HazyDirectionConfigSnapshot snapshot;
+    hazyDirectionConfigSnapshotInit(&snapshot, config);
+    hazyDirectionApplySnapshot(self, &snapshot);
+}
+
+/// Checks if a config has no impairment at all, so packets can be forwarded as is
+/// @param config direction config
+/// @return true if the config has no impairment
+bool hazyDirectionConfigIsPassthrough(const HazyDirectionConfig* config)
+{
+    const HazyDeciderConfig* decider = &config->decider;
+    bool onlyOriginal = decider->dropChance == 0 && decider->outOfOrderChance == 0 && decider->duplicateChance == 0 &&
+                        decider->tamperChance == 0;
+    bool noLatency = config->latency.maxLatency == 0 && config->latency.latencyJitter == 0;
+    bool noDropBurst = config->direction.dropBurstTimeSpanMs == 0;
+    bool noBottleneck = config->bottleneck.octetsPerSecond == 0;
+    bool noWire = config->wire.octetsPerSecond == 0;
+
+    return onlyOriginal && noLatency && noDropBurst && noBottleneck && noWire;
+}
+
+/// Checks if packets can skip the direction, since it has no impairment and nothing queued
+/// @param self direction
+/// @return true if packets can be forwarded directly
+bool hazyDirectionIsIdlePassthrough(const HazyDirection* self)
+{
+    return self->isPassthrough && self->packets.packetCount == 0 && self->reorder.heldCount == 0;
+}
+
+/// Number of packets in the direction, both queued and held back for reordering
+/// @param self direction
+/// @return packet count
+size_t hazyDirectionQueuedPacketCount(const HazyDirection* self)
+{
+    return self->packets.packetCount + self->reorder.heldCount;
+}
+
+/// Number of packets that can be queued before the overflow policy applies. A duplicated packet
+/// takes more than one.
+/// @param self direction
+/// @return free packet count
+size_t hazyDirectionFreePacketCount(const HazyDirection* self)
+{
+    return self->packets.freeCount;
+}
+
+/// Checks if a write would be refused with HAZY_ERROR_WOULD_BLOCK
+/// @param self direction
+/// @return true if the queue is full and the overflow policy is HazyOverflowPolicyWouldBlock
+bool hazyDirectionWouldBlock(const HazyDirection* self)
+{
+    return self->config.overflowPolicy == HazyOverflowPolicyWouldBlock && self->packets.freeCount == 0;
+}
+
+static void hazyDirectionTrace(HazyDirection* self, HazyTraceEventType type, uint32_t sequence, size_t octetCount,
+                               int32_t value, int32_t detail, MonotonicTimeMs now)
+{
+    HazyTraceEvent event;
+    event.timeMs = now;
+    event.sequence = sequence;
+    event.octetCount = (uint16_t) octetCount;
+    event.type = (uint8_t) type;
+    event.directionId = self->traceDirectionId;
+    event.value = value;
+    event.detail = detail;
+    hazyTraceAdd(self->trace, &event);
+}
+
+/// Records events for this direction into the trace ring
+/// @param self direction
+/// @param trace trace ring, or NULL to stop tracing
+/// @param directionId stored in each event
+void hazyDirectionSetTrace(HazyDirection* self, HazyTrace* trace, uint8_t directionId)
+{
+    self->trace = trace;
+    self->traceDirectionId = directionId;
+}
+
+static void hazyDirectionCapture(HazyDirection* self, HazyCaptureEventType type, uint8_t value, uint32_t sequence,
+                                 const uint8_t* data, size_t octetCount, MonotonicTimeMs arrivedMs,
+                                 MonotonicTimeMs timeToActMs, MonotonicTimeMs now)
+{
+    HazyCaptureRecord record;
+    tc_memset_octets(&record, 0, sizeof(record));
+    record.timeMs = now;
+    record.arrivedMs = arrivedMs;
+    record.timeToActMs = timeToActMs;
+    record.sequence = sequence;
+    record.octetCount = (uint16_t) octetCount;
+    record.type = (uint8_t) type;
+    record.value = value;
+    record.interfaceId = self->captureInterfaceId;
+    hazyCaptureAdd(self->capture, &record, data);
+}
+
+/// Records the packets of this direction, and what was decided for them, into the capture ring
+/// @param self direction
+/// @param capture capture ring, or NULL to stop capturing
+/// @param interfaceId the pcapng interface for this direction
+void hazyDirectionSetCapture(HazyDirection* self, HazyCapture* capture, uint8_t interfaceId)
+{
+    self->capture = capture;
+    self->captureInterfaceId = interfaceId;
+}
+
+/// Records the true delay and fate of each packet of this direction
+/// @param self direction
+/// @param truth truth records, or NULL to stop recording
+void hazyDirectionSetTruth(HazyDirection* self, HazyTruth* truth)
+{
+    self->truth = truth;
+}
+
+/// Counts and traces a packet that has left the packet queue and been delivered
+/// @param self direction
+/// @param packet packet found with hazyPacketsFindPacketToActOn()
+/// @param now current time
+void hazyDirectionPacketDelivered(HazyDirection* self, const HazyPacket* packet, MonotonicTimeMs now)
+{
+    MonotonicTimeMs delayMs = now - packet->created;
+    self->stats.deliveredPacketCount++;
+    self->stats.deliveredOctetCount += packet->octetCount;
+    self->stats.deliveredDelayMsSum += (uint64_t) delayMs;
+    if (delayMs > self->stats.maxDeliveredDelayMs) {
+        self->stats.maxDeliveredDelayMs = delayMs;
+    }
+
+    if (self->trace != 0) {
+        hazyDirectionTrace(self, HazyTraceEventTypeDeliver, packet->sequence, packet->octetCount,
+                           (int32_t) delayMs, (int32_t) (now - packet->timeToAct), now);
+    }
+
+    if (self->capture != 0) {
+        hazyDirectionCapture(self, HazyCaptureEventTypeDelivered, 0, packet->sequence, packet->data,
+                             packet->octetCount, packet->created, packet->timeToAct, now);
+    }
+
+    if (self->truth != 0) {
+        hazyTruthDelivered(self->truth, packet->sequence, now);
+    }
+}
+
+/// Counts and traces a packet that was dropped after it left the packet queue
+/// @param self direction
+/// @param packet packet found with hazyPacketsFindPacketToActOn()
+/// @param cause the reason for the drop
+/// @param now current time
+void hazyDirectionPacketDropped(HazyDirection* self, const HazyPacket* packet, HazyTraceDropCause cause,
+                                MonotonicTimeMs now)
+{
+    self->stats.droppedPacketCount++;
+    self->stats.droppedPacketCountByCause[cause]++;
+
+    if (self->trace != 0) {
+        hazyDirectionTrace(self, HazyTraceEventTypeDrop, packet->sequence, packet->octetCount, (int32_t) cause, 0,
+                           now);
+    }
+
+    if (self->capture != 0) {
+        hazyDirectionCapture(self, HazyCaptureEventTypeDropped, (uint8_t) cause, packet->sequence, packet->data,
+                             packet->octetCount, packet->created, packet->timeToAct, now);
+    }
+
+    if (self->truth != 0) {
+        hazyTruthDropped(self->truth, packet->sequence, (uint8_t) cause);
+    }
+}
+
+static void hazyDirectionDropOnWrite(HazyDirection* self, uint32_t sequence, const uint8_t* data, size_t octetCount,
+                                     HazyTraceDropCause cause, MonotonicTimeMs now)
+{
+    self->stats.droppedPacketCount++;
+    self->stats.droppedPacketCountByCause[cause]++;
+
+    if (self->trace != 0) {
+        hazyDirectionTrace(self, HazyTraceEventTypeDrop, sequence, octetCount, (int32_t) cause, 0, now);
+    }
+
+    if (self->capture != 0) {
+        hazyDirectionCapture(self, HazyCaptureEventTypeDropped, (uint8_t) cause, sequence, data, octetCount, now, 0,
+                             now);
+    }
+
+    if (self->truth != 0) {
+        hazyTruthDropped(self->truth, sequence, (uint8_t) cause);
+    }
+}
+
+/// Counts, traces and records a packet that was dropped before it entered the direction, e.g. when a
+/// passthrough could not deliver it
+/// @param self direction
+/// @param data packet payload
+/// @param octetCount packet size
+/// @param cause the reason for the drop
+/// @param now current time
+void hazyDirectionWriteDropped(HazyDirection* self, const uint8_t* data, size_t octetCount, HazyTraceDropCause cause,
+                               MonotonicTimeMs now)
+{
+    uint32_t sequence = self->nextSequence++;
+    self->stats.writtenPacketCount++;
+    self->stats.writtenOctetCount += octetCount;
+    if (self->truth != 0) {
+        hazyTruthWritten(self->truth, sequence, now);
+    }
+
+    hazyDirectionDropOnWrite(self, sequence, data, octetCount, cause, now);
+}
+
+static HazyTraceDropCause bottleneckDropCause(HazyBottleneckResult result)
+{
+    switch (result) {
+        case HazyBottleneckResultRedDrop:
+            return HazyTraceDropCauseRedDrop;
+        case HazyBottleneckResultCoDelDrop:
+            return HazyTraceDropCauseCoDelDrop;
+        default:
+            return HazyTraceDropCauseTailDrop;
+    }
+}
+
+static void hazyDirectionFreeOwned(HazyDirection* self, uint8_t* ownedData)
+{
+    if (ownedData != 0) {
+        IMPRINT_FREE(self->packets.allocatorWithFree, ownedData);
+    }
 }
 
-static int hazyWriteInternal(HazyDirection* self, const uint8_t* data, size_t octetCount, MonotonicTimeMs proposedTime)
+/// Queues the packet. ownedData is the same as data if the payload is owned, and is then handed over
+/// to the packet queue without a copy (or freed if the packet is dropped). Otherwise it is NULL.
+static int hazyWriteOut(HazyDirection* self, const uint8_t* data, size_t octetCount, uint8_t* ownedData,
+                        uint32_t sequence, MonotonicTimeMs now)
 {
     if (octetCount == 0) {
+        hazyDirectionFreeOwned(self, ownedData);
         return 0;
     }
 
-    if (self->packets.packetCount >= HAZY_PACKETS_CAPACITY) {
-        CLOG_C_VERBOSE(&self->log, "overflow out of packet capacity %d", HAZY_PACKETS_CAPACITY)
-        return -45;
+    // Decide before the packet takes any time on the wire or space in the bottleneck, so that a dropped packet
+    // does not delay the packets after it. Also for HazyOverflowPolicyWouldBlock, when the queue was filled by
+    // duplicates or held back packets.
+    bool isFull = self->packets.freeCount == 0;
+    if (isFull && self->config.overflowPolicy != HazyOverflowPolicyDropOldestDue) {
+        hazyDirectionDropOnWrite(self, sequence, data, octetCount, HazyTraceDropCausePacketCapacity, now);
+        hazyDirectionFreeOwned(self, ownedData);
+        return 0;
     }
 
-    HazyPacket* packet = hazyPacketsWrite(&self->packets, data, octetCount, proposedTime, &self->log);
+    int64_t sentUs = hazyWireTransmit(&self->wire, octetCount, now * 1000);
 
-#if defined HAZY_LOG_ENABLE
-    CLOG_C_VERBOSE(&self->log, "packet set index %d,  %zu, latency: %lu", packet->indexForDebug, packet->octetCount,
-                   randomMillisecondsLatency)
-#else
-    (void) packet;
+    int64_t departureUs;
+    HazyBottleneckResult bottleneckResult = hazyBottleneckEnqueue(&self->bottleneck, octetCount, sentUs,
+                                                                  &departureUs);
+    if (bottleneckResult != HazyBottleneckResultQueued) {
+        hazyDirectionDropOnWrite(self, sequence, data, octetCount, bottleneckDropCause(bottleneckResult), now);
+        hazyDirectionFreeOwned(self, ownedData);
+        return 0;
+    }
 
-#endif
+    MonotonicTimeMs departure = (departureUs + 999) / 1000;
+    MonotonicTimeMs proposedTime = departure + hazyLatencyGetLatencyWithJitter(&self->latency, now);
+
+    // Keep the packets in write order, so the jitter does not reorder them. Equal deadlines are delivered in
+    // sequence order, so only a held back packet, that was overtaken by later sequences, needs a later deadline.
+    if (self->packets.lastTimeIsValid) {
+        MonotonicTimeMs lastTime = self->packets.lastTimeAdded;
+        if (proposedTime < lastTime) {
+            proposedTime = lastTime;
+        }
+        if (proposedTime == lastTime && hazyPacketsSequenceIsBefore(sequence, self->packets.lastSequenceAdded)) {
+            proposedTime = lastTime + 1;
+        }
+    }
+
+    // Only make room once the packet is known to be queued
+    if (isFull) {
+        HazyPacket oldest;
+        hazyPacketsFindEarliest(&self->packets, &oldest);
+        hazyDirectionPacketDropped(self, &oldest, HazyTraceDropCauseOverflowOldest, now);
+        hazyPacketsDestroyPacket(&self->packets, &oldest);
+    }
+
+    int index;
+    if (ownedData != 0) {
+        index = hazyPacketsWriteOwned(&self->packets, ownedData, octetCount, sequence, proposedTime, now,
+                                      &self->log);
+        if (index < 0) {
+            hazyDirectionFreeOwned(self, ownedData);
+        }
+    } else {
+        index = hazyPacketsWrite(&self->packets, data, octetCount, sequence, proposedTime, now, &self->log);
+    }
+    if (index < 0) {
+        return index;
+    }
+
+    if (self->trace != 0) {
+        hazyDirectionTrace(self, HazyTraceEventTypeEnqueue, sequence, octetCount, (int32_t) (proposedTime - now),
+                           (int32_t) (departure - now), now);
+    }
 
     return 0;
 }
 
-static int hazyWriteOut(HazyDirection* self, const uint8_t* data, size_t octetCount, bool reorderAllowed)
+static void hazyWriteHeldBack(HazyDirection* self, HazyReorderSlot* slot, MonotonicTimeMs now)
 {
-#if defined HAZY_LOG_ENABLE
-    CLOG_C_VERBOSE(&self->log, "write out %zu octetCount latency:%d", octetCount, self->latency)
-#endif
+    size_t octetCount = slot->octetCount;
+    uint32_t sequence = slot->sequence;
+    uint8_t* data = hazyReorderTake(&self->reorder, slot);
+    hazyWriteOut(self, data, octetCount, data, sequence, now);
+}
 
-    MonotonicTimeMs now = monotonicTimeMsNow();
-    MonotonicTimeMs proposedTime = now + hazyLatencyGetLatencyWithJitter(&self->latency);
+/// Writes a packet and sends the held back packet, if any, that has now been overtaken by enough packets.
+static int hazyWritePassing(HazyDirection* self, const uint8_t* data, size_t octetCount, uint8_t* ownedData,
+                            uint32_t sequence, MonotonicTimeMs now)
+{
+    int result = hazyWriteOut(self, data, octetCount, ownedData, sequence, now);
 
-    if (self->packets.lastTimeIsValid) {
-        if ((proposedTime <= self->packets.lastTimeAdded) && !reorderAllowed) {
-            proposedTime = self->packets.lastTimeAdded + 1;
-        }
+    HazyReorderSlot* overtaken = hazyReorderAdvance(&self->reorder);
+    if (overtaken != 0) {
+        hazyWriteHeldBack(self, overtaken, now);
     }
 
-    return hazyWriteInternal(self, data, octetCount, proposedTime);
+    return result;
 }
 
-void hazyDirectionUpdate(HazyDirection* self, MonotonicTimeMs now)
+#if HAZY_FEATURE_DROP_BURST
+static void hazyDirectionUpdateDropBurst(HazyDirection* self, MonotonicTimeMs now)
 {
     switch (self->phase) {
         case HazyDirectionPhaseNormal:
             if (now >= self->nextPacketDropBurstMs && self->config.dropBurstTimeSpanMs != 0) {
-                size_t dropDuration = (size_t) (rand() % (int) self->config.dropBurstTimeSpanMs) +
+                size_t dropDuration = hazyRandomRange(&self->random, (uint32_t) self->config.dropBurstTimeSpanMs) +
                                       self->config.dropBurstTimeMinimumMs;
                 CLOG_C_DEBUG(&self->log, "start packet drop burst for %zu ms", dropDuration)
                 self->phase = HazyDirectionPhasePacketDropBurst;
                 self->nextPacketDropBurstEndMs = now + (MonotonicTimeMs) dropDuration;
                 self->nextPacketDropBurstMs = 0;
+                if (self->trace != 0) {
+                    hazyDirectionTrace(self, HazyTraceEventTypeDropBurstPhase, 0, 0, (int32_t) self->phase,
+                                       (int32_t) dropDuration, now);
+                }
             }
             break;
         case HazyDirectionPhasePacketDropBurst:
-            if (now >= self->nextPacketDropBurstEndMs && self->config.timeBetweenDropBurstSpanMs) {
-                size_t timeUntilNextDropBurst = (size_t) (rand() % (int) self->config.timeBetweenDropBurstSpanMs) +
-                                                self->config.timeBetweenDropBurstMinimumMs;
+            // The burst always ends on time, even if the config has changed since it started
+            if (now >= self->nextPacketDropBurstEndMs) {
+                size_t timeUntilNextDropBurst = self->config.timeBetweenDropBurstMinimumMs;
+                if (self->config.timeBetweenDropBurstSpanMs != 0) {
+                    timeUntilNextDropBurst += hazyRandomRange(&self->random,
+                                                              (uint32_t) self->config.timeBetweenDropBurstSpanMs);
+                }
                 CLOG_C_DEBUG(&self->log, "packet drop burst over. Will wait %zu ms until the next one", timeUntilNextDropBurst)
                 self->phase = HazyDirectionPhaseNormal;
                 self->nextPacketDropBurstMs = now + (MonotonicTimeMs) timeUntilNextDropBurst;
+                if (self->trace != 0) {
+                    hazyDirectionTrace(self, HazyTraceEventTypeDropBurstPhase, 0, 0, (int32_t) self->phase,
+                                       (int32_t) timeUntilNextDropBurst, now);
+                }
             }
             break;
     }
 }
+#endif
+
+#if HAZY_FEATURE_DUPLICATE
+static int hazyWriteDuplicates(HazyDirection* self, const uint8_t* data, size_t octetCount, uint8_t* ownedData,
+                               uint32_t sequence, MonotonicTimeMs now)
+{
+    // Each copy needs its own payload, except the last one that can take over an owned payload
+    uint32_t copyCount = (hazyRandomRange(&self->random, 3) + 1) * 2;
+    if (self->truth != 0) {
+        hazyTruthDuplicated(self->truth, sequence, copyCount - 1);
+    }
+    for (uint32_t i = 0; i + 1 < copyCount; ++i) {
+        int result = hazyWritePassing(self, data, octetCount, 0, sequence, now);
+        if (result < 0) {
+            hazyDirectionFreeOwned(self, ownedData);
+            return result;
+        }
+    }
+
+    return hazyWritePassing(self, data, octetCount, ownedData, sequence, now);
+}
+#endif
+
+#if HAZY_FEATURE_TAMPER
+static int hazyWriteTampered(HazyDirection* self, const uint8_t* data, size_t octetCount, uint8_t* ownedData,
+                             uint32_t sequence, MonotonicTimeMs now)
+{
+    // An owned payload can be tampered in place
+    if (ownedData != 0) {
+        for (size_t index = 0; index < octetCount; ++index) {
+            ownedData[index] = (uint8_t) hazyRandomNext(&self->random);
+        }
+        return hazyWritePassing(self, ownedData, octetCount, ownedData, sequence, now);
+    }
+
+    uint8_t temp[1200];
+    if (octetCount > sizeof(temp)) {
+        return hazyWritePassing(self, data, octetCount, 0, sequence, now);
+    }
+    for (size_t index = 0; index < octetCount; ++index) {
+        temp[index] = (uint8_t) hazyRandomNext(&self->random);
+    }
+
+    return hazyWritePassing(self, temp, octetCount, 0, sequence, now);
+}
+#endif
+
+void hazyDirectionUpdate(HazyDirection* self, MonotonicTimeMs now)
+{
+    while (1) {
+        HazyReorderSlot* expired = hazyReorderFindExpired(&self->reorder, now);
+        if (expired == 0) {
+            break;
+        }
+        // Held back packet that was not overtaken in time
+        hazyWriteHeldBack(self, expired, now);
+    }
+
+    if (self->trace != 0) {
+        HazyLatencyState latency = hazyLatencyAt(&self->latency, now);
+        if (latency.phase != self->tracedLatencyPhase) {
+            self->tracedLatencyPhase = latency.phase;
+            hazyDirectionTrace(self, HazyTraceEventTypeLatencyPhase, 0, 0, (int32_t) latency.phase,
+                               (int32_t) latency.targetLatency, now);
+        }
+    }
+
+#if HAZY_FEATURE_DROP_BURST
+    hazyDirectionUpdateDropBurst(self, now);
+#endif
+}
 
 int hazyWriteDirection(HazyDirection* self, const uint8_t* data, size_t octetCount)
 {
+    return hazyWriteDirectionAt(self, data, octetCount, monotonicTimeMsNow());
+}
+
+static int hazyWriteDirectionPayload(HazyDirection* self, const uint8_t* data, size_t octetCount, uint8_t* ownedData,
+                                     MonotonicTimeMs now)
+{
+    if (hazyDirectionWouldBlock(self)) {
+        // Nothing has happened to the packet, so an owned payload stays with the caller, that can retry later
+        self->stats.wouldBlockCount++;
+        return HAZY_ERROR_WOULD_BLOCK;
+    }
+
+    uint32_t sequence = self->nextSequence++;
+    self->stats.writtenPacketCount++;
+    self->stats.writtenOctetCount += octetCount;
+    if (self->truth != 0) {
+        hazyTruthWritten(self->truth, sequence, now);
+    }
+
+#if HAZY_FEATURE_DROP_BURST
     if (self->phase == HazyDirectionPhasePacketDropBurst) {
-        CLOG_C_VERBOSE(&self->log, "decision: dropped packet due to packet drop burst")
+        if (self->capture != 0) {
+            hazyDirectionCapture(self, HazyCaptureEventTypeDropBurst, 0, sequence, data, octetCount, now, 0, now);
+        }
+        hazyDirectionDropOnWrite(self, sequence, data, octetCount, HazyTraceDropCauseDropBurst, now);
+        hazyDirectionFreeOwned(self, ownedData);
         return 0;
     }
+#endif
 
     HazyDecision decision = hazyDeciderDecide(&self->decider);
+    if (self->trace != 0) {
+        hazyDirectionTrace(self, HazyTraceEventTypeDecision, sequence, octetCount, (int32_t) decision, 0, now);
+    }
+    if (self->capture != 0) {
+        hazyDirectionCapture(self, HazyCaptureEventTypeArrived, (uint8_t) decision, sequence, data, octetCount, now, 0,
+                             now);
+    }
 
     int result = 0;
     switch (decision) {
         case HazyDecisionDrop:
-            CLOG_C_VERBOSE(&self->log, "decision: dropped packet")
+            hazyDirectionDropOnWrite(self, sequence, data, octetCount, HazyTraceDropCauseDecision, now);
+            hazyDirectionFreeOwned(self, ownedData);
             return 0;
-        case HazyDecisionDuplicate: {
-            int count = (rand() % 3) + 1;
-            CLOG_C_VERBOSE(&self->log, "decision: duplicate packet %d count", count)
-            for (int i = 0; i < count; ++i) {
-                hazyWriteOut(self, data, octetCount, false);
-                result = hazyWriteOut(self, data, octetCount, false);
-            }
-        } break;
-        case HazyDecisionOutOfOrder: {
-            CLOG_C_VERBOSE(&self->log, "decision: out of order packet")
-            // Send this in the future so it is likely reordered
-            HazyLatencyMs latency = self->latency.latency;
-            const int sendInterval = 16; // ms
-            const int reorderLatency = sendInterval * ((rand() % 3) + 1);
-            self->latency.latency += reorderLatency;
-            result = hazyWriteOut(self, data, octetCount, true);
-            self->latency.latency = latency;
-        } break;
-        case HazyDecisionTamper: {
-            uint8_t temp[1200];
-            for (size_t index = 0; index < octetCount; ++index) {
-                temp[index] = (uint8_t) rand();
+        case HazyDecisionDuplicate:
+#if HAZY_FEATURE_DUPLICATE
+            result = hazyWriteDuplicates(self, data, octetCount, ownedData, sequence, now);
+#else
+            result = hazyWritePassing(self, data, octetCount, ownedData, sequence, now);
+#endif
+            break;
+        case HazyDecisionOutOfOrder:
+            if (!hazyReorderHold(&self->reorder, data, octetCount, ownedData, sequence, now)) {
+                result = hazyWritePassing(self, data, octetCount, ownedData, sequence, now);
             }
-            result = hazyWriteOut(self, temp, octetCount, false);
-            CLOG_C_VERBOSE(&self->log, "decision: garble packet")
-        } break;
+            break;
+        case HazyDecisionTamper:
+#if HAZY_FEATURE_TAMPER
+            result = hazyWriteTampered(self, data, octetCount, ownedData, sequence, now);
+#else
+            result = hazyWritePassing(self, data, octetCount, ownedData, sequence, now);
+#endif
+            break;
         case HazyDecisionOriginal:
-            CLOG_C_VERBOSE(&self->log, "decision: original")
-            result = hazyWriteOut(self, data, octetCount, false);
+            result = hazyWritePassing(self, data, octetCount, ownedData, sequence, now);
             break;
     }
 
     return result;
 }
 
+/// Writes a packet to the direction at an explicit time, e.g. from a virtual clock
+/// @param self direction
+/// @param data packet payload
+/// @param octetCount packet size
+/// @param now current time
+/// @return negative on error, HAZY_ERROR_WOULD_BLOCK if the queue is full and the overflow policy is
+/// HazyOverflowPolicyWouldBlock
+int hazyWriteDirectionAt(HazyDirection* self, const uint8_t* data, size_t octetCount, MonotonicTimeMs now)
+{
+    return hazyWriteDirectionPayload(self, data, octetCount, 0, now);
+}
+
+/// Writes a packet without copying it, the direction takes over the payload. The payload must have been
+/// allocated with the allocator that the direction was initialized with, e.g. taken from another direction.
+/// @param self direction
+/// @param data packet payload, owned by the direction afterwards, unless HAZY_ERROR_WOULD_BLOCK is returned
+/// @param octetCount packet size
+/// @param now current time
+/// @return negative on error, HAZY_ERROR_WOULD_BLOCK if the queue is full and the overflow policy is
+/// HazyOverflowPolicyWouldBlock
+int hazyWriteDirectionOwnedAt(HazyDirection* self, uint8_t* data, size_t octetCount, MonotonicTimeMs now)
+{
+    return hazyWriteDirectionPayload(self, data, octetCount, data, now);
+}
+
 HazyDirectionOnlyConfig hazyDirectionOnlyConfigGoodCondition(void)
 {
-    HazyDirectionOnlyConfig config = {0, 0, 0, 0};
+    HazyDirectionOnlyConfig config = {0, 0, 0, 0, HazyOverflowPolicyDropNewest};
     return config;
 }
 
 HazyDirectionOnlyConfig hazyDirectionOnlyConfigRecommended(void)
 {
-    HazyDirectionOnlyConfig config = {60000, 10000, 100, 10};
+    HazyDirectionOnlyConfig config = {60000, 10000, 100, 10, HazyOverflowPolicyDropNewest};
     return config;
 }
 
 HazyDirectionOnlyConfig hazyDirectionOnlyConfigWorstCase(void)
 {
-    HazyDirectionOnlyConfig config = {10000, 5000, 100, 50};
+    HazyDirectionOnlyConfig config = {10000, 5000, 100, 50, HazyOverflowPolicyDropNewest};
     return config;
 }
 
 HazyDirectionConfig hazyDirectionConfigGoodCondition(void)
 {
-    HazyDirectionConfig config = {hazyDeciderGoodCondition(), hazyLatencyGoodCondition(), hazyDirectionOnlyConfigGoodCondition()};
+    HazyDirectionConfig config = {hazyDeciderGoodCondition(), hazyLatencyGoodCondition(),
+                                  hazyDirectionOnlyConfigGoodCondition(), hazyBottleneckDisabled(),
+                                  hazyReorderGoodCondition(), hazyWireDisabled()};
     return config;
 }
 
 HazyDirectionConfig hazyDirectionConfigRecommended(void)
 {
-    HazyDirectionConfig config = {hazyDeciderRecommended(), hazyLatencyRecommended(), hazyDirectionOnlyConfigRecommended()};
+    HazyDirectionConfig config = {hazyDeciderRecommended(), hazyLatencyRecommended(),
+                                  hazyDirectionOnlyConfigRecommended(), hazyBottleneckDisabled(),
+                                  hazyReorderRecommended(), hazyWireDisabled()};
     return config;
 }
 
 HazyDirectionConfig hazyDirectionConfigWorstCase(void)
 {
-    HazyDirectionConfig config = {hazyDeciderWorstCase(), hazyLatencyWorstCase(), hazyDirectionOnlyConfigWorstCase()};
+    HazyDirectionConfig config = {hazyDeciderWorstCase(), hazyLatencyWorstCase(),
+                                  hazyDirectionOnlyConfigWorstCase(), hazyBottleneckDisabled(),
+                                  hazyReorderWorstCase(), hazyWireDisabled()};
     return config;
 }
@@ -5,55 +5,63 @@
 #include <hazy/latency.h>
 #include <math.h>
 
+static const float normalRamp = 2.0f;
+static const float aggressiveRamp = 50.0f;
+static const float outOfRangeRamp = 50.0f;
+static const MonotonicTimeMs minRestMs = 200;
+static const MonotonicTimeMs maxRestMs = 1000;
+
 void hazyLatencyInit(HazyLatency* self, HazyLatencyConfig config, Clog log)
 {
     self->log = log;
-    self->latency = (HazyLatencyMs) (config.minLatency + config.maxLatency) / 2;
-    self->targetLatency = self->latency;
-    self->config = config;
-    self->phase = HazyLatencyPhaseNormal;
-    self->nextDriftEstimationMs = 0;
+    hazyRandomInit(&self->random, 0);
+    self->cycleSeed = 0;
+    hazyLatencySetConfig(self, config);
+    self->lastUpdateTimeMs = 0;
+}
+
+/// Starts over from the middle of the latency range, as if no time has passed
+/// @param self latency
+void hazyLatencyReset(HazyLatency* self)
+{
+    hazyLatencySetConfig(self, self->config);
     self->lastUpdateTimeMs = 0;
 }
 
+/// Sets the config and the latency to the middle of the range. The drift cycles start at the next evaluation.
+/// @param self latency
+/// @param config new latency config
 void hazyLatencySetConfig(HazyLatency* self, HazyLatencyConfig config)
 {
     self->latency = (HazyLatencyMs) (config.minLatency + config.maxLatency) / 2;
+    self->startLatency = self->latency;
     self->targetLatency = self->latency;
     self->config = config;
     self->phase = HazyLatencyPhaseNormal;
-    self->nextDriftEstimationMs = 0;
+    self->driftStartMs = 0;
+    self->driftEndMs = 0;
+    self->latencyDiffPerSecond = 0.0f;
+    self->cycleStartLatency = self->latency;
+    self->cycleOriginMs = 0;
+    self->cyclePeriodMs = 0;
+    self->cycleMinLatency = 0;
+    self->cycleLatencyRange = 0;
+    self->pending = HazyLatencyPendingStart;
 }
 
-static bool reachTargetLatency(HazyLatency* self, float deltaSeconds)
+int hazyLatencyGetLatencyWithJitter(HazyLatency* self, MonotonicTimeMs now)
 {
-    int diff = ((int) self->targetLatency - (int) self->precisionLatency);
-    if (abs(diff) < 1) {
-        //CLOG_C_VERBOSE(&self->log, "hit target %f", self->precisionLatency)
-        self->latency = self->targetLatency;
-        return true;
-    }
+    hazyLatencyUpdate(self, now);
 
-    float changeThisTick = self->latencyDiffPerSecond * deltaSeconds;
-    float floatDiff = (float) diff;
-    float floatAbsDiff = fabsf(floatDiff);
-    if (changeThisTick >= floatAbsDiff) {
-        changeThisTick = floatAbsDiff;
+    if (self->config.latencyJitter == 0) {
+        return self->latency;
     }
 
-    //CLOG_C_VERBOSE(&self->log, "deltaTime: %f changeThisTick: %f", deltaSeconds, changeThisTick)
-
-    self->precisionLatency += copysignf(changeThisTick, floatDiff);
-    self->latency = (HazyLatencyMs) self->precisionLatency;
+    HazyLatencyMs jitterForThisPacket = (HazyLatencyMs) hazyRandomRange(
+        &self->random, (uint32_t) (self->config.latencyJitter * 2 + 1));
 
-    return false;
-}
-
-int hazyLatencyGetLatencyWithJitter(HazyLatency* self)
-{
-    HazyLatencyMs jitterForThisPacket = (HazyLatencyMs) rand() % (self->config.latencyJitter * 2 + 1);
-
-    bool jitterSpikeThisPacket = (rand() % (int)self->config.chanseJitterSpike) == 0;
+    bool jitterSpikeThisPacket = self->config.chanseJitterSpike != 0 &&
+                                 hazyRandomRange(&self->random, (uint32_t) self->config.chanseJitterSpike) == 0;
     if (jitterSpikeThisPacket)
     {
         jitterForThisPacket *= 3;
@@ -68,62 +76,189 @@ static HazyLatencyMs calculateTargetLatency(HazyLatency* self)
     if (diff == 0) {
         diff = 1;
     }
-    return (HazyLatencyMs) self->config.minLatency + (HazyLatencyMs) rand() % diff;
+    return (HazyLatencyMs) (self->config.minLatency + hazyRandomRange(&self->random, (uint32_t) diff));
 }
 
-static float calculateLatencyChangePerSecond(HazyLatency* self)
+/// Takes the target range from the config. The cycle period fits half of a drift across the whole range at the
+/// normal ramp, and the rest after it. Longer drifts ramp faster, so every drift ends within its cycle.
+static void setCycleRange(HazyLatency* self)
 {
-    const float normalRamp = 2.0f;
-    const float aggressiveRamp = 50.0f;
+    size_t range = self->config.maxLatency > self->config.minLatency
+                       ? self->config.maxLatency - self->config.minLatency
+                       : 1;
+    if (range > UINT16_MAX) {
+        range = UINT16_MAX;
+    }
 
-    bool timeForAggressiveRamp = (rand() % 10) == 0;
-    if (timeForAggressiveRamp) {
-#if defined CLOG_LOG_ENABLED
-        CLOG_C_VERBOSE(&self->log, "time for aggressive ramp")
-#else
-        (void) self;
-#endif
+    self->cycleMinLatency = (HazyLatencyMs) self->config.minLatency;
+    self->cycleLatencyRange = (HazyLatencyMs) range;
+    self->cyclePeriodMs = (MonotonicTimeMs) ceilf((float) range * 1000.0f / normalRamp / 2.0f) + maxRestMs;
+}
+
+/// The random value of the cycle that starts at `cycleStartMs`. It only depends on the seed and the start time.
+static uint64_t cycleValue(const HazyLatency* self, MonotonicTimeMs cycleStartMs)
+{
+    return hazyRandomMix(self->cycleSeed + (uint64_t) cycleStartMs);
+}
+
+static HazyLatencyMs cycleTarget(const HazyLatency* self, uint64_t value)
+{
+    return (HazyLatencyMs) (self->cycleMinLatency + (uint32_t) value % self->cycleLatencyRange);
+}
+
+/// Sets the ramp from the start latency towards the target latency
+static void setDriftEnd(HazyLatency* self)
+{
+    int diff = abs((int) self->targetLatency - (int) self->startLatency);
+
+    self->driftEndMs = self->driftStartMs +
+                       (MonotonicTimeMs) ceilf((float) diff * 1000.0f / self->latencyDiffPerSecond);
+}
+
+/// Sets the drift to the one of the cycle that contains `now`, without stepping through the cycles before it
+static void setCycleDrift(HazyLatency* self, MonotonicTimeMs now)
+{
+    MonotonicTimeMs cycleIndex = (now - self->cycleOriginMs) / self->cyclePeriodMs;
+    MonotonicTimeMs startMs = self->cycleOriginMs + cycleIndex * self->cyclePeriodMs;
+    uint64_t value = cycleValue(self, startMs);
+
+    self->startLatency = cycleIndex == 0 ? self->cycleStartLatency
+                                         : cycleTarget(self, cycleValue(self, startMs - self->cyclePeriodMs));
+    self->targetLatency = cycleTarget(self, value);
+    self->driftStartMs = startMs;
+
+    bool timeForAggressiveRamp = (value >> 32) % 10 == 0;
+    float ramp = timeForAggressiveRamp ? aggressiveRamp : normalRamp;
+    int diff = abs((int) self->targetLatency - (int) self->startLatency);
+    float fittingRamp = (float) diff * 1000.0f / (float) (self->cyclePeriodMs - minRestMs);
+    self->latencyDiffPerSecond = ramp > fittingRamp ? ramp : fittingRamp;
+    setDriftEnd(self);
+}
+
+/// The latency on the ramp, same as integrating latencyDiffPerSecond from the start of the drift
+static HazyLatencyMs latencyOnRamp(const HazyLatency* self, MonotonicTimeMs now)
+{
+    MonotonicTimeMs elapsedMs = now > self->driftStartMs ? now - self->driftStartMs : 0;
+    float change = self->latencyDiffPerSecond * (float) elapsedMs / 1000.0f;
+    float diff = (float) ((int) self->targetLatency - (int) self->startLatency);
+    if (change >= fabsf(diff)) {
+        return self->targetLatency;
     }
 
-    return timeForAggressiveRamp ? aggressiveRamp : normalRamp;
+    return (HazyLatencyMs) ((float) self->startLatency + copysignf(change, diff));
+}
+
+static void evaluateDrift(HazyLatency* self, MonotonicTimeMs now)
+{
+    // Before the origin, the drift that leads into the first cycle is still running
+    if (now >= self->cycleOriginMs) {
+        setCycleDrift(self, now);
+    }
+
+    self->phase = now < self->driftEndMs ? HazyLatencyPhaseDrifting : HazyLatencyPhaseNormal;
+    self->latency = self->phase == HazyLatencyPhaseDrifting ? latencyOnRamp(self, now) : self->targetLatency;
+}
+
+/// Starts the drift cycles, or moves them over to a changed config, at the first evaluation after the change
+static void resolvePending(HazyLatency* self, MonotonicTimeMs now)
+{
+    HazyLatencyPending pending = self->pending;
+    if (pending == HazyLatencyPendingNone) {
+        return;
+    }
+    self->pending = HazyLatencyPendingNone;
+
+    if (pending == HazyLatencyPendingStart) {
+        uint64_t upper = hazyRandomNext(&self->random);
+        uint64_t lower = hazyRandomNext(&self->random);
+        // Relative to the start of the timeline, so the cycles do not depend on where the clock starts
+        self->cycleSeed = (upper << 32 | lower) - (uint64_t) now;
+        self->cycleOriginMs = now;
+        self->cycleStartLatency = self->latency;
+        setCycleRange(self);
+        return;
+    }
+
+    // Where the latency is now, with the range the cycles were started with
+    evaluateDrift(self, now);
+
+    if (self->targetLatency < self->config.minLatency || self->targetLatency > self->config.maxLatency) {
+        // Drift into the new range, instead of jumping
+        self->startLatency = self->latency;
+        self->targetLatency = calculateTargetLatency(self);
+        self->latencyDiffPerSecond = outOfRangeRamp;
+        self->driftStartMs = now;
+        setDriftEnd(self);
+        self->cycleOriginMs = self->driftEndMs + minRestMs;
+    } else if (now >= self->cycleOriginMs) {
+        // The current cycle runs to its end, the next one is the first with the new range
+        self->cycleOriginMs = self->driftStartMs + self->cyclePeriodMs;
+    }
+
+    self->cycleStartLatency = self->targetLatency;
+    setCycleRange(self);
+}
+
+/// Changes the config without resetting the latency. The new range is used from the next drift cycle.
+/// If the current target is outside of the new range, a new target is picked and the latency drifts there,
+/// instead of jumping.
+/// @param self latency
+/// @param config new latency config
+void hazyLatencyAdjustConfig(HazyLatency* self, HazyLatencyConfig config)
+{
+    self->config = config;
+
+    if (self->pending < HazyLatencyPendingAdjust) {
+        self->pending = HazyLatencyPendingAdjust;
+    }
 }
 
+/// Evaluates the latency at `now`. The drift is piecewise linear and the cycles have a fixed period, so the
+/// cycle that contains `now` is evaluated directly, no matter how long ago the previous evaluation was.
+/// The timeline starts at the first evaluation. After that, the result does not depend on how often this is
+/// called, and it does not have to be called for idle connections, since the latency is also evaluated when
+/// a packet is stamped.
+/// @param self latency
+/// @param now current time
 void hazyLatencyUpdate(HazyLatency* self, MonotonicTimeMs now)
 {
-    if (!self->lastUpdateTimeMs) {
+    if (now > self->lastUpdateTimeMs) {
         self->lastUpdateTimeMs = now;
     }
-    MonotonicTimeMs deltaMs = now - self->lastUpdateTimeMs;
-    self->lastUpdateTimeMs = now;
-
-    switch (self->phase) {
-        case HazyLatencyPhaseNormal:
-            if (now >= self->nextDriftEstimationMs) {
-                self->phase = HazyLatencyPhaseDrifting;
-                self->targetLatency = calculateTargetLatency(self);
-                self->latencyDiffPerSecond = calculateLatencyChangePerSecond(self);
-                self->precisionLatency = self->latency;
-                self->nextDriftEstimationMs = 0;
-                CLOG_C_VERBOSE(&self->log, "new target latency: %d", self->targetLatency)
-            }
-
-            break;
-        case HazyLatencyPhaseDrifting: {
-            float deltaSeconds = (float) deltaMs / 1000.0f;
-            bool reachedTarget = reachTargetLatency(self, deltaSeconds);
-            if (reachedTarget) {
-                CLOG_C_VERBOSE(&self->log, "drifting complete %d", self->latency)
-                self->phase = HazyLatencyPhaseNormal;
-                MonotonicTimeMs nextTime = rand() % 1000 + 200;
-                self->nextDriftEstimationMs = now + nextTime;
-            }
-        } break;
+
+#if defined CLOG_LOG_ENABLED
+    MonotonicTimeMs previousDriftStartMs = self->driftStartMs;
+#endif
+
+    resolvePending(self, now);
+    evaluateDrift(self, now);
+
+#if defined CLOG_LOG_ENABLED
+    if (self->driftStartMs != previousDriftStartMs) {
+        CLOG_C_VERBOSE(&self->log, "new target latency: %d, %.1f ms/s", self->targetLatency,
+                       (double) self->latencyDiffPerSecond)
     }
-#if defined HAZY_LOG_ENABLE
-    CLOG_C_VERBOSE(&self->log, "latency: %d (phase %d)", self->latency, self->phase)
 #endif
 }
 
+/// Evaluates the latency at `now` without changing it, e.g. for sampling and tracing.
+/// Gives the same result as hazyLatencyUpdate() would.
+/// @param self latency
+/// @param now time to evaluate the latency at
+/// @return latency, target latency, ramp and phase at `now`
+HazyLatencyState hazyLatencyAt(const HazyLatency* self, MonotonicTimeMs now)
+{
+    HazyLatency evaluated = *self;
+
+    resolvePending(&evaluated, now);
+    evaluateDrift(&evaluated, now);
+
+    HazyLatencyState state = {evaluated.latency, evaluated.targetLatency, evaluated.latencyDiffPerSecond,
+                              evaluated.phase};
+
+    return state;
+}
+
 HazyLatencyConfig hazyLatencyGoodCondition(void)
 {
     HazyLatencyConfig config = {38/2, 45/2, 6, 1000};
@@ -0,0 +1,124 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include <hazy/link.h>
+
+/// The time of the link, either the virtual time or the monotonic time
+/// @param self link
+/// @return current time
+MonotonicTimeMs hazyLinkNow(const HazyLink* self)
+{
+    return self->useVirtualClock ? self->virtualNow : monotonicTimeMsNow();
+}
+
+static int hazyLinkSendFn(void* self_, const uint8_t* data, size_t size)
+{
+    HazyLinkEndpoint* self = self_;
+
+    return hazyWriteDirectionAt(self->sendDirection, data, size, hazyLinkNow(self->link));
+}
+
+static ssize_t hazyLinkReceiveFn(void* self_, uint8_t* data, size_t size)
+{
+    HazyLinkEndpoint* self = self_;
+    HazyDirection* direction = self->receiveDirection;
+    MonotonicTimeMs now = hazyLinkNow(self->link);
+
+    HazyPacket packet;
+    if (!hazyPacketsFindPacketToActOn(&direction->packets, now, &packet)) {
+        return 0;
+    }
+
+    ssize_t returnValue = (ssize_t) packet.octetCount;
+    if (packet.octetCount <= size) {
+        tc_memcpy_octets(data, packet.data, packet.octetCount);
+        hazyDirectionPacketDelivered(direction, &packet, now);
+    } else {
+        CLOG_C_WARN(&self->link->log, "couldn't copy to target, capacity too small")
+        returnValue = -4;
+    }
+    hazyPacketsDestroyPacket(&direction->packets, &packet);
+
+    return returnValue;
+}
+
+static void hazyLinkEndpointInit(HazyLinkEndpoint* self, HazyLink* link, HazyDirection* sendDirection,
+                                 HazyDirection* receiveDirection)
+{
+    self->transport.self = self;
+    self->transport.send = hazyLinkSendFn;
+    self->transport.receive = hazyLinkReceiveFn;
+    self->link = link;
+    self->sendDirection = sendDirection;
+    self->receiveDirection = receiveDirection;
+}
+
+/// Initializes the link. It uses the monotonic time until hazyLinkSetVirtualTime() is called.
+/// @param self link
+/// @param allocatorWithFree allocator for the queued packets
+/// @param config the out direction is from the client to the server, and in is from the server to the client
+/// @param log log
+void hazyLinkInit(HazyLink* self, struct ImprintAllocatorWithFree* allocatorWithFree, HazyConfig config, Clog log)
+{
+    tc_snprintf(self->debugPrefix, 32, "%s/link", log.constantPrefix);
+    self->log.config = log.config;
+    self->log.constantPrefix = self->debugPrefix;
+
+    hazyDirectionInit(&self->clientToServer, 0, allocatorWithFree, config.out, self->log);
+    hazyDirectionInit(&self->serverToClient, 0, allocatorWithFree, config.in, self->log);
+    hazyLinkEndpointInit(&self->client, self, &self->clientToServer, &self->serverToClient);
+    hazyLinkEndpointInit(&self->server, self, &self->serverToClient, &self->clientToServer);
+
+    self->useVirtualClock = false;
+    self->virtualNow = 0;
+}
+
+/// Discards all packets in flight
+/// @param self link
+void hazyLinkReset(HazyLink* self)
+{
+    hazyDirectionReset(&self->clientToServer);
+    hazyDirectionReset(&self->serverToClient);
+}
+
+void hazyLinkSetConfig(HazyLink* self, HazyConfig config)
+{
+    hazyDirectionSetConfig(&self->clientToServer, config.out);
+    hazyDirectionSetConfig(&self->serverToClient, config.in);
+}
+
+void hazyLinkSetSeed(HazyLink* self, uint64_t seed)
+{
+    hazyDirectionSetSeed(&self->clientToServer, seed);
+    hazyDirectionSetSeed(&self->serverToClient, hazyRandomMix(seed));
+}
+
+/// Switches the link to a virtual clock, that only moves with hazyLinkAdvance().
+/// @param self link
+/// @param now virtual time, must not be before the previous time
+void hazyLinkSetVirtualTime(HazyLink* self, MonotonicTimeMs now)
+{
+    self->useVirtualClock = true;
+    self->virtualNow = now;
+}
+
+/// Moves the virtual clock forward and updates the link, see hazyLinkSetVirtualTime()
+/// @param self link
+/// @param deltaMs time to move forward
+void hazyLinkAdvance(HazyLink* self, MonotonicTimeMs deltaMs)
+{
+    self->virtualNow += deltaMs;
+    hazyLinkUpdate(self);
+}
+
+/// Updates the drop bursts and the held back packets of both directions.
+/// Datagrams that are due can be received from the endpoints afterwards.
+/// @param self link
+void hazyLinkUpdate(HazyLink* self)
+{
+    MonotonicTimeMs now = hazyLinkNow(self);
+
+    hazyDirectionUpdate(&self->clientToServer, now);
+    hazyDirectionUpdate(&self->serverToClient, now);
+}
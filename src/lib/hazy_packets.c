@@ -7,127 +7,240 @@
 #include <imprint/allocator.h>
 #include <stdbool.h>
 
-#define HAZY_LOG_ENABLE (0)
-
 void hazyPacketsInit(HazyPackets* self, struct ImprintAllocatorWithFree* allocator)
 {
     self->allocatorWithFree = allocator;
     self->packetCount = 0;
-    self->capacity = HAZY_PACKETS_CAPACITY;
-    for (size_t i = 0; i < self->capacity; ++i) {
-        self->packets[i].indexForDebug = (int) i;
-        self->packets[i].octetCount = 0;
-        self->packets[i].data = 0;
-        self->packets[i].timeToAct = 0;
+    self->freeCount = HAZY_PACKETS_CAPACITY;
+    for (size_t i = 0; i < HAZY_PACKETS_CAPACITY; ++i) {
+        self->timeToAct[i] = HAZY_PACKET_TIME_FREE;
+        self->created[i] = 0;
+        self->sequence[i] = 0;
+        self->octetCount[i] = 0;
+        self->data[i] = 0;
+        // Pop the low indices first
+        self->freeIndices[i] = (uint8_t) (HAZY_PACKETS_CAPACITY - 1 - i);
     }
+    self->baseTimeMs = 0;
     self->lastTimeAdded = 0;
+    self->lastSequenceAdded = 0;
     self->lastTimeIsValid = false;
 }
 
-static HazyPacket* hazyPacketsFindFree(HazyPackets* self)
+/// Frees all queued packets
+/// @param self packets
+void hazyPacketsReset(HazyPackets* self)
 {
-    for (size_t i = 0; i < self->capacity; ++i) {
-        if (self->packets[i].data == 0) {
-            return &self->packets[i];
+    for (size_t i = 0; i < HAZY_PACKETS_CAPACITY; ++i) {
+        if (self->data[i] != 0) {
+            IMPRINT_FREE(self->allocatorWithFree, (void*) self->data[i]);
         }
     }
 
-    return 0;
+    hazyPacketsInit(self, self->allocatorWithFree);
 }
 
-int hazyPacketsRead(HazyPackets* self, uint8_t* data, size_t capacity, Clog* log)
+static HazyPacketTime hazyPacketsRelativeTime(const HazyPackets* self, MonotonicTimeMs time)
 {
-    HazyPacket* packet = hazyPacketsFindPacketToActOn(self);
-    if (packet == 0) {
+    MonotonicTimeMs relative = time - self->baseTimeMs;
+    if (relative < 0) {
         return 0;
     }
-    size_t octetCount = packet->octetCount;
-    int returnValue = (int) octetCount;
-    if (octetCount <= capacity) {
-        tc_memcpy_octets(data, packet->data, octetCount);
-#if defined HAZY_LOG_ENABLE
-        CLOG_C_VERBOSE(log, "read copied to target. index: %d, octetCount: %zu", packet->indexForDebug,
-                       octetCount)
-#else
-        (void) log;
-        (void) packet;
-#endif
-    } else {
-        (void) log;
-        CLOG_C_WARN(log, "couldn't copy to target, capacity too small")
-        returnValue = -4;
-    }
-    hazyPacketsDestroyPacket(self, packet);
-
-    return returnValue;
+    if (relative >= (MonotonicTimeMs) HAZY_PACKET_TIME_FREE) {
+        return HAZY_PACKET_TIME_FREE - 1;
+    }
+
+    return (HazyPacketTime) relative;
 }
 
-HazyPacket* hazyPacketsWrite(HazyPackets* self, const uint8_t* buf, size_t octetsRead, MonotonicTimeMs timeToAct,
-                             Clog* log)
+int hazyPacketsWrite(HazyPackets* self, const uint8_t* buf, size_t octetsRead, uint32_t sequence,
+                     MonotonicTimeMs timeToAct, MonotonicTimeMs now, Clog* log)
 {
-    HazyPacket* packet = hazyPacketsFindFree(self);
-    if (packet == 0) {
-        CLOG_C_ERROR(log, "out of capacity")
-    }
-
-    packet->octetCount = octetsRead;
     uint8_t* target = IMPRINT_ALLOC_TYPE_COUNT(&self->allocatorWithFree->allocator, uint8_t, octetsRead);
     tc_memcpy_octets(target, buf, octetsRead);
-    packet->data = target;
-    packet->timeToAct = timeToAct;
-    packet->created = monotonicTimeMsNow();
+
+    int index = hazyPacketsWriteOwned(self, target, octetsRead, sequence, timeToAct, now, log);
+    if (index < 0) {
+        IMPRINT_FREE(self->allocatorWithFree, target);
+    }
+
+    return index;
+}
+
+/// Queues a payload without copying it. The payload must have been allocated from the allocator of the packets.
+/// @param self packets
+/// @param data payload, owned by the packets if successful
+/// @param octetCount payload size
+/// @param sequence packet sequence
+/// @param timeToAct time when the packet is due
+/// @param now current time
+/// @param log log
+/// @return the index of the packet, or negative on error. On error the caller still owns the payload.
+int hazyPacketsWriteOwned(HazyPackets* self, uint8_t* data, size_t octetCount, uint32_t sequence,
+                          MonotonicTimeMs timeToAct, MonotonicTimeMs now, Clog* log)
+{
+    if (self->freeCount == 0) {
+        CLOG_C_WARN(log, "out of capacity")
+        return -45;
+    }
+
+    if (octetCount > UINT16_MAX) {
+        CLOG_C_WARN(log, "datagram is too big %zu", octetCount)
+        return -2;
+    }
+
+    // The relative times only have to be valid while packets are queued, so move the base when it is empty
+    if (self->packetCount == 0) {
+        self->baseTimeMs = now;
+    }
+
+    size_t index = self->freeIndices[--self->freeCount];
+
+    self->data[index] = data;
+    self->octetCount[index] = (uint16_t) octetCount;
+    self->timeToAct[index] = hazyPacketsRelativeTime(self, timeToAct);
+    self->created[index] = hazyPacketsRelativeTime(self, now);
+    self->sequence[index] = sequence;
     self->packetCount++;
     self->lastTimeAdded = timeToAct;
+    self->lastSequenceAdded = sequence;
     self->lastTimeIsValid = true;
 
-    return packet;
+    return (int) index;
 }
 
-void hazyPacketsDestroyPacket(HazyPackets* self, HazyPacket* packetToDiscard)
+static void hazyPacketsFreeSlot(HazyPackets* self, size_t index)
 {
-    if (packetToDiscard->data == 0) {
+    if (index >= HAZY_PACKETS_CAPACITY || self->data[index] == 0) {
         CLOG_ERROR("illegal discard")
     }
     if (self->packetCount == 0) {
         CLOG_ERROR("internal error")
     }
-    IMPRINT_FREE(self->allocatorWithFree, (void*) packetToDiscard->data);
-    packetToDiscard->data = 0;
-    packetToDiscard->octetCount = 0;
+    self->data[index] = 0;
+    self->octetCount[index] = 0;
+    self->timeToAct[index] = HAZY_PACKET_TIME_FREE;
+    self->freeIndices[self->freeCount++] = (uint8_t) index;
     self->packetCount--;
 }
 
-HazyPacket* hazyPacketsFindPacketToActOn(HazyPackets* self)
+void hazyPacketsDestroyPacket(HazyPackets* self, const HazyPacket* packetToDiscard)
+{
+    uint8_t* data = self->data[packetToDiscard->index];
+    hazyPacketsFreeSlot(self, packetToDiscard->index);
+    IMPRINT_FREE(self->allocatorWithFree, data);
+}
+
+/// Removes the packet from the queue without freeing the payload, so it can be handed to another queue
+/// @param self packets
+/// @param packet packet found with hazyPacketsFindPacketToActOn()
+/// @return the payload, now owned by the caller
+uint8_t* hazyPacketsTakePacket(HazyPackets* self, const HazyPacket* packet)
+{
+    uint8_t* data = self->data[packet->index];
+    hazyPacketsFreeSlot(self, packet->index);
+
+    return data;
+}
+
+static void hazyPacketsMoveBase(HazyPackets* self, MonotonicTimeMs baseTimeMs)
 {
-    MonotonicTimeMs now = monotonicTimeMsNow();
-    MonotonicTimeMs minimumToActOn = 0;
-    HazyPacket* foundPacket = 0;
-    for (size_t i = 0; i < self->capacity; ++i) {
-        HazyPacket* packet = &self->packets[i];
-        if (!packet->octetCount) {
+    HazyPacketTime delta = (HazyPacketTime) (self->baseTimeMs - baseTimeMs);
+    for (size_t i = 0; i < HAZY_PACKETS_CAPACITY; ++i) {
+        if (self->timeToAct[i] != HAZY_PACKET_TIME_FREE) {
+            self->timeToAct[i] += delta;
+            self->created[i] += delta;
+        }
+    }
+    self->baseTimeMs = baseTimeMs;
+}
+
+/// Puts a packet taken with hazyPacketsTakePacket() back into the queue, with its original times,
+/// e.g. when it could not be sent yet
+/// @param self packets
+/// @param packet the taken packet, the payload is owned by the packets if successful
+/// @param log log
+/// @return the index of the packet, or negative on error. On error the caller still owns the payload.
+int hazyPacketsPutBack(HazyPackets* self, const HazyPacket* packet, Clog* log)
+{
+    if (self->freeCount == 0) {
+        CLOG_C_WARN(log, "out of capacity")
+        return -45;
+    }
+
+    if (self->packetCount == 0) {
+        self->baseTimeMs = packet->created;
+    } else if (packet->created < self->baseTimeMs) {
+        hazyPacketsMoveBase(self, packet->created);
+    }
+
+    size_t index = self->freeIndices[--self->freeCount];
+
+    self->data[index] = packet->data;
+    self->octetCount[index] = (uint16_t) packet->octetCount;
+    self->timeToAct[index] = hazyPacketsRelativeTime(self, packet->timeToAct);
+    self->created[index] = hazyPacketsRelativeTime(self, packet->created);
+    self->sequence[index] = packet->sequence;
+    self->packetCount++;
+
+    return (int) index;
+}
+
+/// Finds the packet that is due first, even if it is not due yet
+/// @param self packets
+/// @param[out] packet the found packet
+/// @return true if there is any packet
+bool hazyPacketsFindEarliest(const HazyPackets* self, HazyPacket* packet)
+{
+    return hazyPacketsFindPacketToActOn(self, self->baseTimeMs + (MonotonicTimeMs) HAZY_PACKET_TIME_FREE, packet);
+}
+
+/// Compares packet sequences, that are allowed to wrap around
+/// @param sequence packet sequence
+/// @param other packet sequence to compare with
+/// @return true if sequence was written before other
+bool hazyPacketsSequenceIsBefore(uint32_t sequence, uint32_t other)
+{
+    return (int32_t) (sequence - other) < 0;
+}
+
+/// Finds the packet that has been due the longest. Packets that are due at the same time are found in
+/// sequence order.
+/// @param self packets
+/// @param now current time
+/// @param[out] packet the found packet
+/// @return true if a packet is due
+bool hazyPacketsFindPacketToActOn(const HazyPackets* self, MonotonicTimeMs now, HazyPacket* packet)
+{
+    if (self->packetCount == 0 || now < self->baseTimeMs) {
+        return false;
+    }
+
+    // Free slots are HAZY_PACKET_TIME_FREE, which is always later than relativeNow
+    HazyPacketTime relativeNow = hazyPacketsRelativeTime(self, now);
+    HazyPacketTime earliest = HAZY_PACKET_TIME_FREE;
+    size_t foundIndex = HAZY_PACKETS_CAPACITY;
+    for (size_t i = 0; i < HAZY_PACKETS_CAPACITY; ++i) {
+        HazyPacketTime timeToAct = self->timeToAct[i];
+        if (timeToAct > relativeNow || timeToAct > earliest) {
             continue;
         }
-        if (now >= packet->timeToAct) {
-            MonotonicTimeMs timeSinceThreshold = packet->timeToAct - now;
-            if (timeSinceThreshold < minimumToActOn) {
-                minimumToActOn = timeSinceThreshold;
-                foundPacket = packet;
-            }
+        if (timeToAct < earliest || hazyPacketsSequenceIsBefore(self->sequence[i], self->sequence[foundIndex])) {
+            earliest = timeToAct;
+            foundIndex = i;
         }
     }
 
-    if (foundPacket) {
-#if HAZY_LOG_ENABLE
-        MonotonicTimeMs nowMs = monotonicTimeMsNow();
-        MonotonicTimeMs delayedMs = nowMs - foundPacket->created;
-        MonotonicTimeMs intendedLatencyMs = nowMs - foundPacket->timeToAct;
-        CLOG_C_VERBOSE(&self->log, "found packet: actual latency: %ld (intended was %ld) time: %lu", delayedMs,
-                       intendedLatencyMs, nowMs)
-        if (delayedMs > 100) {
-            delayedMs = 0;
-        }
-#endif
+    if (foundIndex == HAZY_PACKETS_CAPACITY) {
+        return false;
     }
 
-    return foundPacket;
+    packet->index = foundIndex;
+    packet->data = self->data[foundIndex];
+    packet->octetCount = self->octetCount[foundIndex];
+    packet->timeToAct = self->baseTimeMs + earliest;
+    packet->created = self->baseTimeMs + self->created[foundIndex];
+    packet->sequence = self->sequence[foundIndex];
+
+    return true;
 }
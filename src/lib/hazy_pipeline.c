@@ -0,0 +1,125 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include <hazy/pipeline.h>
+#include <imprint/allocator.h>
+
+/// Initializes the stages in the order that the packets pass them
+/// @param self pipeline
+/// @param allocatorWithFree allocator for the payloads, shared by all stages
+/// @param stageConfigs config for each stage
+/// @param stageCount number of stages, at most HAZY_PIPELINE_MAX_STAGE_COUNT
+/// @param log log
+/// @return negative on error
+int hazyPipelineInit(HazyPipeline* self, struct ImprintAllocatorWithFree* allocatorWithFree,
+                     const HazyDirectionConfig* stageConfigs, size_t stageCount, Clog log)
+{
+    if (stageCount == 0 || stageCount > HAZY_PIPELINE_MAX_STAGE_COUNT) {
+        CLOG_C_WARN(&log, "illegal stage count %zu", stageCount)
+        return -2;
+    }
+
+    self->log = log;
+    self->stageCount = stageCount;
+    for (size_t i = 0; i < stageCount; ++i) {
+        tc_snprintf(self->debugPrefixes[i], 32, "%s/hop%zu", log.constantPrefix, i);
+        Clog stageLog;
+        stageLog.config = log.config;
+        stageLog.constantPrefix = self->debugPrefixes[i];
+        hazyDirectionInit(&self->stages[i], 0, allocatorWithFree, stageConfigs[i], stageLog);
+    }
+
+    return 0;
+}
+
+/// Discards all packets in all stages
+/// @param self pipeline
+void hazyPipelineReset(HazyPipeline* self)
+{
+    for (size_t i = 0; i < self->stageCount; ++i) {
+        hazyDirectionReset(&self->stages[i]);
+    }
+}
+
+void hazyPipelineSetSeed(HazyPipeline* self, uint64_t seed)
+{
+    for (size_t i = 0; i < self->stageCount; ++i) {
+        hazyDirectionSetSeed(&self->stages[i], hazyRandomMix(seed + i));
+    }
+}
+
+/// Writes a packet to the first stage. This is the only copy of the payload in the pipeline.
+/// @param self pipeline
+/// @param data packet payload
+/// @param octetCount packet size
+/// @param now current time
+/// @return negative on error
+int hazyPipelineWriteAt(HazyPipeline* self, const uint8_t* data, size_t octetCount, MonotonicTimeMs now)
+{
+    return hazyWriteDirectionAt(&self->stages[0], data, octetCount, now);
+}
+
+static void hazyPipelineHandOver(HazyDirection* from, HazyDirection* to, MonotonicTimeMs now)
+{
+    HazyPacket packet;
+    while (hazyPacketsFindPacketToActOn(&from->packets, now, &packet)) {
+        // The next stage refuses packets when it is full, so they stay queued here until there is room
+        if (hazyDirectionWouldBlock(to)) {
+            break;
+        }
+        // Enter the next stage when it was due, not when it was found, so the update interval does not add latency
+        hazyDirectionPacketDelivered(from, &packet, packet.timeToAct);
+        uint8_t* data = hazyPacketsTakePacket(&from->packets, &packet);
+        int result = hazyWriteDirectionOwnedAt(to, data, packet.octetCount, packet.timeToAct);
+        if (result == HAZY_ERROR_WOULD_BLOCK) {
+            // Refused payloads are still owned by the caller
+            IMPRINT_FREE(from->packets.allocatorWithFree, data);
+        }
+        if (result < 0) {
+            CLOG_C_WARN(&from->log, "next stage could not take packet %u (%d)", packet.sequence, result)
+        }
+    }
+}
+
+/// Updates each stage, and moves the packets that are due to the next stage
+/// @param self pipeline
+/// @param now current time
+void hazyPipelineUpdate(HazyPipeline* self, MonotonicTimeMs now)
+{
+    for (size_t i = 0; i < self->stageCount; ++i) {
+        HazyDirection* stage = &self->stages[i];
+        hazyDirectionUpdate(stage, now);
+        if (i + 1 < self->stageCount) {
+            hazyPipelineHandOver(stage, &self->stages[i + 1], now);
+        }
+    }
+}
+
+/// Reads a packet that is due from the last stage
+/// @param self pipeline
+/// @param data target buffer
+/// @param capacity target buffer size
+/// @param now current time
+/// @return the packet size, zero if no packet is due, or negative on error
+int hazyPipelineReadAt(HazyPipeline* self, uint8_t* data, size_t capacity, MonotonicTimeMs now)
+{
+    HazyDirection* last = &self->stages[self->stageCount - 1];
+
+    HazyPacket packet;
+    if (!hazyPacketsFindPacketToActOn(&last->packets, now, &packet)) {
+        return 0;
+    }
+
+    int returnValue = (int) packet.octetCount;
+    if (packet.octetCount <= capacity) {
+        tc_memcpy_octets(data, packet.data, packet.octetCount);
+        hazyDirectionPacketDelivered(last, &packet, now);
+    } else {
+        CLOG_C_WARN(&self->log, "couldn't copy to target, capacity too small")
+        returnValue = -4;
+    }
+    hazyPacketsDestroyPacket(&last->packets, &packet);
+
+    return returnValue;
+}
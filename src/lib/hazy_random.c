@@ -0,0 +1,37 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include <hazy/random.h>
+
+void hazyRandomInit(HazyRandom* self, uint64_t seed)
+{
+    self->state = seed;
+}
+
+/// Scrambles a value, useful for deriving seeds from a single seed
+/// @param value value to scramble
+/// @return scrambled value
+uint64_t hazyRandomMix(uint64_t value)
+{
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+
+    return value ^ (value >> 31);
+}
+
+uint32_t hazyRandomNext(HazyRandom* self)
+{
+    self->state += 0x9e3779b97f4a7c15ULL;
+
+    return (uint32_t) (hazyRandomMix(self->state) >> 32);
+}
+
+/// Returns a random value in the range [0, count)
+/// @param self random
+/// @param count number of possible values, must be greater than zero
+/// @return random value
+uint32_t hazyRandomRange(HazyRandom* self, uint32_t count)
+{
+    return hazyRandomNext(self) % count;
+}
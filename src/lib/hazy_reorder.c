@@ -0,0 +1,175 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include <hazy/reorder.h>
+#include <imprint/allocator.h>
+
+#define HAZY_REORDER_SLOT_MASK (HAZY_REORDER_SLOT_COUNT - 1)
+
+void hazyReorderInit(HazyReorder* self, HazyReorderConfig config, struct ImprintAllocatorWithFree* allocatorWithFree,
+                     Clog log)
+{
+    self->log = log;
+    self->config = config;
+    hazyRandomInit(&self->random, 0);
+    self->allocatorWithFree = allocatorWithFree;
+    self->sequence = 0;
+    self->heldCount = 0;
+    for (size_t i = 0; i < HAZY_REORDER_SLOT_COUNT; ++i) {
+        self->slots[i].data = 0;
+        self->slots[i].octetCount = 0;
+        self->slots[i].heldAtMs = 0;
+        self->slots[i].sequence = 0;
+    }
+}
+
+/// Discards all held back packets
+/// @param self reorder
+void hazyReorderReset(HazyReorder* self)
+{
+    for (size_t i = 0; i < HAZY_REORDER_SLOT_COUNT && self->heldCount > 0; ++i) {
+        if (self->slots[i].data != 0) {
+            hazyReorderRelease(self, &self->slots[i]);
+        }
+    }
+    self->sequence = 0;
+}
+
+void hazyReorderSetConfig(HazyReorder* self, HazyReorderConfig config)
+{
+    self->config = config;
+}
+
+static size_t randomDepth(HazyReorder* self)
+{
+    size_t minDepth = self->config.minDepth > 0 ? self->config.minDepth : 1;
+    size_t maxDepth = self->config.maxDepth >= minDepth ? self->config.maxDepth : minDepth;
+    if (maxDepth > HAZY_REORDER_SLOT_MASK) {
+        maxDepth = HAZY_REORDER_SLOT_MASK;
+    }
+    if (minDepth > maxDepth) {
+        minDepth = maxDepth;
+    }
+
+    return minDepth + hazyRandomRange(&self->random, (uint32_t) (maxDepth - minDepth + 1));
+}
+
+/// Holds back the packet until it has been overtaken by a random number of later packets.
+/// @param self reorder
+/// @param data packet payload
+/// @param octetCount packet size
+/// @param ownedData same as data if the payload is owned, and is then held without a copy. Otherwise NULL.
+/// @param sequence packet sequence, kept for tracing
+/// @param now current time
+/// @return false if there was no free slot, and the packet should be sent as usual. The caller then still
+/// owns the payload.
+bool hazyReorderHold(HazyReorder* self, const uint8_t* data, size_t octetCount, uint8_t* ownedData,
+                     uint32_t sequence, MonotonicTimeMs now)
+{
+    size_t depth = randomDepth(self);
+
+    // If another packet is released at the same sequence, overtake by more packets instead
+    for (; depth <= HAZY_REORDER_SLOT_MASK; ++depth) {
+        HazyReorderSlot* slot = &self->slots[(self->sequence + depth) & HAZY_REORDER_SLOT_MASK];
+        if (slot->data != 0) {
+            continue;
+        }
+
+        if (ownedData != 0) {
+            slot->data = ownedData;
+        } else {
+            slot->data = IMPRINT_ALLOC_TYPE_COUNT(&self->allocatorWithFree->allocator, uint8_t, octetCount);
+            tc_memcpy_octets(slot->data, data, octetCount);
+        }
+        slot->octetCount = octetCount;
+        slot->heldAtMs = now;
+        slot->sequence = sequence;
+        self->heldCount++;
+
+        return true;
+    }
+
+    return false;
+}
+
+/// Notifies that a packet has passed.
+/// @param self reorder
+/// @return the held back packet that should be sent now, or NULL
+HazyReorderSlot* hazyReorderAdvance(HazyReorder* self)
+{
+    self->sequence++;
+    if (self->heldCount == 0) {
+        return 0;
+    }
+
+    HazyReorderSlot* slot = &self->slots[self->sequence & HAZY_REORDER_SLOT_MASK];
+
+    return slot->data != 0 ? slot : 0;
+}
+
+/// Finds a held back packet that has been held back for too long.
+/// @param self reorder
+/// @param now current time
+/// @return the held back packet that should be sent now, or NULL
+HazyReorderSlot* hazyReorderFindExpired(HazyReorder* self, MonotonicTimeMs now)
+{
+    if (self->heldCount == 0) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < HAZY_REORDER_SLOT_COUNT; ++i) {
+        HazyReorderSlot* slot = &self->slots[i];
+        if (slot->data != 0 && now >= slot->heldAtMs + (MonotonicTimeMs) self->config.maxHoldMs) {
+            return slot;
+        }
+    }
+
+    return 0;
+}
+
+/// Frees the slot after the held back packet has been sent.
+/// @param self reorder
+/// @param slot slot returned from hazyReorderAdvance() or hazyReorderFindExpired()
+void hazyReorderRelease(HazyReorder* self, HazyReorderSlot* slot)
+{
+    IMPRINT_FREE(self->allocatorWithFree, slot->data);
+    slot->data = 0;
+    slot->octetCount = 0;
+    self->heldCount--;
+}
+
+/// Frees the slot without freeing the held back packet, so it can be queued without a copy.
+/// @param self reorder
+/// @param slot slot returned from hazyReorderAdvance() or hazyReorderFindExpired()
+/// @return the payload, now owned by the caller
+uint8_t* hazyReorderTake(HazyReorder* self, HazyReorderSlot* slot)
+{
+    uint8_t* data = slot->data;
+    slot->data = 0;
+    slot->octetCount = 0;
+    self->heldCount--;
+
+    return data;
+}
+
+HazyReorderConfig hazyReorderGoodCondition(void)
+{
+    HazyReorderConfig config = {1, 1, 50};
+
+    return config;
+}
+
+HazyReorderConfig hazyReorderRecommended(void)
+{
+    HazyReorderConfig config = {1, 3, 100};
+
+    return config;
+}
+
+HazyReorderConfig hazyReorderWorstCase(void)
+{
+    HazyReorderConfig config = {1, 8, 200};
+
+    return config;
+}
@@ -0,0 +1,166 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include <hazy/sampler.h>
+#include <imprint/allocator.h>
+#include <inttypes.h>
+
+/// Initializes the sampler. All memory is allocated here, so sampling does not allocate.
+/// @param self sampler
+/// @param allocator allocator for the samples
+/// @param sampleCapacity number of samples kept in the ring
+/// @param intervalMs time between samples
+/// @return negative on error
+int hazySamplerInit(HazySampler* self, struct ImprintAllocator* allocator, size_t sampleCapacity,
+                    MonotonicTimeMs intervalMs)
+{
+    if (sampleCapacity == 0 || intervalMs <= 0) {
+        return -2;
+    }
+
+    self->samples = IMPRINT_ALLOC_TYPE_COUNT(allocator, HazySample, sampleCapacity);
+    self->capacity = sampleCapacity;
+    self->writeCount = 0;
+    self->readCount = 0;
+    self->lostSampleCount = 0;
+    self->intervalMs = intervalMs;
+    self->nextSampleMs = 0;
+    self->lastSampleMs = 0;
+    tc_memset_octets(&self->previousOut, 0, sizeof(self->previousOut));
+    tc_memset_octets(&self->previousIn, 0, sizeof(self->previousIn));
+    self->hasWrittenCsvHeader = false;
+
+    return 0;
+}
+
+static void sampleDirection(HazyDirectionSample* sample, const HazyDirection* direction,
+                            HazyDirectionStats* previousStats, MonotonicTimeMs now)
+{
+    const HazyDirectionStats* stats = &direction->stats;
+
+    HazyLatencyState latency = hazyLatencyAt(&direction->latency, now);
+
+    sample->latencyMs = latency.latency;
+    sample->targetLatencyMs = latency.targetLatency;
+    sample->latencyDiffPerSecond = latency.latencyDiffPerSecond;
+    sample->latencyPhase = (uint8_t) latency.phase;
+    sample->dropBurstPhase = (uint8_t) direction->phase;
+    sample->queuedPacketCount = (uint16_t) (direction->packets.packetCount + direction->reorder.heldCount);
+    sample->bottleneckQueuedOctetCount = (uint32_t) hazyBottleneckQueuedOctetCount(&direction->bottleneck,
+                                                                                   now * 1000);
+    sample->writtenPacketCount = (uint32_t) (stats->writtenPacketCount - previousStats->writtenPacketCount);
+    sample->deliveredPacketCount = (uint32_t) (stats->deliveredPacketCount - previousStats->deliveredPacketCount);
+    sample->deliveredOctetCount = (uint32_t) (stats->deliveredOctetCount - previousStats->deliveredOctetCount);
+    sample->droppedPacketCount = (uint32_t) (stats->droppedPacketCount - previousStats->droppedPacketCount);
+
+    *previousStats = *stats;
+}
+
+/// Takes a sample if the interval has passed. Called from hazyUpdate() when set with hazySetSampler().
+/// @param self sampler
+/// @param out outgoing direction
+/// @param in incoming direction
+/// @param now current time
+void hazySamplerUpdate(HazySampler* self, const HazyDirection* out, const HazyDirection* in, MonotonicTimeMs now)
+{
+    if (now < self->nextSampleMs) {
+        return;
+    }
+
+    // Keep a fixed cadence, unless the updates have been too far apart
+    self->nextSampleMs += self->intervalMs;
+    if (self->nextSampleMs <= now) {
+        self->nextSampleMs = now + self->intervalMs;
+    }
+
+    HazySample* sample = &self->samples[self->writeCount % self->capacity];
+    sample->timeMs = now;
+    // The counters are deltas since the previous sample, which can be more than an interval ago
+    sample->elapsedMs = self->writeCount == 0 ? self->intervalMs : now - self->lastSampleMs;
+    self->lastSampleMs = now;
+    sampleDirection(&sample->out, out, &self->previousOut, now);
+    sampleDirection(&sample->in, in, &self->previousIn, now);
+    self->writeCount++;
+}
+
+/// Skips the samples that have been overwritten since the last dump
+static void skipOverwritten(HazySampler* self)
+{
+    size_t unreadCount = self->writeCount - self->readCount;
+    if (unreadCount > self->capacity) {
+        self->lostSampleCount += unreadCount - self->capacity;
+        self->readCount = self->writeCount - self->capacity;
+    }
+}
+
+static void writeCsvDirectionHeader(FILE* fp, const char* prefix)
+{
+    fprintf(fp,
+            ",%slatencyMs,%stargetLatencyMs,%slatencyDiffPerSecond,%slatencyPhase,%sdropBurstPhase,%squeuedPackets,"
+            "%sbottleneckQueuedOctets,%swrittenPackets,%sdeliveredPackets,%sdeliveredOctetsPerSecond,%sdroppedPackets",
+            prefix, prefix, prefix, prefix, prefix, prefix, prefix, prefix, prefix, prefix, prefix);
+}
+
+static void writeCsvDirection(FILE* fp, const HazyDirectionSample* sample, MonotonicTimeMs elapsedMs)
+{
+    uint64_t octetsPerSecond = elapsedMs > 0 ? (uint64_t) sample->deliveredOctetCount * 1000u / (uint64_t) elapsedMs
+                                             : 0;
+
+    fprintf(fp, ",%u,%u,%.2f,%u,%u,%u,%u,%u,%u,%" PRIu64 ",%u", sample->latencyMs, sample->targetLatencyMs,
+            (double) sample->latencyDiffPerSecond, sample->latencyPhase, sample->dropBurstPhase,
+            sample->queuedPacketCount, sample->bottleneckQueuedOctetCount, sample->writtenPacketCount,
+            sample->deliveredPacketCount, octetsPerSecond, sample->droppedPacketCount);
+}
+
+/// Writes the samples taken since the last dump as CSV. The header is written on the first dump.
+/// @param self sampler
+/// @param fp file
+/// @return number of written samples
+size_t hazySamplerDumpCsv(HazySampler* self, FILE* fp)
+{
+    if (!self->hasWrittenCsvHeader) {
+        fprintf(fp, "timeMs");
+        writeCsvDirectionHeader(fp, "out.");
+        writeCsvDirectionHeader(fp, "in.");
+        fprintf(fp, "\n");
+        self->hasWrittenCsvHeader = true;
+    }
+
+    skipOverwritten(self);
+
+    size_t writtenCount = 0;
+    for (; self->readCount != self->writeCount; self->readCount++) {
+        const HazySample* sample = &self->samples[self->readCount % self->capacity];
+        fprintf(fp, "%" PRId64, sample->timeMs);
+        writeCsvDirection(fp, &sample->out, sample->elapsedMs);
+        writeCsvDirection(fp, &sample->in, sample->elapsedMs);
+        fprintf(fp, "\n");
+        writtenCount++;
+    }
+
+    return writtenCount;
+}
+
+/// Writes the samples taken since the last dump as an array of HazySample
+/// @param self sampler
+/// @param fp file opened in binary mode
+/// @return number of written samples
+size_t hazySamplerDumpBinary(HazySampler* self, FILE* fp)
+{
+    skipOverwritten(self);
+
+    size_t writtenCount = 0;
+    while (self->readCount != self->writeCount) {
+        size_t start = self->readCount % self->capacity;
+        size_t count = self->writeCount - self->readCount;
+        if (count > self->capacity - start) {
+            count = self->capacity - start;
+        }
+        fwrite(&self->samples[start], sizeof(HazySample), count, fp);
+        self->readCount += count;
+        writtenCount += count;
+    }
+
+    return writtenCount;
+}
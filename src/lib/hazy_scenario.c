@@ -0,0 +1,460 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include <clog/clog.h>
+#include <hazy/scenario.h>
+#include <imprint/allocator.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct HazyScenarioField {
+    const char* name;
+    size_t offset;
+} HazyScenarioField;
+
+static const HazyScenarioField g_hazyScenarioFields[] = {
+    {"decider.original", offsetof(HazyDirectionConfig, decider.originalChance)},
+    {"decider.drop", offsetof(HazyDirectionConfig, decider.dropChance)},
+    {"decider.outOfOrder", offsetof(HazyDirectionConfig, decider.outOfOrderChance)},
+    {"decider.duplicate", offsetof(HazyDirectionConfig, decider.duplicateChance)},
+    {"decider.tamper", offsetof(HazyDirectionConfig, decider.tamperChance)},
+    {"latency.min", offsetof(HazyDirectionConfig, latency.minLatency)},
+    {"latency.max", offsetof(HazyDirectionConfig, latency.maxLatency)},
+    {"latency.jitter", offsetof(HazyDirectionConfig, latency.latencyJitter)},
+    {"latency.jitterSpike", offsetof(HazyDirectionConfig, latency.chanseJitterSpike)},
+    {"burst.between", offsetof(HazyDirectionConfig, direction.timeBetweenDropBurstSpanMs)},
+    {"burst.betweenMinimum", offsetof(HazyDirectionConfig, direction.timeBetweenDropBurstMinimumMs)},
+    {"burst.duration", offsetof(HazyDirectionConfig, direction.dropBurstTimeSpanMs)},
+    {"burst.durationMinimum", offsetof(HazyDirectionConfig, direction.dropBurstTimeMinimumMs)},
+    {"reorder.minDepth", offsetof(HazyDirectionConfig, reorder.minDepth)},
+    {"reorder.maxDepth", offsetof(HazyDirectionConfig, reorder.maxDepth)},
+    {"reorder.maxHold", offsetof(HazyDirectionConfig, reorder.maxHoldMs)},
+    {"bottleneck.octetsPerSecond", offsetof(HazyDirectionConfig, bottleneck.octetsPerSecond)},
+    {"bottleneck.queueOctetCapacity", offsetof(HazyDirectionConfig, bottleneck.queueOctetCapacity)},
+    {"bottleneck.redMinThreshold", offsetof(HazyDirectionConfig, bottleneck.redMinThresholdOctets)},
+    {"bottleneck.redMaxThreshold", offsetof(HazyDirectionConfig, bottleneck.redMaxThresholdOctets)},
+    {"bottleneck.redMaxDropPerMille", offsetof(HazyDirectionConfig, bottleneck.redMaxDropPerMille)},
+    {"bottleneck.codelTarget", offsetof(HazyDirectionConfig, bottleneck.codelTargetMs)},
+    {"bottleneck.codelInterval", offsetof(HazyDirectionConfig, bottleneck.codelIntervalMs)},
+    {"wire.octetsPerSecond", offsetof(HazyDirectionConfig, wire.octetsPerSecond)},
+    {"wire.overhead", offsetof(HazyDirectionConfig, wire.overheadOctetCount)},
+};
+
+#define HAZY_SCENARIO_FIELD_COUNT (sizeof(g_hazyScenarioFields) / sizeof(g_hazyScenarioFields[0]))
+#define HAZY_SCENARIO_MAX_LINE_LENGTH (512)
+
+typedef struct HazyScenarioParser {
+    HazyScenario* scenario;
+    HazyDirectionConfig in;
+    HazyDirectionConfig out;
+    size_t lineNumber;
+    size_t keyframeCount;
+} HazyScenarioParser;
+
+static size_t getField(const HazyDirectionConfig* config, size_t offset)
+{
+    size_t value;
+    tc_memcpy_octets(&value, (const uint8_t*) config + offset, sizeof(value));
+    return value;
+}
+
+static void setField(HazyDirectionConfig* config, size_t offset, size_t value)
+{
+    tc_memcpy_octets((uint8_t*) config + offset, &value, sizeof(value));
+}
+
+static bool tokenEquals(const char* token, size_t tokenLength, const char* name)
+{
+    return strlen(name) == tokenLength && strncmp(token, name, tokenLength) == 0;
+}
+
+static size_t nextToken(const char* line, size_t length, size_t* pos, const char** token)
+{
+    while (*pos < length && (line[*pos] == ' ' || line[*pos] == '\t' || line[*pos] == '\r')) {
+        (*pos)++;
+    }
+
+    *token = &line[*pos];
+    size_t start = *pos;
+    while (*pos < length && line[*pos] != ' ' && line[*pos] != '\t' && line[*pos] != '\r') {
+        (*pos)++;
+    }
+
+    return *pos - start;
+}
+
+static size_t parseUnsigned(const char* token, size_t tokenLength, size_t* value)
+{
+    size_t index = 0;
+    *value = 0;
+    while (index < tokenLength && token[index] >= '0' && token[index] <= '9') {
+        *value = *value * 10 + (size_t) (token[index] - '0');
+        index++;
+    }
+
+    return index;
+}
+
+static int parseTime(const char* token, size_t tokenLength, MonotonicTimeMs* timeMs)
+{
+    size_t value;
+    size_t digitCount = parseUnsigned(token, tokenLength, &value);
+    if (digitCount == 0) {
+        return -1;
+    }
+
+    const char* suffix = token + digitCount;
+    size_t suffixLength = tokenLength - digitCount;
+    if (suffixLength == 0 || tokenEquals(suffix, suffixLength, "ms")) {
+        *timeMs = (MonotonicTimeMs) value;
+    } else if (tokenEquals(suffix, suffixLength, "s")) {
+        *timeMs = (MonotonicTimeMs) value * 1000;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int parsePreset(const char* value, size_t valueLength, HazyDirectionConfig* config)
+{
+    if (tokenEquals(value, valueLength, "good")) {
+        *config = hazyDirectionConfigGoodCondition();
+    } else if (tokenEquals(value, valueLength, "recommended")) {
+        *config = hazyDirectionConfigRecommended();
+    } else if (tokenEquals(value, valueLength, "worst")) {
+        *config = hazyDirectionConfigWorstCase();
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int parseBottleneckPolicy(const char* value, size_t valueLength, HazyBottleneckPolicy* policy)
+{
+    if (tokenEquals(value, valueLength, "taildrop")) {
+        *policy = HazyBottleneckPolicyTailDrop;
+    } else if (tokenEquals(value, valueLength, "red")) {
+        *policy = HazyBottleneckPolicyRed;
+    } else if (tokenEquals(value, valueLength, "codel")) {
+        *policy = HazyBottleneckPolicyCoDel;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int parseAssignment(HazyScenarioParser* self, const char* token, size_t tokenLength)
+{
+    const char* equals = memchr(token, '=', tokenLength);
+    if (equals == 0) {
+        return -1;
+    }
+
+    const char* key = token;
+    size_t keyLength = (size_t) (equals - token);
+    const char* value = equals + 1;
+    size_t valueLength = tokenLength - keyLength - 1;
+
+    bool affectsIn = true;
+    bool affectsOut = true;
+    if (keyLength > 3 && strncmp(key, "in.", 3) == 0) {
+        affectsOut = false;
+        key += 3;
+        keyLength -= 3;
+    } else if (keyLength > 4 && strncmp(key, "out.", 4) == 0) {
+        affectsIn = false;
+        key += 4;
+        keyLength -= 4;
+    }
+
+    if (tokenEquals(key, keyLength, "preset")) {
+        if (affectsIn && parsePreset(value, valueLength, &self->in) < 0) {
+            return -1;
+        }
+        if (affectsOut && parsePreset(value, valueLength, &self->out) < 0) {
+            return -1;
+        }
+        return 0;
+    }
+
+    if (tokenEquals(key, keyLength, "bottleneck.policy")) {
+        HazyBottleneckPolicy policy;
+        if (parseBottleneckPolicy(value, valueLength, &policy) < 0) {
+            return -1;
+        }
+        if (affectsIn) {
+            self->in.bottleneck.policy = policy;
+        }
+        if (affectsOut) {
+            self->out.bottleneck.policy = policy;
+        }
+        return 0;
+    }
+
+    size_t number;
+    if (valueLength == 0 || parseUnsigned(value, valueLength, &number) != valueLength) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < HAZY_SCENARIO_FIELD_COUNT; ++i) {
+        const HazyScenarioField* field = &g_hazyScenarioFields[i];
+        if (tokenEquals(key, keyLength, field->name)) {
+            if (affectsIn) {
+                setField(&self->in, field->offset, number);
+            }
+            if (affectsOut) {
+                setField(&self->out, field->offset, number);
+            }
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static bool isKeyframeLine(const char* line, size_t length)
+{
+    size_t pos = 0;
+    const char* token;
+    size_t tokenLength = nextToken(line, length, &pos, &token);
+
+    return tokenLength > 0 && token[0] != '#';
+}
+
+/// Parses a line in the form `<time>[ms|s] <step|linear> key=value ...`
+/// Each keyframe starts out from the config of the previous keyframe.
+static int parseKeyframeLine(HazyScenarioParser* self, const char* line, size_t length)
+{
+    if (!isKeyframeLine(line, length)) {
+        return 0;
+    }
+
+    HazyScenario* scenario = self->scenario;
+    HazyScenarioKeyframe* keyframe = &scenario->keyframes[self->keyframeCount];
+
+    size_t pos = 0;
+    const char* token;
+    size_t tokenLength = nextToken(line, length, &pos, &token);
+    if (parseTime(token, tokenLength, &keyframe->timeMs) < 0) {
+        CLOG_C_WARN(&scenario->log, "line %zu: illegal time '%.*s'", self->lineNumber, (int) tokenLength, token)
+        return -1;
+    }
+
+    if (self->keyframeCount > 0 && keyframe->timeMs < scenario->keyframes[self->keyframeCount - 1].timeMs) {
+        CLOG_C_WARN(&scenario->log, "line %zu: keyframes must be in time order", self->lineNumber)
+        return -1;
+    }
+
+    tokenLength = nextToken(line, length, &pos, &token);
+    if (tokenEquals(token, tokenLength, "step")) {
+        keyframe->transition = HazyScenarioTransitionStep;
+    } else if (tokenEquals(token, tokenLength, "linear")) {
+        keyframe->transition = HazyScenarioTransitionLinear;
+    } else {
+        CLOG_C_WARN(&scenario->log, "line %zu: expected 'step' or 'linear'", self->lineNumber)
+        return -1;
+    }
+
+    while (1) {
+        tokenLength = nextToken(line, length, &pos, &token);
+        if (tokenLength == 0 || token[0] == '#') {
+            break;
+        }
+        if (parseAssignment(self, token, tokenLength) < 0) {
+            CLOG_C_WARN(&scenario->log, "line %zu: illegal assignment '%.*s'", self->lineNumber, (int) tokenLength,
+                        token)
+            return -1;
+        }
+    }
+
+    keyframe->in = self->in;
+    keyframe->out = self->out;
+    self->keyframeCount++;
+
+    return 0;
+}
+
+static void parserInit(HazyScenarioParser* self, HazyScenario* scenario)
+{
+    self->scenario = scenario;
+    self->in = hazyDirectionConfigGoodCondition();
+    self->out = hazyDirectionConfigGoodCondition();
+    self->lineNumber = 0;
+    self->keyframeCount = 0;
+}
+
+static void scenarioAllocate(HazyScenario* self, ImprintAllocator* allocator, size_t keyframeCount, Clog log)
+{
+    self->log = log;
+    self->keyframeCount = keyframeCount;
+    self->keyframes = keyframeCount > 0 ? IMPRINT_ALLOC_TYPE_COUNT(allocator, HazyScenarioKeyframe, keyframeCount) : 0;
+}
+
+/// Parses a scenario. Each line is a keyframe in the form `<time>[ms|s] <step|linear> key=value ...`,
+/// e.g. `30s linear in.latency.min=60 in.latency.max=90 decider.drop=100`.
+/// Keys without an `in.` or `out.` prefix affect both directions.
+/// @param self scenario
+/// @param allocator allocator for the keyframes
+/// @param text scenario text
+/// @param log log
+/// @return negative on error
+int hazyScenarioInitFromString(HazyScenario* self, struct ImprintAllocator* allocator, const char* text, Clog log)
+{
+    size_t keyframeCount = 0;
+    for (const char* line = text; *line != 0;) {
+        const char* end = strchr(line, '\n');
+        size_t length = end ? (size_t) (end - line) : strlen(line);
+        if (isKeyframeLine(line, length)) {
+            keyframeCount++;
+        }
+        line += end ? length + 1 : length;
+    }
+
+    scenarioAllocate(self, allocator, keyframeCount, log);
+
+    HazyScenarioParser parser;
+    parserInit(&parser, self);
+
+    for (const char* line = text; *line != 0;) {
+        const char* end = strchr(line, '\n');
+        size_t length = end ? (size_t) (end - line) : strlen(line);
+        parser.lineNumber++;
+        if (parseKeyframeLine(&parser, line, length) < 0) {
+            self->keyframeCount = 0;
+            return -1;
+        }
+        line += end ? length + 1 : length;
+    }
+
+    return 0;
+}
+
+/// Loads and parses a scenario file. See hazyScenarioInitFromString() for the format.
+/// @param self scenario
+/// @param allocator allocator for the keyframes
+/// @param filename scenario filename
+/// @param log log
+/// @return negative on error
+int hazyScenarioInitFromFile(HazyScenario* self, struct ImprintAllocator* allocator, const char* filename, Clog log)
+{
+    FILE* fp = fopen(filename, "r");
+    if (fp == 0) {
+        CLOG_C_WARN(&log, "could not open scenario '%s'", filename)
+        return -2;
+    }
+
+    char line[HAZY_SCENARIO_MAX_LINE_LENGTH];
+    size_t keyframeCount = 0;
+    while (fgets(line, sizeof(line), fp) != 0) {
+        if (isKeyframeLine(line, strcspn(line, "\n"))) {
+            keyframeCount++;
+        }
+    }
+
+    scenarioAllocate(self, allocator, keyframeCount, log);
+
+    HazyScenarioParser parser;
+    parserInit(&parser, self);
+
+    rewind(fp);
+    int result = 0;
+    while (fgets(line, sizeof(line), fp) != 0) {
+        parser.lineNumber++;
+        size_t length = strcspn(line, "\n");
+        if (line[length] != '\n' && !feof(fp)) {
+            CLOG_C_WARN(&log, "line %zu: line is too long", parser.lineNumber)
+            result = -1;
+            break;
+        }
+        if (parseKeyframeLine(&parser, line, length) < 0) {
+            result = -1;
+            break;
+        }
+    }
+
+    fclose(fp);
+
+    if (result < 0) {
+        self->keyframeCount = 0;
+    }
+
+    return result;
+}
+
+static void lerpConfig(const HazyDirectionConfig* from, const HazyDirectionConfig* to, double fraction,
+                       HazyDirectionConfig* result)
+{
+    *result = *from;
+    for (size_t i = 0; i < HAZY_SCENARIO_FIELD_COUNT; ++i) {
+        size_t offset = g_hazyScenarioFields[i].offset;
+        double a = (double) getField(from, offset);
+        double b = (double) getField(to, offset);
+        setField(result, offset, (size_t) (a + (b - a) * fraction + 0.5));
+    }
+}
+
+void hazyScenarioPlayerInit(HazyScenarioPlayer* self, const HazyScenario* scenario)
+{
+    self->scenario = scenario;
+    self->startTimeMs = 0;
+    self->nextKeyframeIndex = 0;
+    self->hasStarted = false;
+}
+
+/// Advances the scenario to `now`. The scenario starts at the first update.
+/// @param self player
+/// @param now current time
+/// @param in the config to use for the in direction
+/// @param out the config to use for the out direction
+/// @return true if the config has changed and should be applied
+bool hazyScenarioPlayerUpdate(HazyScenarioPlayer* self, MonotonicTimeMs now, HazyDirectionConfig* in,
+                              HazyDirectionConfig* out)
+{
+    const HazyScenario* scenario = self->scenario;
+    if (scenario == 0) {
+        return false;
+    }
+
+    if (!self->hasStarted) {
+        self->startTimeMs = now;
+        self->hasStarted = true;
+    }
+
+    MonotonicTimeMs timeSinceStart = now - self->startTimeMs;
+
+    bool reachedKeyframe = false;
+    while (self->nextKeyframeIndex < scenario->keyframeCount &&
+           scenario->keyframes[self->nextKeyframeIndex].timeMs <= timeSinceStart) {
+        self->nextKeyframeIndex++;
+        reachedKeyframe = true;
+    }
+
+    if (self->nextKeyframeIndex == 0) {
+        return false;
+    }
+
+    const HazyScenarioKeyframe* previous = &scenario->keyframes[self->nextKeyframeIndex - 1];
+
+    if (self->nextKeyframeIndex < scenario->keyframeCount) {
+        const HazyScenarioKeyframe* next = &scenario->keyframes[self->nextKeyframeIndex];
+        if (next->transition == HazyScenarioTransitionLinear) {
+            double fraction = (double) (timeSinceStart - previous->timeMs) / (double) (next->timeMs - previous->timeMs);
+            lerpConfig(&previous->in, &next->in, fraction, in);
+            lerpConfig(&previous->out, &next->out, fraction, out);
+            return true;
+        }
+    }
+
+    if (!reachedKeyframe) {
+        return false;
+    }
+
+    *in = previous->in;
+    *out = previous->out;
+
+    return true;
+}
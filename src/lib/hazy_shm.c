@@ -0,0 +1,363 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#if defined TORNADO_OS_WINDOWS || defined __EMSCRIPTEN__
+#define HAZY_SHM_SUPPORTED (0)
+#else
+#define HAZY_SHM_SUPPORTED (1)
+#if !defined _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L // shm_open(), ftruncate() and mmap() in C99
+#endif
+#endif
+
+#include "hazy_atomic.h"
+#include <hazy/shm.h>
+
+#if HAZY_SHM_SUPPORTED
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define HAZY_SHM_MAGIC (0x485a5348)
+#define HAZY_SHM_VERSION (1)
+#define HAZY_SHM_CACHE_LINE_OCTET_COUNT (64)
+#define HAZY_SHM_MAX_SLOT_OCTET_COUNT (65507) // largest UDP payload
+
+/// Placed first in the segment. The creator writes readyMagic last, so the segment can be opened
+/// as soon as it is set.
+typedef struct HazyShmHeader {
+    int readyMagic;
+    uint32_t version;
+    uint64_t slotCount;
+    uint64_t slotOctetCount;
+} HazyShmHeader;
+
+/// The indices are on separate cache lines, since they are written by different processes
+struct HazyShmRing {
+    size_t writeIndex;
+    uint8_t writePadding[HAZY_SHM_CACHE_LINE_OCTET_COUNT - sizeof(size_t)];
+    size_t readIndex;
+    uint8_t readPadding[HAZY_SHM_CACHE_LINE_OCTET_COUNT - sizeof(size_t)];
+    uint8_t slots[]; // each slot is an uint32_t octet count followed by the datagram
+};
+
+static size_t hazyShmSlotStride(size_t slotOctetCount)
+{
+    return (sizeof(uint32_t) + slotOctetCount + 7u) & ~(size_t) 7u;
+}
+
+#if HAZY_SHM_SUPPORTED
+static size_t hazyShmRingOctetCount(size_t slotCount, size_t slotOctetCount)
+{
+    size_t octetCount = sizeof(struct HazyShmRing) + slotCount * hazyShmSlotStride(slotOctetCount);
+
+    return (octetCount + HAZY_SHM_CACHE_LINE_OCTET_COUNT - 1) & ~(size_t) (HAZY_SHM_CACHE_LINE_OCTET_COUNT - 1);
+}
+
+static size_t hazyShmSegmentOctetCount(size_t slotCount, size_t slotOctetCount)
+{
+    return HAZY_SHM_CACHE_LINE_OCTET_COUNT + 2 * hazyShmRingOctetCount(slotCount, slotOctetCount);
+}
+
+static struct HazyShmRing* hazyShmRingAt(const HazyShm* self, size_t ringIndex)
+{
+    uint8_t* base = (uint8_t*) self->memory + HAZY_SHM_CACHE_LINE_OCTET_COUNT;
+
+    return (struct HazyShmRing*) (void*) (base + ringIndex * hazyShmRingOctetCount(self->slotCount,
+                                                                                   self->slotOctetCount));
+}
+#endif
+
+static uint8_t* hazyShmSlot(const HazyShm* self, struct HazyShmRing* ring, size_t index)
+{
+    return ring->slots + (index & (self->slotCount - 1)) * hazyShmSlotStride(self->slotOctetCount);
+}
+
+static bool hazyShmPush(HazyShm* self, const uint8_t* data, size_t octetCount)
+{
+    struct HazyShmRing* ring = self->sendRing;
+    size_t writeIndex = ring->writeIndex;
+    if (writeIndex - hazyAtomicLoadSize(&ring->readIndex) >= self->slotCount) {
+        return false;
+    }
+
+    uint8_t* slot = hazyShmSlot(self, ring, writeIndex);
+    uint32_t slotOctetCount = (uint32_t) octetCount;
+    tc_memcpy_octets(slot, &slotOctetCount, sizeof(slotOctetCount));
+    tc_memcpy_octets(slot + sizeof(slotOctetCount), data, octetCount);
+    hazyAtomicStoreSize(&ring->writeIndex, writeIndex + 1);
+
+    return true;
+}
+
+/// Moves the packets that are due from the send direction into the ring. Like a full socket receive
+/// buffer, a full ring drops the packet.
+static void hazyShmFlush(HazyShm* self, MonotonicTimeMs now)
+{
+    HazyDirection* direction = &self->sendDirection;
+    HazyPacket packet;
+    while (hazyPacketsFindPacketToActOn(&direction->packets, now, &packet)) {
+        if (hazyShmPush(self, packet.data, packet.octetCount)) {
+            hazyDirectionPacketDelivered(direction, &packet, now);
+        } else {
+            self->ringFullDropCount++;
+            hazyDirectionPacketDropped(direction, &packet, HazyTraceDropCauseReceiveBuffer, now);
+        }
+        hazyPacketsDestroyPacket(&direction->packets, &packet);
+    }
+}
+
+static int hazyShmSendFn(void* self_, const uint8_t* data, size_t size)
+{
+    HazyShm* self = self_;
+
+    if (self->sendRing == 0) {
+        return -1;
+    }
+
+    if (size > self->slotOctetCount) {
+        CLOG_C_WARN(&self->log, "datagram of %zu octets does not fit in a slot of %zu", size, self->slotOctetCount)
+        return -2;
+    }
+
+    if (hazyDirectionIsIdlePassthrough(&self->sendDirection)) {
+        if (!hazyShmPush(self, data, size)) {
+            self->ringFullDropCount++;
+            hazyDirectionWriteDropped(&self->sendDirection, data, size, HazyTraceDropCauseReceiveBuffer,
+                                      monotonicTimeMsNow());
+        }
+        return 0;
+    }
+
+    MonotonicTimeMs now = monotonicTimeMsNow();
+    int result = hazyWriteDirectionAt(&self->sendDirection, data, size, now);
+    if (result < 0) {
+        return result;
+    }
+    hazyShmFlush(self, now);
+
+    return 0;
+}
+
+static ssize_t hazyShmReceiveFn(void* self_, uint8_t* data, size_t size)
+{
+    HazyShm* self = self_;
+    struct HazyShmRing* ring = self->receiveRing;
+    if (ring == 0) {
+        return -1;
+    }
+
+    size_t readIndex = ring->readIndex;
+    if (readIndex == hazyAtomicLoadSize(&ring->writeIndex)) {
+        return 0;
+    }
+
+    const uint8_t* slot = hazyShmSlot(self, ring, readIndex);
+    uint32_t octetCount;
+    tc_memcpy_octets(&octetCount, slot, sizeof(octetCount));
+
+    // The length is written by the other process, so it must not be trusted to fit in the slot
+    ssize_t returnValue = (ssize_t) octetCount;
+    if (octetCount > self->slotOctetCount) {
+        CLOG_C_WARN(&self->log, "corrupt slot, %u octets does not fit in a slot of %zu", octetCount,
+                    self->slotOctetCount)
+        returnValue = -5;
+    } else if (octetCount <= size) {
+        tc_memcpy_octets(data, slot + sizeof(octetCount), octetCount);
+    } else {
+        CLOG_C_WARN(&self->log, "couldn't copy to target, capacity too small")
+        returnValue = -4;
+    }
+    hazyAtomicStoreSize(&ring->readIndex, readIndex + 1);
+
+    return returnValue;
+}
+
+static void hazyShmInit(HazyShm* self, const char* name, struct ImprintAllocatorWithFree* allocatorWithFree,
+                        HazyDirectionConfig config, Clog log)
+{
+    tc_snprintf(self->debugPrefix, 32, "%s/shm", log.constantPrefix);
+    self->log.config = log.config;
+    self->log.constantPrefix = self->debugPrefix;
+
+    tc_snprintf(self->name, 64, "%s", name);
+    self->transport.self = self;
+    self->transport.send = hazyShmSendFn;
+    self->transport.receive = hazyShmReceiveFn;
+    self->memory = 0;
+    self->memoryOctetCount = 0;
+    self->slotCount = 0;
+    self->slotOctetCount = 0;
+    self->ringFullDropCount = 0;
+    self->fd = -1;
+    self->isOwner = false;
+    self->sendRing = 0;
+    self->receiveRing = 0;
+
+    hazyDirectionInit(&self->sendDirection, 0, allocatorWithFree, config, self->log);
+}
+
+/// Creates the shared memory segment, and is the server end of it. Any previous segment with the
+/// same name is replaced. The segment is removed by hazyShmClose().
+/// @param self shm
+/// @param name POSIX shared memory name, starting with a slash, e.g. "/hazy-game"
+/// @param slotCount number of datagrams that fit in each ring, must be a power of two
+/// @param slotOctetCount the largest datagram
+/// @param allocatorWithFree allocator for the packets in the send direction
+/// @param config impairment for the datagrams sent from this end
+/// @param log log
+/// @return negative on error
+int hazyShmCreate(HazyShm* self, const char* name, size_t slotCount, size_t slotOctetCount,
+                  struct ImprintAllocatorWithFree* allocatorWithFree, HazyDirectionConfig config, Clog log)
+{
+    hazyShmInit(self, name, allocatorWithFree, config, log);
+
+    if (slotCount == 0 || (slotCount & (slotCount - 1)) != 0 || slotOctetCount == 0 ||
+        slotOctetCount > HAZY_SHM_MAX_SLOT_OCTET_COUNT || tc_strlen(name) >= sizeof(self->name)) {
+        return -2;
+    }
+
+#if HAZY_SHM_SUPPORTED
+    size_t segmentOctetCount = hazyShmSegmentOctetCount(slotCount, slotOctetCount);
+
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        CLOG_C_WARN(&self->log, "could not create shared memory '%s': %d", name, errno)
+        return -1;
+    }
+
+    if (ftruncate(fd, (off_t) segmentOctetCount) != 0) {
+        CLOG_C_WARN(&self->log, "could not resize shared memory '%s' to %zu octets: %d", name, segmentOctetCount,
+                    errno)
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+
+    void* memory = mmap(0, segmentOctetCount, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) {
+        CLOG_C_WARN(&self->log, "could not map shared memory '%s': %d", name, errno)
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+
+    self->fd = fd;
+    self->isOwner = true;
+    self->memory = memory;
+    self->memoryOctetCount = segmentOctetCount;
+    self->slotCount = slotCount;
+    self->slotOctetCount = slotOctetCount;
+    self->receiveRing = hazyShmRingAt(self, 0);
+    self->sendRing = hazyShmRingAt(self, 1);
+
+    // A new segment is filled with zeros, so the rings are already empty
+    HazyShmHeader* header = memory;
+    header->version = HAZY_SHM_VERSION;
+    header->slotCount = slotCount;
+    header->slotOctetCount = slotOctetCount;
+    hazyAtomicStoreInt(&header->readyMagic, HAZY_SHM_MAGIC);
+
+    return 0;
+#else
+    CLOG_C_WARN(&self->log, "shared memory transport is not supported on this platform")
+    return -1;
+#endif
+}
+
+/// Opens a segment made by hazyShmCreate() in another process, and is the client end of it
+/// @param self shm
+/// @param name the name given to hazyShmCreate()
+/// @param allocatorWithFree allocator for the packets in the send direction
+/// @param config impairment for the datagrams sent from this end
+/// @param log log
+/// @return negative on error, -3 if the segment is not created yet or is incompatible
+int hazyShmOpen(HazyShm* self, const char* name, struct ImprintAllocatorWithFree* allocatorWithFree,
+                HazyDirectionConfig config, Clog log)
+{
+    hazyShmInit(self, name, allocatorWithFree, config, log);
+
+#if HAZY_SHM_SUPPORTED
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        return -3;
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size < HAZY_SHM_CACHE_LINE_OCTET_COUNT) {
+        close(fd);
+        return -3;
+    }
+
+    size_t segmentOctetCount = (size_t) status.st_size;
+    void* memory = mmap(0, segmentOctetCount, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) {
+        CLOG_C_WARN(&self->log, "could not map shared memory '%s': %d", name, errno)
+        close(fd);
+        return -1;
+    }
+
+    HazyShmHeader* header = memory;
+    if (hazyAtomicLoadInt(&header->readyMagic) != HAZY_SHM_MAGIC || header->version != HAZY_SHM_VERSION ||
+        hazyShmSegmentOctetCount((size_t) header->slotCount, (size_t) header->slotOctetCount) != segmentOctetCount) {
+        munmap(memory, segmentOctetCount);
+        close(fd);
+        return -3;
+    }
+
+    self->fd = fd;
+    self->memory = memory;
+    self->memoryOctetCount = segmentOctetCount;
+    self->slotCount = (size_t) header->slotCount;
+    self->slotOctetCount = (size_t) header->slotOctetCount;
+    self->sendRing = hazyShmRingAt(self, 0);
+    self->receiveRing = hazyShmRingAt(self, 1);
+
+    return 0;
+#else
+    CLOG_C_WARN(&self->log, "shared memory transport is not supported on this platform")
+    return -1;
+#endif
+}
+
+/// Updates the drop bursts and the held back packets of the send direction, and pushes the
+/// datagrams that are due into the ring. Must be called regularly when the impairment delays datagrams.
+/// @param self shm
+/// @param now current time
+void hazyShmUpdate(HazyShm* self, MonotonicTimeMs now)
+{
+    if (self->memory == 0) {
+        return;
+    }
+
+    hazyDirectionUpdate(&self->sendDirection, now);
+    hazyShmFlush(self, now);
+}
+
+/// Discards the datagrams in the send direction and unmaps the segment. The end that created the
+/// segment also removes it.
+/// @param self shm
+void hazyShmClose(HazyShm* self)
+{
+    hazyDirectionReset(&self->sendDirection);
+
+#if HAZY_SHM_SUPPORTED
+    if (self->memory != 0) {
+        munmap(self->memory, self->memoryOctetCount);
+        close(self->fd);
+        if (self->isOwner) {
+            shm_unlink(self->name);
+        }
+    }
+#endif
+
+    self->memory = 0;
+    self->fd = -1;
+    self->sendRing = 0;
+    self->receiveRing = 0;
+}
@@ -0,0 +1,85 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include "hazy_atomic.h"
+#include <hazy/trace.h>
+#include <imprint/allocator.h>
+
+/// Initializes the trace ring
+/// @param self trace
+/// @param allocator allocator for the events
+/// @param eventCapacity number of events, must be a power of two
+/// @return negative on error
+int hazyTraceInit(HazyTrace* self, struct ImprintAllocator* allocator, size_t eventCapacity)
+{
+    if (eventCapacity == 0 || (eventCapacity & (eventCapacity - 1)) != 0) {
+        return -2;
+    }
+
+    self->events = IMPRINT_ALLOC_TYPE_COUNT(allocator, HazyTraceEvent, eventCapacity);
+    self->capacityMask = eventCapacity - 1;
+    self->writeIndex = 0;
+    self->readIndex = 0;
+    self->lostEventCount = 0;
+
+    return 0;
+}
+
+/// Adds an event. Must only be called from the producer thread.
+/// @param self trace
+/// @param event event to copy into the ring
+void hazyTraceAdd(HazyTrace* self, const HazyTraceEvent* event)
+{
+    size_t writeIndex = self->writeIndex;
+    size_t readIndex = hazyAtomicLoadSize(&self->readIndex);
+    if (writeIndex - readIndex > self->capacityMask) {
+        self->lostEventCount++;
+        return;
+    }
+
+    self->events[writeIndex & self->capacityMask] = *event;
+    hazyAtomicStoreSize(&self->writeIndex, writeIndex + 1);
+}
+
+/// Hands all available events to the callback, in at most two contiguous spans.
+/// Must only be called from the consumer thread.
+/// @param self trace
+/// @param fn called with the events
+/// @param userData passed to fn
+/// @return number of drained events
+size_t hazyTraceDrain(HazyTrace* self, HazyTraceDrainFn fn, void* userData)
+{
+    size_t readIndex = self->readIndex;
+    size_t writeIndex = hazyAtomicLoadSize(&self->writeIndex);
+    size_t drainedCount = writeIndex - readIndex;
+
+    while (readIndex != writeIndex) {
+        size_t start = readIndex & self->capacityMask;
+        size_t count = writeIndex - readIndex;
+        size_t countUntilWrap = self->capacityMask + 1 - start;
+        if (count > countUntilWrap) {
+            count = countUntilWrap;
+        }
+        fn(userData, &self->events[start], count);
+        readIndex += count;
+    }
+
+    hazyAtomicStoreSize(&self->readIndex, readIndex);
+
+    return drainedCount;
+}
+
+static void writeEventsToFile(void* userData, const HazyTraceEvent* events, size_t eventCount)
+{
+    fwrite(events, sizeof(HazyTraceEvent), eventCount, (FILE*) userData);
+}
+
+/// Writes the available events to a file, as an array of HazyTraceEvent
+/// @param self trace
+/// @param fp file opened in binary mode
+/// @return number of written events
+size_t hazyTraceDrainToFile(HazyTrace* self, FILE* fp)
+{
+    return hazyTraceDrain(self, writeEventsToFile, fp);
+}
@@ -8,6 +8,10 @@ static int hazyDatagramTransportSendFn(void* self_, const uint8_t* data, size_t
 {
     HazyDatagramTransportInOut* self = self_;
 
+    if (hazyDirectionIsIdlePassthrough(&self->hazy.out)) {
+        return datagramTransportSend(&self->other, data, size);
+    }
+
     return hazyWrite(&self->hazy, data, size);
 }
 
@@ -18,6 +22,11 @@ static ssize_t hazyDatagramTransportReceiveFn(void* self_, uint8_t* data, size_t
     if (self->debugDiscardIncoming) {
         return 0;
     }
+
+    if (discoidBufferReadAvailable(&self->hazy.receiveBuffer) == 0 && hazyDirectionIsIdlePassthrough(&self->hazy.in)) {
+        return datagramTransportReceive(&self->other, data, size);
+    }
+
     return hazyRead(&self->hazy, data, size);
 }
 
@@ -37,6 +46,12 @@ void hazyDatagramTransportInOutInit(HazyDatagramTransportInOut* self, DatagramTr
 
 void hazyDatagramTransportInOutUpdate(HazyDatagramTransportInOut* self)
 {
+    if (hazyDirectionIsIdlePassthrough(&self->hazy.in)) {
+        // Incoming datagrams are received directly from the other transport in the receive function
+        hazyUpdateAndSend(&self->hazy, &self->other);
+        return;
+    }
+
     hazyUpdateAndCommunicate(&self->hazy, &self->other);
 }
 
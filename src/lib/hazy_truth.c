@@ -0,0 +1,207 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include <hazy/truth.h>
+#include <imprint/allocator.h>
+#include <tiny-libc/tiny_libc.h>
+
+/// Initializes the record ring
+/// @param self truth
+/// @param allocator allocator for the records
+/// @param recordCapacity number of records, must be a power of two
+/// @return negative on error
+int hazyTruthInit(HazyTruth* self, struct ImprintAllocator* allocator, size_t recordCapacity)
+{
+    if (recordCapacity == 0 || (recordCapacity & (recordCapacity - 1)) != 0) {
+        return -2;
+    }
+
+    self->records = IMPRINT_ALLOC_TYPE_COUNT(allocator, HazyTruthRecord, recordCapacity);
+    self->capacityMask = recordCapacity - 1;
+    hazyTruthReset(self);
+
+    return 0;
+}
+
+/// Forgets all records. Called by hazyDirectionReset(), since the sequences start over and the queued
+/// packets are discarded.
+/// @param self truth
+void hazyTruthReset(HazyTruth* self)
+{
+    tc_memset_octets(self->records, 0, sizeof(HazyTruthRecord) * (self->capacityMask + 1));
+    self->nextSequence = 0;
+}
+
+static HazyTruthRecord* hazyTruthFindMutable(const HazyTruth* self, uint32_t sequence)
+{
+    HazyTruthRecord* record = &self->records[sequence & self->capacityMask];
+    if (record->fate == HazyTruthFateUnknown || record->sequence != sequence) {
+        return 0;
+    }
+
+    return record;
+}
+
+/// Called by the direction when a datagram is written and gets its sequence
+/// @param self truth
+/// @param sequence packet sequence
+/// @param now current time
+void hazyTruthWritten(HazyTruth* self, uint32_t sequence, MonotonicTimeMs now)
+{
+    HazyTruthRecord* record = &self->records[sequence & self->capacityMask];
+    record->writtenMs = now;
+    record->deliveredMs = 0;
+    record->sequence = sequence;
+    record->fate = HazyTruthFatePending;
+    record->dropCause = 0;
+    record->deliveredCount = 0;
+    record->outstandingCount = 1;
+
+    self->nextSequence = sequence + 1;
+}
+
+/// Called by the direction when a packet is duplicated, so it is only dropped when all copies are dropped
+/// @param self truth
+/// @param sequence packet sequence
+/// @param extraCopyCount number of copies in addition to the written packet
+void hazyTruthDuplicated(HazyTruth* self, uint32_t sequence, size_t extraCopyCount)
+{
+    HazyTruthRecord* record = hazyTruthFindMutable(self, sequence);
+    if (record == 0) {
+        return;
+    }
+
+    size_t outstandingCount = record->outstandingCount + extraCopyCount;
+    record->outstandingCount = (uint8_t) (outstandingCount < UINT8_MAX ? outstandingCount : UINT8_MAX);
+}
+
+/// Called by the direction for each delivered copy of a packet
+/// @param self truth
+/// @param sequence packet sequence
+/// @param now current time
+void hazyTruthDelivered(HazyTruth* self, uint32_t sequence, MonotonicTimeMs now)
+{
+    HazyTruthRecord* record = hazyTruthFindMutable(self, sequence);
+    if (record == 0) {
+        return;
+    }
+
+    if (record->deliveredCount < UINT8_MAX) {
+        record->deliveredCount++;
+    }
+    if (record->outstandingCount > 0) {
+        record->outstandingCount--;
+    }
+
+    if (record->fate != HazyTruthFateDelivered) {
+        record->fate = HazyTruthFateDelivered;
+        record->deliveredMs = now;
+    }
+}
+
+/// Called by the direction for each dropped copy of a packet. A duplicated packet is
+/// delivered as soon as one of the copies is delivered, and dropped when the last copy is dropped.
+/// @param self truth
+/// @param sequence packet sequence
+/// @param cause HazyTraceDropCause
+void hazyTruthDropped(HazyTruth* self, uint32_t sequence, uint8_t cause)
+{
+    HazyTruthRecord* record = hazyTruthFindMutable(self, sequence);
+    if (record == 0) {
+        return;
+    }
+
+    if (record->outstandingCount > 0) {
+        record->outstandingCount--;
+    }
+    if (record->fate == HazyTruthFateDelivered) {
+        return;
+    }
+
+    record->dropCause = cause;
+    if (record->outstandingCount == 0) {
+        record->fate = HazyTruthFateDropped;
+    }
+}
+
+/// Looks up the record for a packet
+/// @param self truth
+/// @param sequence packet sequence
+/// @return the record, or NULL if it was never written or has been overwritten
+const HazyTruthRecord* hazyTruthFind(const HazyTruth* self, uint32_t sequence)
+{
+    return hazyTruthFindMutable(self, sequence);
+}
+
+/// Aggregates the records for a range of sequences. Sequences without a record are skipped.
+/// The jitter is the RFC 3550 estimate over the delivered packets in sequence order.
+/// @param self truth
+/// @param firstSequence first sequence in the window
+/// @param count number of sequences
+/// @param window the aggregates
+void hazyTruthWindow(const HazyTruth* self, uint32_t firstSequence, uint32_t count, HazyTruthWindow* window)
+{
+    tc_memset_octets(window, 0, sizeof(*window));
+
+    double delaySum = 0;
+    MonotonicTimeMs previousDelayMs = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        const HazyTruthRecord* record = hazyTruthFind(self, firstSequence + i);
+        if (record == 0) {
+            continue;
+        }
+        window->packetCount++;
+
+        switch ((HazyTruthFate) record->fate) {
+            case HazyTruthFatePending:
+                window->pendingCount++;
+                break;
+            case HazyTruthFateDropped:
+                window->droppedCount++;
+                break;
+            case HazyTruthFateDelivered: {
+                MonotonicTimeMs delayMs = record->deliveredMs - record->writtenMs;
+                if (window->deliveredCount == 0 || delayMs < window->minDelayMs) {
+                    window->minDelayMs = delayMs;
+                }
+                if (delayMs > window->maxDelayMs) {
+                    window->maxDelayMs = delayMs;
+                }
+                if (window->deliveredCount > 0) {
+                    MonotonicTimeMs diffMs = delayMs - previousDelayMs;
+                    double variation = (double) (diffMs < 0 ? -diffMs : diffMs);
+                    window->jitterMs += (variation - window->jitterMs) / 16.0;
+                }
+                previousDelayMs = delayMs;
+                delaySum += (double) delayMs;
+                window->deliveredCount++;
+                break;
+            }
+            case HazyTruthFateUnknown:
+                break;
+        }
+    }
+
+    if (window->deliveredCount > 0) {
+        window->meanDelayMs = delaySum / (double) window->deliveredCount;
+    }
+
+    uint32_t handledCount = window->deliveredCount + window->droppedCount;
+    if (handledCount > 0) {
+        window->lossRatio = (double) window->droppedCount / (double) handledCount;
+    }
+}
+
+/// Aggregates the records for the latest written sequences
+/// @param self truth
+/// @param count number of sequences
+/// @param window the aggregates
+void hazyTruthRecentWindow(const HazyTruth* self, uint32_t count, HazyTruthWindow* window)
+{
+    if (count > self->nextSequence) {
+        count = self->nextSequence;
+    }
+
+    hazyTruthWindow(self, self->nextSequence - count, count, window);
+}
@@ -0,0 +1,74 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include <hazy/wire.h>
+
+void hazyWireInit(HazyWire* self, HazyWireConfig config)
+{
+    self->config = config;
+    hazyWireReset(self);
+}
+
+void hazyWireReset(HazyWire* self)
+{
+    self->busyUntilUs = 0;
+}
+
+/// Changes the link speed, a packet that is being sent keeps its time
+/// @param self wire
+/// @param config new config
+void hazyWireSetConfig(HazyWire* self, HazyWireConfig config)
+{
+    self->config = config;
+}
+
+/// Sends a packet on the wire, after the packets that are already being sent
+/// @param self wire
+/// @param octetCount packet size, without the overhead
+/// @param nowUs current time
+/// @return the time when the last octet has been sent
+int64_t hazyWireTransmit(HazyWire* self, size_t octetCount, int64_t nowUs)
+{
+    if (self->config.octetsPerSecond == 0) {
+        return nowUs;
+    }
+
+    uint64_t wireOctetCount = (uint64_t) (octetCount + self->config.overheadOctetCount);
+    int64_t serializationUs = (int64_t) ((wireOctetCount * 1000000u) / self->config.octetsPerSecond);
+
+    int64_t startUs = self->busyUntilUs > nowUs ? self->busyUntilUs : nowUs;
+    self->busyUntilUs = startUs + serializationUs;
+
+    return self->busyUntilUs;
+}
+
+HazyWireConfig hazyWireDisabled(void)
+{
+    HazyWireConfig config = {0, 0};
+
+    return config;
+}
+
+/// Links of 100, 10 and 1 Mbit/s with IPv4 and UDP overhead. The direction presets leave the wire
+/// disabled, so these must be set explicitly in `config.wire`.
+HazyWireConfig hazyWireGoodCondition(void)
+{
+    HazyWireConfig config = {100000000 / 8, 28};
+
+    return config;
+}
+
+HazyWireConfig hazyWireRecommended(void)
+{
+    HazyWireConfig config = {10000000 / 8, 28};
+
+    return config;
+}
+
+HazyWireConfig hazyWireWorstCase(void)
+{
+    HazyWireConfig config = {1000000 / 8, 28};
+
+    return config;
+}
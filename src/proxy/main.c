@@ -0,0 +1,245 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include "proxy.h"
+#include <clog/console.h>
+#include <errno.h>
+#include <limits.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HAZY_PROXY_MAX_THREAD_COUNT (256)
+
+clog_config g_clog;
+
+static volatile sig_atomic_t g_shouldStop;
+
+static void onSignal(int signalNumber)
+{
+    (void) signalNumber;
+    g_shouldStop = 1;
+}
+
+/// Resolves `host:port` or `[ipv6]:port`
+static int resolveAddress(const char* text, struct sockaddr_storage* address, socklen_t* addressLength)
+{
+    char host[256];
+    const char* colon = strrchr(text, ':');
+    if (colon == 0 || (size_t) (colon - text) >= sizeof(host)) {
+        return -1;
+    }
+
+    const char* hostStart = text;
+    size_t hostLength = (size_t) (colon - text);
+    if (hostLength >= 2 && text[0] == '[' && text[hostLength - 1] == ']') {
+        hostStart++;
+        hostLength -= 2;
+    }
+    tc_memcpy_octets(host, hostStart, hostLength);
+    host[hostLength] = 0;
+
+    struct addrinfo hints;
+    tc_memset_octets(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    struct addrinfo* result;
+    if (getaddrinfo(hostLength > 0 ? host : 0, colon + 1, &hints, &result) != 0) {
+        return -2;
+    }
+
+    tc_memcpy_octets(address, result->ai_addr, result->ai_addrlen);
+    *addressLength = result->ai_addrlen;
+    freeaddrinfo(result);
+
+    return 0;
+}
+
+static int parsePreset(const char* name, HazyConfig* config)
+{
+    if (strcmp(name, "good") == 0) {
+        *config = hazyConfigGoodCondition();
+    } else if (strcmp(name, "recommended") == 0) {
+        *config = hazyConfigRecommended();
+    } else if (strcmp(name, "worst") == 0) {
+        *config = hazyConfigWorstCase();
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+/// Parses a positive number of milliseconds
+static int parseMilliseconds(const char* text, MonotonicTimeMs* milliseconds)
+{
+    char* end;
+    errno = 0;
+    long value = strtol(text, &end, 10);
+    if (errno != 0 || end == text || *end != 0 || value <= 0) {
+        return -1;
+    }
+
+    *milliseconds = value;
+
+    return 0;
+}
+
+/// Parses a count from one to maxCount
+static int parseCount(const char* text, long maxCount, size_t* count)
+{
+    char* end;
+    errno = 0;
+    long value = strtol(text, &end, 10);
+    if (errno != 0 || end == text || *end != 0 || value <= 0 || value > maxCount) {
+        return -1;
+    }
+
+    *count = (size_t) value;
+
+    return 0;
+}
+
+static void printUsage(void)
+{
+    fprintf(stderr, "usage: hazy-proxy --listen host:port --upstream host:port [--preset good|recommended|worst]\n"
+                    "                  [--scenario file] [--threads count] [--max-flows count] [--idle-timeout ms]\n");
+}
+
+static void* workerThread(void* arg)
+{
+    HazyProxyWorker* worker = arg;
+    hazyProxyWorkerRun(worker, &g_shouldStop);
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    g_clog.log = clog_console;
+
+    srand((unsigned int) time(0));
+
+    Clog log;
+    log.config = &g_clog;
+    log.constantPrefix = "hazy-proxy";
+
+    HazyProxyConfig config;
+    tc_memset_octets(&config, 0, sizeof(config));
+    config.hazyConfig = hazyConfigRecommended();
+    config.maxFlowCount = 4096;
+    config.flowIdleTimeoutMs = 30000;
+
+    const char* listenText = 0;
+    const char* upstreamText = 0;
+    const char* scenarioFilename = 0;
+    long onlineCpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threadCount = onlineCpuCount > 0 ? (size_t) onlineCpuCount : 1;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* option = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : 0;
+        if (value == 0) {
+            printUsage();
+            return 1;
+        }
+        i++;
+
+        if (strcmp(option, "--listen") == 0) {
+            listenText = value;
+        } else if (strcmp(option, "--upstream") == 0) {
+            upstreamText = value;
+        } else if (strcmp(option, "--preset") == 0) {
+            if (parsePreset(value, &config.hazyConfig) < 0) {
+                printUsage();
+                return 1;
+            }
+        } else if (strcmp(option, "--scenario") == 0) {
+            scenarioFilename = value;
+        } else if (strcmp(option, "--threads") == 0) {
+            if (parseCount(value, HAZY_PROXY_MAX_THREAD_COUNT, &threadCount) < 0) {
+                printUsage();
+                return 1;
+            }
+        } else if (strcmp(option, "--max-flows") == 0) {
+            if (parseCount(value, LONG_MAX, &config.maxFlowCount) < 0) {
+                printUsage();
+                return 1;
+            }
+        } else if (strcmp(option, "--idle-timeout") == 0) {
+            if (parseMilliseconds(value, &config.flowIdleTimeoutMs) < 0) {
+                printUsage();
+                return 1;
+            }
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    if (listenText == 0 || upstreamText == 0) {
+        printUsage();
+        return 1;
+    }
+
+    if (resolveAddress(listenText, &config.listenAddress, &config.listenAddressLength) < 0) {
+        CLOG_C_WARN(&log, "could not resolve listen address '%s'", listenText)
+        return 1;
+    }
+
+    if (resolveAddress(upstreamText, &config.upstreamAddress, &config.upstreamAddressLength) < 0) {
+        CLOG_C_WARN(&log, "could not resolve upstream address '%s'", upstreamText)
+        return 1;
+    }
+
+    ImprintDefaultSetup scenarioImprint;
+    HazyScenario scenario;
+    if (scenarioFilename != 0) {
+        imprintDefaultSetupInit(&scenarioImprint, 1024 * 1024);
+        if (hazyScenarioInitFromFile(&scenario, &scenarioImprint.tagAllocator.info, scenarioFilename, log) < 0) {
+            return 1;
+        }
+        config.scenario = &scenario;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    size_t workerCount = threadCount;
+    HazyProxyWorker* workers = tc_malloc(sizeof(HazyProxyWorker) * workerCount);
+    for (size_t i = 0; i < workerCount; ++i) {
+        if (hazyProxyWorkerInit(&workers[i], &config, i, log) < 0) {
+            for (size_t j = 0; j < i; ++j) {
+                hazyProxyWorkerDestroy(&workers[j]);
+            }
+            tc_free(workers);
+            return 1;
+        }
+    }
+
+    CLOG_C_INFO(&log, "forwarding %s to %s using %zu threads", listenText, upstreamText, workerCount)
+
+    for (size_t i = 0; i < workerCount; ++i) {
+        pthread_create(&workers[i].thread, 0, workerThread, &workers[i]);
+    }
+
+    size_t receivedDatagramCount = 0;
+    size_t sentDatagramCount = 0;
+    for (size_t i = 0; i < workerCount; ++i) {
+        pthread_join(workers[i].thread, 0);
+        receivedDatagramCount += workers[i].receivedDatagramCount;
+        sentDatagramCount += workers[i].sentDatagramCount;
+        hazyProxyWorkerDestroy(&workers[i]);
+    }
+
+    CLOG_C_INFO(&log, "received %zu and sent %zu datagrams", receivedDatagramCount, sentDatagramCount)
+
+    tc_free(workers);
+
+    return 0;
+}
@@ -0,0 +1,561 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include "proxy.h"
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#define HAZY_PROXY_LISTEN_TAG (UINT64_MAX)
+#define HAZY_PROXY_IDLE_WAIT_MS (100)
+
+static int hazyProxyCreateSocket(int family)
+{
+    return socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+}
+
+static uint32_t hashAddress(const struct sockaddr_storage* address)
+{
+    const uint8_t* octets;
+    size_t octetCount;
+    uint16_t port;
+
+    if (address->ss_family == AF_INET6) {
+        const struct sockaddr_in6* in6 = (const struct sockaddr_in6*) address;
+        octets = in6->sin6_addr.s6_addr;
+        octetCount = sizeof(in6->sin6_addr.s6_addr);
+        port = in6->sin6_port;
+    } else {
+        const struct sockaddr_in* in4 = (const struct sockaddr_in*) address;
+        octets = (const uint8_t*) &in4->sin_addr.s_addr;
+        octetCount = sizeof(in4->sin_addr.s_addr);
+        port = in4->sin_port;
+    }
+
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < octetCount; ++i) {
+        hash = (hash ^ octets[i]) * 16777619u;
+    }
+    hash = (hash ^ (port & 0xff)) * 16777619u;
+    hash = (hash ^ (uint32_t) (port >> 8)) * 16777619u;
+
+    return hash;
+}
+
+static bool isSameAddress(const struct sockaddr_storage* a, const struct sockaddr_storage* b)
+{
+    if (a->ss_family != b->ss_family) {
+        return false;
+    }
+
+    if (a->ss_family == AF_INET6) {
+        const struct sockaddr_in6* a6 = (const struct sockaddr_in6*) a;
+        const struct sockaddr_in6* b6 = (const struct sockaddr_in6*) b;
+        return a6->sin6_port == b6->sin6_port &&
+               memcmp(&a6->sin6_addr, &b6->sin6_addr, sizeof(a6->sin6_addr)) == 0;
+    }
+
+    const struct sockaddr_in* a4 = (const struct sockaddr_in*) a;
+    const struct sockaddr_in* b4 = (const struct sockaddr_in*) b;
+
+    return a4->sin_port == b4->sin_port && a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+}
+
+static void batchResetNameLengths(HazyProxyBatch* self)
+{
+    for (size_t i = 0; i < HAZY_PROXY_BATCH_COUNT; ++i) {
+        self->messages[i].msg_hdr.msg_namelen = sizeof(self->addresses[i]);
+    }
+}
+
+static void batchPrepare(HazyProxyBatch* self)
+{
+    for (size_t i = 0; i < HAZY_PROXY_BATCH_COUNT; ++i) {
+        self->vectors[i].iov_base = self->buffers[i];
+        self->vectors[i].iov_len = HAZY_PROXY_MAX_DATAGRAM_OCTET_COUNT;
+        tc_memset_octets(&self->messages[i], 0, sizeof(self->messages[i]));
+        self->messages[i].msg_hdr.msg_iov = &self->vectors[i];
+        self->messages[i].msg_hdr.msg_iovlen = 1;
+        self->messages[i].msg_hdr.msg_name = &self->addresses[i];
+        self->messages[i].msg_hdr.msg_namelen = sizeof(self->addresses[i]);
+    }
+    self->count = 0;
+}
+
+int hazyProxyWorkerInit(HazyProxyWorker* self, const HazyProxyConfig* config, size_t index, Clog log)
+{
+    self->config = config;
+    self->index = index;
+    tc_snprintf(self->debugPrefix, sizeof(self->debugPrefix), "%s/%zu", log.constantPrefix, index);
+    self->log.config = log.config;
+    self->log.constantPrefix = self->debugPrefix;
+
+    // Everything that can fail is done before any memory is allocated
+    self->listenSocket = hazyProxyCreateSocket(config->listenAddress.ss_family);
+    if (self->listenSocket < 0) {
+        CLOG_C_WARN(&self->log, "could not create listen socket (%d)", errno)
+        return -1;
+    }
+
+    int enable = 1;
+    setsockopt(self->listenSocket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
+    if (bind(self->listenSocket, (const struct sockaddr*) &config->listenAddress, config->listenAddressLength) < 0) {
+        CLOG_C_WARN(&self->log, "could not bind listen socket (%d)", errno)
+        close(self->listenSocket);
+        return -2;
+    }
+
+    self->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (self->epollFd < 0) {
+        CLOG_C_WARN(&self->log, "could not create epoll instance (%d)", errno)
+        close(self->listenSocket);
+        return -3;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = HAZY_PROXY_LISTEN_TAG;
+    if (epoll_ctl(self->epollFd, EPOLL_CTL_ADD, self->listenSocket, &event) < 0) {
+        CLOG_C_WARN(&self->log, "could not add listen socket to epoll (%d)", errno)
+        close(self->epollFd);
+        close(self->listenSocket);
+        return -3;
+    }
+    self->isListenBlocked = false;
+
+    size_t bucketCount = 1;
+    while (bucketCount < config->maxFlowCount * 2) {
+        bucketCount *= 2;
+    }
+    self->bucketMask = bucketCount - 1;
+    self->buckets = tc_malloc(sizeof(int) * bucketCount);
+    for (size_t i = 0; i < bucketCount; ++i) {
+        self->buckets[i] = -1;
+    }
+
+    self->flows = tc_malloc(sizeof(HazyProxyFlow) * config->maxFlowCount);
+    self->freeFlows = tc_malloc(sizeof(int) * config->maxFlowCount);
+    self->activeFlows = tc_malloc(sizeof(size_t) * config->maxFlowCount);
+    for (size_t i = 0; i < config->maxFlowCount; ++i) {
+        self->flows[i].isUsed = false;
+        self->freeFlows[i] = (int) (config->maxFlowCount - 1 - i);
+    }
+    self->freeFlowCount = config->maxFlowCount;
+    self->activeFlowCount = 0;
+
+    batchPrepare(&self->receiveBatch);
+    batchPrepare(&self->sendBatch);
+
+    imprintDefaultSetupInit(&self->imprint, 64 * 1024 * 1024);
+
+    self->nextHousekeepingMs = 0;
+    self->receivedDatagramCount = 0;
+    self->sentDatagramCount = 0;
+    self->rejectedFlowCount = 0;
+    self->truncatedDatagramCount = 0;
+
+    return 0;
+}
+
+void hazyProxyWorkerDestroy(HazyProxyWorker* self)
+{
+    for (size_t i = 0; i < self->config->maxFlowCount; ++i) {
+        if (self->flows[i].isUsed) {
+            close(self->flows[i].upstreamSocket);
+        }
+    }
+    close(self->epollFd);
+    close(self->listenSocket);
+    tc_free(self->buckets);
+    tc_free(self->flows);
+    tc_free(self->freeFlows);
+    tc_free(self->activeFlows);
+}
+
+static HazyProxyFlow* findFlow(HazyProxyWorker* self, const struct sockaddr_storage* address)
+{
+    int flowIndex = self->buckets[hashAddress(address) & self->bucketMask];
+    while (flowIndex >= 0) {
+        HazyProxyFlow* flow = &self->flows[flowIndex];
+        if (isSameAddress(&flow->clientAddress, address)) {
+            return flow;
+        }
+        flowIndex = flow->nextInBucket;
+    }
+
+    return 0;
+}
+
+static HazyProxyFlow* createFlow(HazyProxyWorker* self, const struct sockaddr_storage* address,
+                                 socklen_t addressLength, MonotonicTimeMs now)
+{
+    if (self->freeFlowCount == 0) {
+        self->rejectedFlowCount++;
+        return 0;
+    }
+
+    const HazyProxyConfig* config = self->config;
+    int upstreamSocket = hazyProxyCreateSocket(config->upstreamAddress.ss_family);
+    if (upstreamSocket < 0) {
+        CLOG_C_WARN(&self->log, "could not create upstream socket (%d)", errno)
+        return 0;
+    }
+
+    if (connect(upstreamSocket, (const struct sockaddr*) &config->upstreamAddress, config->upstreamAddressLength) <
+        0) {
+        CLOG_C_WARN(&self->log, "could not connect upstream socket (%d)", errno)
+        close(upstreamSocket);
+        return 0;
+    }
+
+    int flowIndex = self->freeFlows[--self->freeFlowCount];
+    HazyProxyFlow* flow = &self->flows[flowIndex];
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = (uint64_t) flowIndex;
+    epoll_ctl(self->epollFd, EPOLL_CTL_ADD, upstreamSocket, &event);
+
+    flow->clientAddress = *address;
+    flow->clientAddressLength = addressLength;
+    flow->upstreamSocket = upstreamSocket;
+    flow->lastActivityMs = now;
+    flow->isUsed = true;
+    flow->isActive = false;
+    flow->isUpstreamBlocked = false;
+
+    ImprintAllocatorWithFree* allocatorWithFree = &self->imprint.slabAllocator.info;
+    flow->toUpstream.log = self->log;
+    flow->toClient.log = self->log;
+    hazyDirectionInit(&flow->toUpstream, 0, allocatorWithFree, config->hazyConfig.out, self->log);
+    hazyDirectionInit(&flow->toClient, 0, allocatorWithFree, config->hazyConfig.in, self->log);
+    hazyScenarioPlayerInit(&flow->scenarioPlayer, config->scenario);
+
+    size_t bucket = hashAddress(address) & self->bucketMask;
+    flow->nextInBucket = self->buckets[bucket];
+    self->buckets[bucket] = flowIndex;
+
+    CLOG_C_DEBUG(&self->log, "new flow %d", flowIndex)
+
+    return flow;
+}
+
+static void destroyFlow(HazyProxyWorker* self, int flowIndex)
+{
+    HazyProxyFlow* flow = &self->flows[flowIndex];
+
+    int* link = &self->buckets[hashAddress(&flow->clientAddress) & self->bucketMask];
+    while (*link != flowIndex) {
+        link = &self->flows[*link].nextInBucket;
+    }
+    *link = flow->nextInBucket;
+
+    close(flow->upstreamSocket);
+    hazyDirectionReset(&flow->toUpstream);
+    hazyDirectionReset(&flow->toClient);
+    flow->isUsed = false;
+    self->freeFlows[self->freeFlowCount++] = flowIndex;
+
+    CLOG_C_DEBUG(&self->log, "removed idle flow %d", flowIndex)
+}
+
+static bool isDirectionIdle(const HazyDirection* direction)
+{
+    return direction->packets.packetCount == 0 && direction->reorder.heldCount == 0;
+}
+
+static void updateFlow(HazyProxyFlow* flow, MonotonicTimeMs now)
+{
+    HazyDirectionConfig in;
+    HazyDirectionConfig out;
+    if (hazyScenarioPlayerUpdate(&flow->scenarioPlayer, now, &in, &out)) {
+        hazyDirectionAdjustConfig(&flow->toClient, in);
+        hazyDirectionAdjustConfig(&flow->toUpstream, out);
+    }
+
+    hazyDirectionUpdate(&flow->toUpstream, now);
+    hazyDirectionUpdate(&flow->toClient, now);
+}
+
+static void activateFlow(HazyProxyWorker* self, HazyProxyFlow* flow)
+{
+    if (flow->isActive) {
+        return;
+    }
+    flow->isActive = true;
+    self->activeFlows[self->activeFlowCount++] = (size_t) (flow - self->flows);
+}
+
+static void writeToDirection(HazyProxyWorker* self, HazyProxyFlow* flow, HazyDirection* direction,
+                             const uint8_t* data, size_t octetCount, MonotonicTimeMs now)
+{
+    if (!flow->isActive) {
+        updateFlow(flow, now);
+        activateFlow(self, flow);
+    }
+    flow->lastActivityMs = now;
+    hazyWriteDirectionAt(direction, data, octetCount, now);
+}
+
+static void receiveFromClients(HazyProxyWorker* self, MonotonicTimeMs now)
+{
+    HazyProxyBatch* batch = &self->receiveBatch;
+
+    while (1) {
+        batchResetNameLengths(batch);
+        int receivedCount = recvmmsg(self->listenSocket, batch->messages, HAZY_PROXY_BATCH_COUNT, 0, 0);
+        if (receivedCount <= 0) {
+            return;
+        }
+
+        for (size_t i = 0; i < (size_t) receivedCount; ++i) {
+            const struct msghdr* header = &batch->messages[i].msg_hdr;
+            HazyProxyFlow* flow = findFlow(self, &batch->addresses[i]);
+            if (flow == 0) {
+                flow = createFlow(self, &batch->addresses[i], header->msg_namelen, now);
+                if (flow == 0) {
+                    continue;
+                }
+            }
+            if (header->msg_flags & MSG_TRUNC) {
+                self->truncatedDatagramCount++;
+                continue;
+            }
+            writeToDirection(self, flow, &flow->toUpstream, batch->buffers[i], batch->messages[i].msg_len, now);
+        }
+        self->receivedDatagramCount += (size_t) receivedCount;
+
+        if (receivedCount < HAZY_PROXY_BATCH_COUNT) {
+            return;
+        }
+    }
+}
+
+static void receiveFromUpstream(HazyProxyWorker* self, HazyProxyFlow* flow, MonotonicTimeMs now)
+{
+    HazyProxyBatch* batch = &self->receiveBatch;
+
+    while (1) {
+        batchResetNameLengths(batch);
+        int receivedCount = recvmmsg(flow->upstreamSocket, batch->messages, HAZY_PROXY_BATCH_COUNT, 0, 0);
+        if (receivedCount <= 0) {
+            return;
+        }
+
+        for (size_t i = 0; i < (size_t) receivedCount; ++i) {
+            if (batch->messages[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                self->truncatedDatagramCount++;
+                continue;
+            }
+            writeToDirection(self, flow, &flow->toClient, batch->buffers[i], batch->messages[i].msg_len, now);
+        }
+        self->receivedDatagramCount += (size_t) receivedCount;
+
+        if (receivedCount < HAZY_PROXY_BATCH_COUNT) {
+            return;
+        }
+    }
+}
+
+static void settleBatchPacket(HazyProxyWorker* self, HazyProxyBatch* batch, size_t index, bool isSent,
+                              MonotonicTimeMs now)
+{
+    HazyDirection* direction = batch->directions[index];
+    HazyPacket* packet = &batch->packets[index];
+    if (isSent) {
+        hazyDirectionPacketDelivered(direction, packet, now);
+        self->sentDatagramCount++;
+    } else {
+        hazyDirectionPacketDropped(direction, packet, HazyTraceDropCauseSendFailed, now);
+    }
+    IMPRINT_FREE(direction->packets.allocatorWithFree, packet->data);
+}
+
+static void waitForWritable(HazyProxyWorker* self, int socketFd, uint64_t tag, uint32_t events)
+{
+    struct epoll_event event;
+    event.events = events;
+    event.data.u64 = tag;
+    epoll_ctl(self->epollFd, EPOLL_CTL_MOD, socketFd, &event);
+}
+
+/// Sends the batch. The packets are only counted as delivered when the kernel has accepted them.
+/// If the socket would block, the unsent packets are put back into their directions, so they are
+/// sent when the socket is writable again.
+/// @return true if the socket would block
+static bool flushBatch(HazyProxyWorker* self, HazyProxyBatch* batch, int socketFd, MonotonicTimeMs now)
+{
+    unsigned int sentIndex = 0;
+    bool isBlocked = false;
+    while (sentIndex < batch->count) {
+        int sentCount = sendmmsg(socketFd, &batch->messages[sentIndex], batch->count - sentIndex, 0);
+        if (sentCount > 0) {
+            for (unsigned int i = 0; i < (unsigned int) sentCount; ++i) {
+                settleBatchPacket(self, batch, sentIndex + i, true, now);
+            }
+            sentIndex += (unsigned int) sentCount;
+            continue;
+        }
+
+        if (sentCount < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (sentCount < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)) {
+            isBlocked = true;
+            break;
+        }
+
+        // The first datagram could not be sent at all, e.g. the upstream port is closed
+        settleBatchPacket(self, batch, sentIndex, false, now);
+        sentIndex++;
+    }
+
+    for (unsigned int i = sentIndex; i < batch->count; ++i) {
+        if (hazyPacketsPutBack(&batch->directions[i]->packets, &batch->packets[i], &self->log) < 0) {
+            settleBatchPacket(self, batch, i, false, now);
+        }
+    }
+
+    batch->count = 0;
+
+    return isBlocked;
+}
+
+/// Moves the packets that are due into the send batch, without copying the payloads.
+/// The batch is flushed when full.
+/// @return true if the socket would block
+static bool collectDuePackets(HazyProxyWorker* self, HazyDirection* direction, MonotonicTimeMs now, int socketFd,
+                              const struct sockaddr_storage* address, socklen_t addressLength)
+{
+    HazyProxyBatch* batch = &self->sendBatch;
+
+    HazyPacket packet;
+    while (hazyPacketsFindPacketToActOn(&direction->packets, now, &packet)) {
+        hazyPacketsTakePacket(&direction->packets, &packet);
+
+        struct msghdr* header = &batch->messages[batch->count].msg_hdr;
+        batch->vectors[batch->count].iov_base = packet.data;
+        batch->vectors[batch->count].iov_len = packet.octetCount;
+        if (address != 0) {
+            batch->addresses[batch->count] = *address;
+            header->msg_name = &batch->addresses[batch->count];
+            header->msg_namelen = addressLength;
+        } else {
+            header->msg_name = 0;
+            header->msg_namelen = 0;
+        }
+        batch->packets[batch->count] = packet;
+        batch->directions[batch->count] = direction;
+        batch->count++;
+
+        if (batch->count == HAZY_PROXY_BATCH_COUNT && flushBatch(self, batch, socketFd, now)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void sendDuePackets(HazyProxyWorker* self, MonotonicTimeMs now)
+{
+    // Client bound packets from all flows share the listen socket, so they can be sent in the same batch
+    for (size_t i = 0; i < self->activeFlowCount; ++i) {
+        HazyProxyFlow* flow = &self->flows[self->activeFlows[i]];
+        updateFlow(flow, now);
+        if (!self->isListenBlocked) {
+            self->isListenBlocked = collectDuePackets(self, &flow->toClient, now, self->listenSocket,
+                                                      &flow->clientAddress, flow->clientAddressLength);
+        }
+    }
+    if (!self->isListenBlocked) {
+        self->isListenBlocked = flushBatch(self, &self->sendBatch, self->listenSocket, now);
+    }
+    if (self->isListenBlocked) {
+        waitForWritable(self, self->listenSocket, HAZY_PROXY_LISTEN_TAG, EPOLLIN | EPOLLOUT);
+    }
+
+    for (size_t i = 0; i < self->activeFlowCount;) {
+        HazyProxyFlow* flow = &self->flows[self->activeFlows[i]];
+        if (!flow->isUpstreamBlocked) {
+            bool isBlocked = collectDuePackets(self, &flow->toUpstream, now, flow->upstreamSocket, 0, 0);
+            if (!isBlocked) {
+                isBlocked = flushBatch(self, &self->sendBatch, flow->upstreamSocket, now);
+            }
+            if (isBlocked) {
+                flow->isUpstreamBlocked = true;
+                waitForWritable(self, flow->upstreamSocket, (uint64_t) self->activeFlows[i], EPOLLIN | EPOLLOUT);
+            }
+        }
+
+        if (isDirectionIdle(&flow->toUpstream) && isDirectionIdle(&flow->toClient)) {
+            flow->isActive = false;
+            self->activeFlows[i] = self->activeFlows[--self->activeFlowCount];
+        } else {
+            ++i;
+        }
+    }
+}
+
+static void removeIdleFlows(HazyProxyWorker* self, MonotonicTimeMs now)
+{
+    for (size_t i = 0; i < self->config->maxFlowCount; ++i) {
+        HazyProxyFlow* flow = &self->flows[i];
+        if (flow->isUsed && !flow->isActive && now - flow->lastActivityMs >= self->config->flowIdleTimeoutMs) {
+            destroyFlow(self, (int) i);
+        }
+    }
+}
+
+/// Runs the worker until `shouldStop` is set.
+/// @param self worker
+/// @param shouldStop stop flag, usually set from a signal handler
+void hazyProxyWorkerRun(HazyProxyWorker* self, volatile sig_atomic_t* shouldStop)
+{
+    struct epoll_event events[HAZY_PROXY_BATCH_COUNT];
+
+    while (!*shouldStop) {
+        // Packets are scheduled with millisecond precision, so only wake up every millisecond when needed
+        int timeoutMs = self->activeFlowCount > 0 ? 1 : HAZY_PROXY_IDLE_WAIT_MS;
+        int eventCount = epoll_wait(self->epollFd, events, HAZY_PROXY_BATCH_COUNT, timeoutMs);
+        if (eventCount < 0 && errno != EINTR) {
+            CLOG_C_WARN(&self->log, "epoll wait failed (%d)", errno)
+            return;
+        }
+
+        MonotonicTimeMs now = monotonicTimeMsNow();
+
+        for (int i = 0; i < eventCount; ++i) {
+            uint64_t tag = events[i].data.u64;
+            bool isWritable = (events[i].events & EPOLLOUT) != 0;
+            if (tag == HAZY_PROXY_LISTEN_TAG) {
+                if (isWritable) {
+                    self->isListenBlocked = false;
+                    waitForWritable(self, self->listenSocket, tag, EPOLLIN);
+                }
+                receiveFromClients(self, now);
+            } else {
+                HazyProxyFlow* flow = &self->flows[tag];
+                if (!flow->isUsed) {
+                    continue;
+                }
+                if (isWritable) {
+                    flow->isUpstreamBlocked = false;
+                    waitForWritable(self, flow->upstreamSocket, tag, EPOLLIN);
+                }
+                receiveFromUpstream(self, flow, now);
+            }
+        }
+
+        sendDuePackets(self, now);
+
+        if (now >= self->nextHousekeepingMs) {
+            removeIdleFlows(self, now);
+            self->nextHousekeepingMs = now + 1000;
+        }
+    }
+}
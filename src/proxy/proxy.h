@@ -0,0 +1,87 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#ifndef HAZY_PROXY_H
+#define HAZY_PROXY_H
+
+#include <clog/clog.h>
+#include <hazy/hazy.h>
+#include <imprint/default_setup.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+
+#define HAZY_PROXY_BATCH_COUNT (64)
+#define HAZY_PROXY_MAX_DATAGRAM_OCTET_COUNT (1200)
+
+typedef struct HazyProxyConfig {
+    struct sockaddr_storage listenAddress;
+    socklen_t listenAddressLength;
+    struct sockaddr_storage upstreamAddress;
+    socklen_t upstreamAddressLength;
+    HazyConfig hazyConfig;
+    const HazyScenario* scenario;
+    size_t maxFlowCount;
+    MonotonicTimeMs flowIdleTimeoutMs;
+} HazyProxyConfig;
+
+/// A client, identified by its address, with its own upstream socket and impairment.
+/// Client to upstream uses the `out` config and upstream to client uses the `in` config.
+typedef struct HazyProxyFlow {
+    struct sockaddr_storage clientAddress;
+    socklen_t clientAddressLength;
+    int upstreamSocket;
+    HazyDirection toUpstream;
+    HazyDirection toClient;
+    HazyScenarioPlayer scenarioPlayer;
+    MonotonicTimeMs lastActivityMs;
+    int nextInBucket;
+    bool isUsed;
+    bool isActive;
+    bool isUpstreamBlocked; // waiting for EPOLLOUT before sending more
+} HazyProxyFlow;
+
+typedef struct HazyProxyBatch {
+    struct mmsghdr messages[HAZY_PROXY_BATCH_COUNT];
+    struct iovec vectors[HAZY_PROXY_BATCH_COUNT];
+    struct sockaddr_storage addresses[HAZY_PROXY_BATCH_COUNT];
+    uint8_t buffers[HAZY_PROXY_BATCH_COUNT][HAZY_PROXY_MAX_DATAGRAM_OCTET_COUNT];
+    HazyPacket packets[HAZY_PROXY_BATCH_COUNT];       // send batch: taken from the direction until sent
+    HazyDirection* directions[HAZY_PROXY_BATCH_COUNT]; // send batch: where each packet was taken from
+    unsigned int count;
+} HazyProxyBatch;
+
+/// Each worker has its own listen socket (SO_REUSEPORT), epoll instance and flows.
+/// The kernel hashes the client address to a listen socket, so a flow always stays on the same worker.
+typedef struct HazyProxyWorker {
+    const HazyProxyConfig* config;
+    size_t index;
+    int listenSocket;
+    int epollFd;
+    bool isListenBlocked; // waiting for EPOLLOUT before sending more to the clients
+    HazyProxyFlow* flows;
+    int* buckets;
+    size_t bucketMask;
+    int* freeFlows;
+    size_t freeFlowCount;
+    size_t* activeFlows;
+    size_t activeFlowCount;
+    HazyProxyBatch receiveBatch;
+    HazyProxyBatch sendBatch;
+    ImprintDefaultSetup imprint;
+    MonotonicTimeMs nextHousekeepingMs;
+    size_t receivedDatagramCount;
+    size_t sentDatagramCount;
+    size_t rejectedFlowCount;
+    size_t truncatedDatagramCount;
+    pthread_t thread;
+    char debugPrefix[32];
+    Clog log;
+} HazyProxyWorker;
+
+int hazyProxyWorkerInit(HazyProxyWorker* self, const HazyProxyConfig* config, size_t index, Clog log);
+void hazyProxyWorkerRun(HazyProxyWorker* self, volatile sig_atomic_t* shouldStop);
+void hazyProxyWorkerDestroy(HazyProxyWorker* self);
+
+#endif
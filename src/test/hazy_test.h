@@ -0,0 +1,86 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#ifndef HAZY_TEST_H
+#define HAZY_TEST_H
+
+#include <hazy/hazy.h>
+#include <imprint/default_setup.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Fails the test, also when assert() is compiled out in release builds
+#define HAZY_TEST_ASSERT(condition)                                                                                    \
+    do {                                                                                                               \
+        if (!(condition)) {                                                                                            \
+            fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #condition);                                    \
+            exit(1);                                                                                                   \
+        }                                                                                                              \
+    } while (0)
+
+#define HAZY_TEST_OCTET_CAPACITY (1200)
+
+typedef struct HazyTest {
+    ImprintDefaultSetup imprint;
+    Hazy hazy;
+    Clog log;
+} HazyTest;
+
+/// A direction that only delays the packets. Tests turn on the impairment they check.
+/// @param roundTripLatencyMs latency of both directions together, each direction gets half of it
+/// @return direction config
+static inline HazyDirectionConfig hazyTestDirectionConfig(size_t roundTripLatencyMs)
+{
+    HazyDirectionConfig config;
+    memset(&config, 0, sizeof(config));
+    config.decider.originalChance = 1;
+    config.latency.minLatency = roundTripLatencyMs;
+    config.latency.maxLatency = roundTripLatencyMs;
+
+    return config;
+}
+
+static inline void hazyTestInit(HazyTest* self, HazyConfig config, uint64_t seed, clog_config* clogConfig)
+{
+    self->log.constantPrefix = "test";
+    self->log.config = clogConfig;
+    imprintDefaultSetupInit(&self->imprint, 1024 * 1024);
+    hazyInit(&self->hazy, HAZY_PACKETS_CAPACITY, &self->imprint.tagAllocator.info, &self->imprint.slabAllocator.info,
+             config, self->log);
+    hazySetSeed(&self->hazy, seed);
+}
+
+/// Writes a packet that starts with its sequence number
+static inline int hazyTestWrite(Hazy* hazy, uint32_t sequence, size_t octetCount, MonotonicTimeMs now)
+{
+    uint8_t data[HAZY_TEST_OCTET_CAPACITY];
+    memset(data, 0xa5, octetCount);
+    memcpy(data, &sequence, sizeof(sequence));
+
+    return hazyWriteAt(hazy, data, octetCount, now);
+}
+
+/// Reads the outgoing packets that are due at `now`
+/// @param hazy hazy
+/// @param sequences the sequence numbers of the packets, in the order they were sent
+/// @param count number of sequences so far, is increased for each packet
+/// @param capacity sequences capacity
+/// @param now current time
+static inline void hazyTestReadSend(Hazy* hazy, uint32_t* sequences, size_t* count, size_t capacity,
+                                    MonotonicTimeMs now)
+{
+    uint8_t data[HAZY_TEST_OCTET_CAPACITY];
+    while (1) {
+        int octetCount = hazyReadSendAt(hazy, data, sizeof(data), now);
+        if (octetCount <= 0) {
+            break;
+        }
+        HAZY_TEST_ASSERT(*count < capacity);
+        memcpy(&sequences[*count], data, sizeof(uint32_t));
+        (*count)++;
+    }
+}
+
+#endif
@@ -0,0 +1,155 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include "hazy_test.h"
+#include <hazy/batch.h>
+
+clog_config g_clog;
+
+#define TEST_RUN_COUNT (24)
+#define TEST_WORKER_CAPACITY (4)
+
+/// What the server received in a run. Each run is only touched by the worker that executes it.
+typedef struct TestRunState {
+    uint64_t orderHash;
+    uint32_t nextSequence;
+    size_t serverReceivedCount;
+    size_t clientReceivedCount;
+} TestRunState;
+
+typedef struct TestBatch {
+    TestRunState runStates[TEST_RUN_COUNT];
+    HazyBatchRunResult runResults[TEST_RUN_COUNT];
+    HazyBatchResult result;
+} TestBatch;
+
+static void* runInit(void* userData, HazyBatchRun* run)
+{
+    TestBatch* batch = userData;
+    TestRunState* state = &batch->runStates[run->index];
+    memset(state, 0, sizeof(*state));
+
+    return state;
+}
+
+/// The client sends a packet every step, and the server echoes everything back
+static int runStep(void* userData, HazyBatchRun* run)
+{
+    (void) userData;
+    TestRunState* state = run->userState;
+
+    uint8_t data[HAZY_TEST_OCTET_CAPACITY];
+    memset(data, 0, 200);
+    memcpy(data, &state->nextSequence, sizeof(state->nextSequence));
+    state->nextSequence++;
+    int result = datagramTransportSend(&run->client, data, 100 + (size_t) (run->now % 100));
+    if (result < 0) {
+        return result;
+    }
+
+    ssize_t octetCount;
+    while ((octetCount = datagramTransportReceive(&run->server, data, sizeof(data))) > 0) {
+        uint32_t sequence;
+        memcpy(&sequence, data, sizeof(sequence));
+        state->orderHash = hazyRandomMix(state->orderHash + sequence);
+        state->serverReceivedCount++;
+        result = datagramTransportSend(&run->server, data, (size_t) octetCount);
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    while ((octetCount = datagramTransportReceive(&run->client, data, sizeof(data))) > 0) {
+        state->clientReceivedCount++;
+    }
+
+    return 0;
+}
+
+static void execute(TestBatch* batch, const HazyScenario* scenario, uint64_t baseSeed, size_t workerCount)
+{
+    static ImprintDefaultSetup setups[TEST_WORKER_CAPACITY];
+    HazyBatchWorker workers[TEST_WORKER_CAPACITY];
+    for (size_t i = 0; i < workerCount; ++i) {
+        imprintDefaultSetupInit(&setups[i], 1024 * 1024);
+        workers[i].allocator = &setups[i].tagAllocator.info;
+        workers[i].allocatorWithFree = &setups[i].slabAllocator.info;
+    }
+
+    HazyBatchConfig config = {hazyConfigWorstCase(), scenario, TEST_RUN_COUNT, baseSeed, 5000, 16,
+                              {"batch", &g_clog}};
+    HazyBatchCallbacks callbacks = {runInit, runStep, 0, batch};
+
+    int result = hazyBatchExecute(&config, callbacks, workers, workerCount, batch->runResults, &batch->result);
+    HAZY_TEST_ASSERT(result == 0);
+    HAZY_TEST_ASSERT(batch->result.runCount == TEST_RUN_COUNT);
+    HAZY_TEST_ASSERT(batch->result.failedRunCount == 0);
+
+    for (size_t i = 0; i < TEST_RUN_COUNT; ++i) {
+        const HazyBatchRunResult* runResult = &batch->runResults[i];
+        const TestRunState* state = &batch->runStates[i];
+        HAZY_TEST_ASSERT(runResult->seed == hazyBatchRunSeed(baseSeed, i));
+        HAZY_TEST_ASSERT(runResult->errorCode == 0);
+        // One packet per step. Some are duplicated, and some are still on their way when the run ends.
+        HAZY_TEST_ASSERT(runResult->out.writtenPacketCount == 5000 / 16 + 1);
+        HAZY_TEST_ASSERT(runResult->out.deliveredPacketCount == state->serverReceivedCount);
+        HAZY_TEST_ASSERT(runResult->out.deliveredPacketCount > runResult->out.writtenPacketCount / 2);
+        HAZY_TEST_ASSERT(runResult->out.droppedPacketCount < runResult->out.writtenPacketCount / 2);
+        HAZY_TEST_ASSERT(runResult->in.writtenPacketCount == state->serverReceivedCount);
+        HAZY_TEST_ASSERT(runResult->in.deliveredPacketCount == state->clientReceivedCount);
+    }
+
+    HAZY_TEST_ASSERT(batch->result.out.droppedPacketCount > 0);
+    HAZY_TEST_ASSERT(batch->result.out.lossRatio > 0.0 && batch->result.out.lossRatio < 0.2);
+}
+
+static bool isSame(const TestBatch* a, const TestBatch* b)
+{
+    return memcmp(a->runResults, b->runResults, sizeof(a->runResults)) == 0 &&
+           memcmp(a->runStates, b->runStates, sizeof(a->runStates)) == 0;
+}
+
+/// A run only depends on its seed, not on the worker it ran on or what that worker ran before
+static void testDeterministicAcrossWorkerCounts(const HazyScenario* scenario)
+{
+    static TestBatch single;
+    static TestBatch again;
+    static TestBatch three;
+    static TestBatch four;
+    static TestBatch otherSeed;
+
+    execute(&single, scenario, 1234, 1);
+    execute(&again, scenario, 1234, 1);
+    execute(&three, scenario, 1234, 3);
+    execute(&four, scenario, 1234, 4);
+    execute(&otherSeed, scenario, 4321, 4);
+
+    HAZY_TEST_ASSERT(isSame(&single, &again));
+    HAZY_TEST_ASSERT(isSame(&single, &three));
+    HAZY_TEST_ASSERT(isSame(&single, &four));
+    HAZY_TEST_ASSERT(!isSame(&single, &otherSeed));
+
+    // The runs differ from each other
+    HAZY_TEST_ASSERT(single.runStates[0].orderHash != single.runStates[1].orderHash);
+}
+
+int main(void)
+{
+    static ImprintDefaultSetup imprint;
+    imprintDefaultSetupInit(&imprint, 1024 * 1024);
+    Clog log = {"test", &g_clog};
+
+    testDeterministicAcrossWorkerCounts(0);
+
+    HazyScenario scenario;
+    int result = hazyScenarioInitFromString(&scenario, &imprint.tagAllocator.info,
+                                            "0 step preset=worst\n"
+                                            "2s linear latency.min=20 latency.max=40\n"
+                                            "3s step out.decider.drop=200\n",
+                                            log);
+    HAZY_TEST_ASSERT(result == 0);
+    testDeterministicAcrossWorkerCounts(&scenario);
+
+    return 0;
+}
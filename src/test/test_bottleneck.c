@@ -0,0 +1,111 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include "hazy_test.h"
+
+clog_config g_clog;
+
+#define TEST_PACKET_COUNT (2000)
+
+typedef struct TestRun {
+    uint32_t sequences[TEST_PACKET_COUNT];
+    size_t deliveredCount;
+    HazyDirectionStats stats;
+} TestRun;
+
+/// Offers 1000 octet packets every 5 ms, which is twice the rate of the bottleneck, for ten seconds
+static void runOverloaded(HazyTest* test, HazyBottleneckConfig bottleneck, TestRun* run)
+{
+    HazyConfig config = {hazyTestDirectionConfig(0), hazyTestDirectionConfig(0)};
+    config.out.bottleneck = bottleneck;
+    hazySetConfig(&test->hazy, config);
+    hazyReset(&test->hazy);
+    hazySetSeed(&test->hazy, 7);
+    memset(&test->hazy.out.stats, 0, sizeof(test->hazy.out.stats));
+
+    run->deliveredCount = 0;
+    for (MonotonicTimeMs now = 0; now < 20000; ++now) {
+        hazyUpdateAt(&test->hazy, now);
+        if (now % 5 == 0 && now < 10000) {
+            HAZY_TEST_ASSERT(hazyTestWrite(&test->hazy, (uint32_t) (now / 5), 1000, now) >= 0);
+        }
+        hazyTestReadSend(&test->hazy, run->sequences, &run->deliveredCount, TEST_PACKET_COUNT, now);
+    }
+
+    run->stats = test->hazy.out.stats;
+
+    // Everything written is accounted for, and the link is never faster than its rate
+    HAZY_TEST_ASSERT(run->stats.writtenPacketCount == TEST_PACKET_COUNT);
+    HAZY_TEST_ASSERT(run->deliveredCount == run->stats.deliveredPacketCount);
+    HAZY_TEST_ASSERT(run->deliveredCount + run->stats.droppedPacketCount == TEST_PACKET_COUNT);
+    HAZY_TEST_ASSERT(run->stats.droppedPacketCount > 0);
+
+    // The queue is a FIFO, so the packets that get through are in order
+    for (size_t i = 1; i < run->deliveredCount; ++i) {
+        HAZY_TEST_ASSERT(run->sequences[i - 1] < run->sequences[i]);
+    }
+}
+
+static void testTailDrop(HazyTest* test)
+{
+    static TestRun run;
+    runOverloaded(test, hazyBottleneckTailDrop(100000, 20000), &run);
+
+    // Only full queues drop, so about half of the packets get through, plus the queue that drains at the end
+    HAZY_TEST_ASSERT(run.stats.droppedPacketCountByCause[HazyTraceDropCauseTailDrop] == run.stats.droppedPacketCount);
+    HAZY_TEST_ASSERT(run.deliveredCount >= 1000 && run.deliveredCount <= 1000 + 21);
+
+    // The delay is the time it takes to drain a full queue
+    HAZY_TEST_ASSERT(run.stats.maxDeliveredDelayMs >= 190 && run.stats.maxDeliveredDelayMs <= 210);
+}
+
+static void testRed(HazyTest* test)
+{
+    static TestRun run;
+    runOverloaded(test, hazyBottleneckRed(100000, 20000), &run);
+
+    // Drops early, before the queue is full
+    HAZY_TEST_ASSERT(run.stats.droppedPacketCountByCause[HazyTraceDropCauseRedDrop] > 0);
+    HAZY_TEST_ASSERT(run.stats.droppedPacketCountByCause[HazyTraceDropCauseRedDrop] +
+                         run.stats.droppedPacketCountByCause[HazyTraceDropCauseTailDrop] ==
+                     run.stats.droppedPacketCount);
+    HAZY_TEST_ASSERT(run.deliveredCount >= 1000 && run.deliveredCount <= 1000 + 21);
+    HAZY_TEST_ASSERT(run.stats.maxDeliveredDelayMs <= 210);
+}
+
+static void testCoDel(HazyTest* test)
+{
+    static TestRun run;
+    runOverloaded(test, hazyBottleneckCoDel(100000, 0), &run);
+
+    // The queue is unlimited, so only CoDel drops, and it keeps the delay far below the five seconds the
+    // queue would grow to without it
+    HAZY_TEST_ASSERT(run.stats.droppedPacketCountByCause[HazyTraceDropCauseCoDelDrop] == run.stats.droppedPacketCount);
+    HAZY_TEST_ASSERT(run.deliveredCount >= 1000);
+    HAZY_TEST_ASSERT(run.stats.maxDeliveredDelayMs < 1000);
+}
+
+static void testDeterministic(HazyTest* test)
+{
+    static TestRun first;
+    static TestRun second;
+    runOverloaded(test, hazyBottleneckRed(100000, 20000), &first);
+    runOverloaded(test, hazyBottleneckRed(100000, 20000), &second);
+
+    HAZY_TEST_ASSERT(first.deliveredCount == second.deliveredCount);
+    HAZY_TEST_ASSERT(memcmp(first.sequences, second.sequences, first.deliveredCount * sizeof(uint32_t)) == 0);
+}
+
+int main(void)
+{
+    static HazyTest test;
+    hazyTestInit(&test, hazyConfigRecommended(), 1, &g_clog);
+
+    testTailDrop(&test);
+    testRed(&test);
+    testCoDel(&test);
+    testDeterministic(&test);
+
+    return 0;
+}
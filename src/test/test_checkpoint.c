@@ -0,0 +1,159 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include "hazy_test.h"
+#include <hazy/checkpoint.h>
+
+clog_config g_clog;
+
+#define TEST_CHECKPOINT_CAPACITY (64 * 1024)
+#define TEST_DELIVERY_CAPACITY (4096)
+
+/// The sequences that came out of each direction, in order
+typedef struct TestDeliveries {
+    uint32_t out[TEST_DELIVERY_CAPACITY];
+    size_t outCount;
+    uint32_t in[TEST_DELIVERY_CAPACITY];
+    size_t inCount;
+} TestDeliveries;
+
+/// Sends a packet every 10 ms through the out direction, and echoes what is delivered back through the in direction
+static void drive(Hazy* hazy, MonotonicTimeMs startMs, uint32_t packetCount, TestDeliveries* deliveries)
+{
+    memset(deliveries, 0, sizeof(*deliveries));
+
+    uint8_t data[HAZY_TEST_OCTET_CAPACITY];
+    MonotonicTimeMs now = startMs;
+    for (uint32_t i = 0; i < packetCount; ++i, now += 10) {
+        hazyUpdateAt(hazy, now);
+        HAZY_TEST_ASSERT(hazyTestWrite(hazy, i, 100 + i % 200, now) >= 0);
+
+        int octetCount;
+        while ((octetCount = hazyReadSendAt(hazy, data, sizeof(data), now)) > 0) {
+            HAZY_TEST_ASSERT(deliveries->outCount < TEST_DELIVERY_CAPACITY);
+            memcpy(&deliveries->out[deliveries->outCount++], data, sizeof(uint32_t));
+            HAZY_TEST_ASSERT(hazyFeedReadAt(hazy, data, (size_t) octetCount, now) >= 0);
+        }
+        while ((octetCount = hazyRead(hazy, data, sizeof(data))) > 0) {
+            HAZY_TEST_ASSERT(deliveries->inCount < TEST_DELIVERY_CAPACITY);
+            memcpy(&deliveries->in[deliveries->inCount++], data, sizeof(uint32_t));
+        }
+    }
+}
+
+static bool isSame(const TestDeliveries* a, const TestDeliveries* b)
+{
+    return a->outCount == b->outCount && a->inCount == b->inCount &&
+           memcmp(a->out, b->out, a->outCount * sizeof(uint32_t)) == 0 &&
+           memcmp(a->in, b->in, a->inCount * sizeof(uint32_t)) == 0;
+}
+
+/// A restored instance continues exactly like the original, whatever config it had before
+static void testRoundTrip(HazyTest* original, HazyTest* forks)
+{
+    hazySetConfig(&original->hazy, hazyConfigWorstCase());
+    hazyReset(&original->hazy);
+    hazySetSeed(&original->hazy, 99);
+
+    static TestDeliveries deliveries[3];
+    drive(&original->hazy, 1000, 500, &deliveries[0]);
+
+    // Packets are in flight, in both directions, when the checkpoint is taken
+    HAZY_TEST_ASSERT(hazyDirectionQueuedPacketCount(&original->hazy.out) > 0);
+    HAZY_TEST_ASSERT(hazyDirectionQueuedPacketCount(&original->hazy.in) > 0);
+
+    static uint8_t checkpoint[TEST_CHECKPOINT_CAPACITY];
+    size_t octetCount = hazyCheckpointOctetCount(&original->hazy);
+    HAZY_TEST_ASSERT(octetCount <= sizeof(checkpoint));
+    HAZY_TEST_ASSERT(hazyCheckpointWrite(&original->hazy, checkpoint, sizeof(checkpoint)) == (int) octetCount);
+
+    for (size_t i = 0; i < 2; ++i) {
+        HAZY_TEST_ASSERT(hazyCheckpointRestore(&forks[i].hazy, checkpoint, octetCount) == 0);
+        HAZY_TEST_ASSERT(hazyDirectionQueuedPacketCount(&forks[i].hazy.out) ==
+                         hazyDirectionQueuedPacketCount(&original->hazy.out));
+        HAZY_TEST_ASSERT(forks[i].hazy.out.reorder.heldCount == original->hazy.out.reorder.heldCount);
+    }
+
+    drive(&original->hazy, 6000, 2000, &deliveries[0]);
+    drive(&forks[0].hazy, 6000, 2000, &deliveries[1]);
+    drive(&forks[1].hazy, 6000, 2000, &deliveries[2]);
+
+    HAZY_TEST_ASSERT(deliveries[0].outCount > 1500);
+    HAZY_TEST_ASSERT(deliveries[0].inCount > 1000);
+    HAZY_TEST_ASSERT(isSame(&deliveries[0], &deliveries[1]));
+    HAZY_TEST_ASSERT(isSame(&deliveries[0], &deliveries[2]));
+
+    // Restoring into itself rewinds it
+    hazySetSeed(&original->hazy, 1);
+    HAZY_TEST_ASSERT(hazyCheckpointRestore(&original->hazy, checkpoint, octetCount) == 0);
+    drive(&original->hazy, 6000, 2000, &deliveries[1]);
+    HAZY_TEST_ASSERT(isSame(&deliveries[0], &deliveries[1]));
+}
+
+static void testIllegal(HazyTest* original, HazyTest* fork)
+{
+    hazySetConfig(&original->hazy, hazyConfigRecommended());
+    hazyReset(&original->hazy);
+    static TestDeliveries deliveries;
+    drive(&original->hazy, 1000, 100, &deliveries);
+
+    static uint8_t checkpoint[TEST_CHECKPOINT_CAPACITY];
+    size_t octetCount = hazyCheckpointOctetCount(&original->hazy);
+    HAZY_TEST_ASSERT(hazyCheckpointWrite(&original->hazy, checkpoint, 10) < 0);
+    HAZY_TEST_ASSERT(hazyCheckpointWrite(&original->hazy, checkpoint, sizeof(checkpoint)) == (int) octetCount);
+
+    HAZY_TEST_ASSERT(hazyCheckpointRestore(&fork->hazy, checkpoint, octetCount - 1) < 0);
+    HAZY_TEST_ASSERT(hazyDirectionQueuedPacketCount(&fork->hazy.out) == 0);
+    HAZY_TEST_ASSERT(hazyCheckpointRestore(&fork->hazy, checkpoint, octetCount + 1) < 0);
+
+    checkpoint[0] ^= 0xff;
+    HAZY_TEST_ASSERT(hazyCheckpointRestore(&fork->hazy, checkpoint, octetCount) < 0);
+    checkpoint[0] ^= 0xff;
+    HAZY_TEST_ASSERT(hazyCheckpointRestore(&fork->hazy, checkpoint, octetCount) == 0);
+}
+
+/// The scenario is not in the checkpoint, so its position must fit the scenario of the instance it is restored into
+static void testScenarioPosition(HazyTest* original, HazyTest* fork)
+{
+    HazyScenario scenario;
+    int result = hazyScenarioInitFromString(&scenario, &original->imprint.tagAllocator.info,
+                                            "0 step preset=good\n"
+                                            "1s step preset=recommended\n"
+                                            "2s step preset=worst\n",
+                                            original->log);
+    HAZY_TEST_ASSERT(result == 0);
+
+    hazyReset(&original->hazy);
+    hazySetScenario(&original->hazy, &scenario);
+    static TestDeliveries deliveries;
+    drive(&original->hazy, 1000, 300, &deliveries);
+    HAZY_TEST_ASSERT(original->hazy.scenarioPlayer.nextKeyframeIndex == 3);
+
+    static uint8_t checkpoint[TEST_CHECKPOINT_CAPACITY];
+    int octetCount = hazyCheckpointWrite(&original->hazy, checkpoint, sizeof(checkpoint));
+    HAZY_TEST_ASSERT(octetCount > 0);
+
+    hazySetScenario(&fork->hazy, 0);
+    HAZY_TEST_ASSERT(hazyCheckpointRestore(&fork->hazy, checkpoint, (size_t) octetCount) < 0);
+    hazySetScenario(&fork->hazy, &scenario);
+    HAZY_TEST_ASSERT(hazyCheckpointRestore(&fork->hazy, checkpoint, (size_t) octetCount) == 0);
+
+    hazySetScenario(&original->hazy, 0);
+    hazySetScenario(&fork->hazy, 0);
+}
+
+int main(void)
+{
+    static HazyTest original;
+    static HazyTest forks[2];
+    hazyTestInit(&original, hazyConfigWorstCase(), 1, &g_clog);
+    hazyTestInit(&forks[0], hazyConfigGoodCondition(), 2, &g_clog);
+    hazyTestInit(&forks[1], hazyConfigRecommended(), 3, &g_clog);
+
+    testRoundTrip(&original, forks);
+    testIllegal(&original, &forks[0]);
+    testScenarioPosition(&original, &forks[1]);
+
+    return 0;
+}
@@ -0,0 +1,117 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include "hazy_test.h"
+#include <hazy/pipeline.h>
+
+clog_config g_clog;
+
+#define TEST_PACKET_COUNT (500)
+
+typedef struct TestDelivery {
+    uint32_t sequence;
+    MonotonicTimeMs delayMs;
+} TestDelivery;
+
+/// Writes a packet every 4 ms, and updates and reads every `updateIntervalMs`
+static size_t run(HazyPipeline* pipeline, MonotonicTimeMs updateIntervalMs, TestDelivery* deliveries)
+{
+    size_t count = 0;
+    uint32_t sequence = 0;
+    for (MonotonicTimeMs now = 1000; now < 1000 + TEST_PACKET_COUNT * 4 + 500; ++now) {
+        if (now % 4 == 0 && sequence < TEST_PACKET_COUNT) {
+            uint8_t data[64];
+            memset(data, 0, sizeof(data));
+            memcpy(data, &sequence, sizeof(sequence));
+            memcpy(data + sizeof(sequence), &now, sizeof(now));
+            HAZY_TEST_ASSERT(hazyPipelineWriteAt(pipeline, data, sizeof(data), now) >= 0);
+            sequence++;
+        }
+        if (now % updateIntervalMs != 0) {
+            continue;
+        }
+        hazyPipelineUpdate(pipeline, now);
+        uint8_t data[HAZY_TEST_OCTET_CAPACITY];
+        while (hazyPipelineReadAt(pipeline, data, sizeof(data), now) > 0) {
+            HAZY_TEST_ASSERT(count < TEST_PACKET_COUNT);
+            MonotonicTimeMs writtenAtMs;
+            memcpy(&deliveries[count].sequence, data, sizeof(uint32_t));
+            memcpy(&writtenAtMs, data + sizeof(uint32_t), sizeof(writtenAtMs));
+            deliveries[count].delayMs = now - writtenAtMs;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+/// The latencies of the stages add up, also when the pipeline is updated less often than the packets are due
+static void testHandOver(HazyTest* test)
+{
+    HazyDirectionConfig configs[3] = {hazyTestDirectionConfig(20), hazyTestDirectionConfig(40),
+                                      hazyTestDirectionConfig(60)};
+    static HazyPipeline pipeline;
+    HAZY_TEST_ASSERT(hazyPipelineInit(&pipeline, &test->imprint.slabAllocator.info, configs, 3, test->log) == 0);
+    hazyPipelineSetSeed(&pipeline, 5);
+
+    static TestDelivery deliveries[TEST_PACKET_COUNT];
+    HAZY_TEST_ASSERT(run(&pipeline, 1, deliveries) == TEST_PACKET_COUNT);
+    for (size_t i = 0; i < TEST_PACKET_COUNT; ++i) {
+        HAZY_TEST_ASSERT(deliveries[i].sequence == i);
+        HAZY_TEST_ASSERT(deliveries[i].delayMs == 10 + 20 + 30);
+    }
+
+    // A stage is entered when the packet was due in the previous one, so a slow update only delays the read
+    hazyPipelineReset(&pipeline);
+    HAZY_TEST_ASSERT(run(&pipeline, 7, deliveries) == TEST_PACKET_COUNT);
+    for (size_t i = 0; i < TEST_PACKET_COUNT; ++i) {
+        HAZY_TEST_ASSERT(deliveries[i].sequence == i);
+        HAZY_TEST_ASSERT(deliveries[i].delayMs >= 60 && deliveries[i].delayMs < 60 + 7);
+    }
+}
+
+/// A packet dropped in one stage never reaches the next
+static void testDropInMiddleStage(HazyTest* test)
+{
+    HazyDirectionConfig configs[3] = {hazyTestDirectionConfig(20), hazyTestDirectionConfig(20),
+                                      hazyTestDirectionConfig(20)};
+    configs[1].decider.originalChance = 4;
+    configs[1].decider.dropChance = 1;
+    static HazyPipeline pipeline;
+    HAZY_TEST_ASSERT(hazyPipelineInit(&pipeline, &test->imprint.slabAllocator.info, configs, 3, test->log) == 0);
+    hazyPipelineSetSeed(&pipeline, 9);
+
+    static TestDelivery deliveries[TEST_PACKET_COUNT];
+    size_t count = run(&pipeline, 1, deliveries);
+
+    const HazyDirectionStats* first = &pipeline.stages[0].stats;
+    const HazyDirectionStats* middle = &pipeline.stages[1].stats;
+    const HazyDirectionStats* last = &pipeline.stages[2].stats;
+    HAZY_TEST_ASSERT(first->writtenPacketCount == TEST_PACKET_COUNT);
+    HAZY_TEST_ASSERT(first->droppedPacketCount == 0);
+    HAZY_TEST_ASSERT(middle->writtenPacketCount == first->deliveredPacketCount);
+    HAZY_TEST_ASSERT(middle->droppedPacketCount > 50 && middle->droppedPacketCount < 150);
+    HAZY_TEST_ASSERT(last->writtenPacketCount == middle->deliveredPacketCount);
+    HAZY_TEST_ASSERT(last->droppedPacketCount == 0);
+    HAZY_TEST_ASSERT(count == last->deliveredPacketCount);
+    HAZY_TEST_ASSERT(count + middle->droppedPacketCount == TEST_PACKET_COUNT);
+
+    for (size_t i = 1; i < count; ++i) {
+        HAZY_TEST_ASSERT(deliveries[i - 1].sequence < deliveries[i].sequence);
+        HAZY_TEST_ASSERT(deliveries[i].delayMs == 30);
+    }
+
+    hazyPipelineReset(&pipeline);
+}
+
+int main(void)
+{
+    static HazyTest test;
+    hazyTestInit(&test, hazyConfigRecommended(), 1, &g_clog);
+
+    testHandOver(&test);
+    testDropInMiddleStage(&test);
+
+    return 0;
+}
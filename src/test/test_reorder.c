@@ -0,0 +1,109 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include "hazy_test.h"
+
+clog_config g_clog;
+
+#define TEST_PACKET_COUNT (1000)
+
+static void setConfig(HazyTest* test, HazyDeciderConfig decider, HazyReorderConfig reorder)
+{
+    HazyConfig config = {hazyTestDirectionConfig(0), hazyTestDirectionConfig(0)};
+    config.out.decider = decider;
+    config.out.reorder = reorder;
+    hazySetConfig(&test->hazy, config);
+    hazyReset(&test->hazy);
+    hazySetSeed(&test->hazy, 3);
+    memset(&test->hazy.out.stats, 0, sizeof(test->hazy.out.stats));
+}
+
+/// A held back packet is sent after the number of later packets in the configured depth
+static void testDepth(HazyTest* test)
+{
+    HazyDeciderConfig decider = {20, 0, 1, 0, 0};
+    HazyReorderConfig reorder = {3, 3, 10000};
+    setConfig(test, decider, reorder);
+
+    static uint32_t sequences[TEST_PACKET_COUNT];
+    size_t count = 0;
+    for (MonotonicTimeMs now = 0; now < TEST_PACKET_COUNT * 10; ++now) {
+        hazyUpdateAt(&test->hazy, now);
+        if (now % 10 == 0) {
+            HAZY_TEST_ASSERT(hazyTestWrite(&test->hazy, (uint32_t) (now / 10), 100, now) >= 0);
+        }
+        hazyTestReadSend(&test->hazy, sequences, &count, TEST_PACKET_COUNT, now);
+    }
+
+    // Nothing is dropped, the held back packets are only late. The last ones are never overtaken.
+    HAZY_TEST_ASSERT(test->hazy.out.stats.droppedPacketCount == 0);
+    HAZY_TEST_ASSERT(count + test->hazy.out.reorder.heldCount == TEST_PACKET_COUNT);
+
+    static bool isDelivered[TEST_PACKET_COUNT];
+    size_t lateCount = 0;
+    size_t exactDepthCount = 0;
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t sequence = sequences[i];
+        HAZY_TEST_ASSERT(sequence < TEST_PACKET_COUNT && !isDelivered[sequence]);
+        isDelivered[sequence] = true;
+
+        size_t overtakenBy = 0;
+        for (size_t j = 0; j < i; ++j) {
+            if (sequences[j] > sequence) {
+                overtakenBy++;
+            }
+        }
+        if (overtakenBy == 0) {
+            continue;
+        }
+        lateCount++;
+        // Two held back packets can not be released at the same sequence, the later one is overtaken by more
+        HAZY_TEST_ASSERT(overtakenBy >= 3 && overtakenBy < HAZY_REORDER_SLOT_COUNT);
+        if (overtakenBy == 3) {
+            exactDepthCount++;
+        }
+    }
+
+    // About one in 21 packets
+    HAZY_TEST_ASSERT(lateCount > 25 && lateCount < 75);
+    HAZY_TEST_ASSERT(exactDepthCount * 5 >= lateCount * 4);
+}
+
+/// A held back packet that is not overtaken is sent when it has been held for maxHoldMs
+static void testMaxHold(HazyTest* test)
+{
+    HazyDeciderConfig decider = {0, 0, 1, 0, 0};
+    HazyReorderConfig reorder = {3, 3, 100};
+    setConfig(test, decider, reorder);
+
+    uint32_t sequences[4];
+    size_t count = 0;
+    MonotonicTimeMs deliveredAtMs = 0;
+    for (MonotonicTimeMs now = 1000; now < 1300; ++now) {
+        hazyUpdateAt(&test->hazy, now);
+        if (now == 1000) {
+            HAZY_TEST_ASSERT(hazyTestWrite(&test->hazy, 77, 100, now) >= 0);
+        }
+        size_t previousCount = count;
+        hazyTestReadSend(&test->hazy, sequences, &count, 4, now);
+        if (count != previousCount) {
+            deliveredAtMs = now;
+        }
+    }
+
+    HAZY_TEST_ASSERT(count == 1);
+    HAZY_TEST_ASSERT(sequences[0] == 77);
+    HAZY_TEST_ASSERT(deliveredAtMs == 1100);
+}
+
+int main(void)
+{
+    static HazyTest test;
+    hazyTestInit(&test, hazyConfigRecommended(), 1, &g_clog);
+
+    testDepth(&test);
+    testMaxHold(&test);
+
+    return 0;
+}
@@ -0,0 +1,130 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include "hazy_test.h"
+
+clog_config g_clog;
+
+/// Writes a packet every 10 ms from `startMs` to `endMs`, and sends them when they are due
+static void run(HazyTest* test, MonotonicTimeMs startMs, MonotonicTimeMs endMs)
+{
+    static uint32_t sequences[512];
+    for (MonotonicTimeMs now = startMs; now < endMs; ++now) {
+        hazyUpdateAt(&test->hazy, now);
+        if (now % 10 == 0) {
+            HAZY_TEST_ASSERT(hazyTestWrite(&test->hazy, 0, 80, now) >= 0);
+        }
+        size_t count = 0;
+        hazyTestReadSend(&test->hazy, sequences, &count, 512, now);
+    }
+}
+
+static size_t readSamples(HazySampler* sampler, HazySample* samples, size_t capacity)
+{
+    FILE* fp = tmpfile();
+    HAZY_TEST_ASSERT(fp != 0);
+    size_t dumpedCount = hazySamplerDumpBinary(sampler, fp);
+    rewind(fp);
+    size_t readCount = fread(samples, sizeof(HazySample), capacity, fp);
+    fclose(fp);
+    HAZY_TEST_ASSERT(readCount == dumpedCount);
+
+    return readCount;
+}
+
+/// The ring keeps the latest samples, and each sample has the counts since the previous one
+static void testRing(HazyTest* test)
+{
+    HazySampler sampler;
+    HAZY_TEST_ASSERT(hazySamplerInit(&sampler, &test->imprint.tagAllocator.info, 8, 100) == 0);
+
+    HazyConfig config = {hazyTestDirectionConfig(40), hazyTestDirectionConfig(40)};
+    hazySetConfig(&test->hazy, config);
+    hazyReset(&test->hazy);
+    hazySetSampler(&test->hazy, &sampler);
+
+    run(test, 1000, 3000);
+
+    HazySample samples[8];
+    HAZY_TEST_ASSERT(readSamples(&sampler, samples, 8) == 8);
+    HAZY_TEST_ASSERT(sampler.lostSampleCount == 12);
+    for (size_t i = 0; i < 8; ++i) {
+        const HazySample* sample = &samples[i];
+        HAZY_TEST_ASSERT(sample->timeMs == 2200 + (MonotonicTimeMs) i * 100);
+        HAZY_TEST_ASSERT(sample->elapsedMs == 100);
+        HAZY_TEST_ASSERT(sample->out.writtenPacketCount == 10);
+        HAZY_TEST_ASSERT(sample->out.deliveredPacketCount == 10);
+        HAZY_TEST_ASSERT(sample->out.deliveredOctetCount == 800);
+        HAZY_TEST_ASSERT(sample->out.droppedPacketCount == 0);
+        // Two packets are on their way, for half of the round trip latency
+        HAZY_TEST_ASSERT(sample->out.queuedPacketCount == 2);
+        HAZY_TEST_ASSERT(sample->out.latencyMs == 20);
+        HAZY_TEST_ASSERT(sample->out.latencyPhase == HazyLatencyPhaseNormal);
+        HAZY_TEST_ASSERT(sample->in.writtenPacketCount == 0);
+    }
+
+    // Nothing new to dump
+    HAZY_TEST_ASSERT(readSamples(&sampler, samples, 8) == 0);
+
+    // Updates that are far apart take a sample with the counts for the whole gap
+    hazyUpdateAt(&test->hazy, 3000);
+    for (MonotonicTimeMs now = 3000; now < 4000; now += 10) {
+        HAZY_TEST_ASSERT(hazyTestWrite(&test->hazy, 0, 80, now) >= 0);
+    }
+    hazyUpdateAt(&test->hazy, 4000);
+    HAZY_TEST_ASSERT(readSamples(&sampler, samples, 8) == 2);
+    HAZY_TEST_ASSERT(samples[1].timeMs == 4000);
+    HAZY_TEST_ASSERT(samples[1].elapsedMs == 1000);
+    HAZY_TEST_ASSERT(samples[1].out.writtenPacketCount == 100);
+
+    hazySetSampler(&test->hazy, 0);
+}
+
+static size_t countLines(FILE* fp)
+{
+    rewind(fp);
+    size_t lineCount = 0;
+    int c;
+    while ((c = fgetc(fp)) != EOF) {
+        if (c == '\n') {
+            lineCount++;
+        }
+    }
+
+    return lineCount;
+}
+
+static void testCsv(HazyTest* test)
+{
+    HazySampler sampler;
+    HAZY_TEST_ASSERT(hazySamplerInit(&sampler, &test->imprint.tagAllocator.info, 64, 50) == 0);
+
+    hazyReset(&test->hazy);
+    hazySetSampler(&test->hazy, &sampler);
+
+    FILE* fp = tmpfile();
+    HAZY_TEST_ASSERT(fp != 0);
+
+    run(test, 10000, 10500);
+    HAZY_TEST_ASSERT(hazySamplerDumpCsv(&sampler, fp) == 10);
+    run(test, 10500, 11000);
+    HAZY_TEST_ASSERT(hazySamplerDumpCsv(&sampler, fp) == 10);
+
+    // The header is only written once
+    HAZY_TEST_ASSERT(countLines(fp) == 21);
+    fclose(fp);
+
+    hazySetSampler(&test->hazy, 0);
+}
+
+int main(void)
+{
+    static HazyTest test;
+    hazyTestInit(&test, hazyConfigRecommended(), 1, &g_clog);
+
+    testRing(&test);
+    testCsv(&test);
+
+    return 0;
+}
@@ -0,0 +1,155 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include "hazy_test.h"
+
+clog_config g_clog;
+
+static void testParse(HazyTest* test)
+{
+    HazyScenario scenario;
+    int result = hazyScenarioInitFromString(&scenario, &test->imprint.tagAllocator.info,
+                                            "# handover between two access points\n"
+                                            "0 step preset=recommended\n"
+                                            "\n"
+                                            "30s linear in.latency.min=60 latency.max=200 # comment\n"
+                                            "45000ms step decider.original=0 decider.drop=1\n",
+                                            test->log);
+    HAZY_TEST_ASSERT(result == 0);
+    HAZY_TEST_ASSERT(scenario.keyframeCount == 3);
+
+    const HazyScenarioKeyframe* keyframes = scenario.keyframes;
+    HAZY_TEST_ASSERT(keyframes[0].timeMs == 0);
+    HAZY_TEST_ASSERT(keyframes[0].transition == HazyScenarioTransitionStep);
+    HAZY_TEST_ASSERT(keyframes[0].in.latency.minLatency == hazyDirectionConfigRecommended().latency.minLatency);
+
+    HAZY_TEST_ASSERT(keyframes[1].timeMs == 30000);
+    HAZY_TEST_ASSERT(keyframes[1].transition == HazyScenarioTransitionLinear);
+    HAZY_TEST_ASSERT(keyframes[1].in.latency.minLatency == 60);
+    HAZY_TEST_ASSERT(keyframes[1].out.latency.minLatency == keyframes[0].out.latency.minLatency);
+    HAZY_TEST_ASSERT(keyframes[1].in.latency.maxLatency == 200);
+    HAZY_TEST_ASSERT(keyframes[1].out.latency.maxLatency == 200);
+
+    // Each keyframe starts out from the previous one
+    HAZY_TEST_ASSERT(keyframes[2].timeMs == 45000);
+    HAZY_TEST_ASSERT(keyframes[2].in.latency.minLatency == 60);
+    HAZY_TEST_ASSERT(keyframes[2].in.decider.originalChance == 0);
+    HAZY_TEST_ASSERT(keyframes[2].out.decider.dropChance == 1);
+}
+
+static void testIllegal(HazyTest* test)
+{
+    const char* illegal[] = {
+        "0 step foo=1\n",
+        "0 jump decider.drop=1\n",
+        "10s step decider.drop=1\n5s step decider.drop=2\n",
+        "0 step decider.drop=-1\n",
+        "0 step preset=unknown\n",
+        "soon step decider.drop=1\n",
+    };
+
+    for (size_t i = 0; i < sizeof(illegal) / sizeof(illegal[0]); ++i) {
+        HazyScenario scenario;
+        int result = hazyScenarioInitFromString(&scenario, &test->imprint.tagAllocator.info, illegal[i], test->log);
+        HAZY_TEST_ASSERT(result < 0);
+        HAZY_TEST_ASSERT(scenario.keyframeCount == 0);
+    }
+}
+
+static void testInterpolation(HazyTest* test)
+{
+    HazyScenario scenario;
+    int result = hazyScenarioInitFromString(&scenario, &test->imprint.tagAllocator.info,
+                                            "0 step latency.min=0 latency.max=100\n"
+                                            "10s linear latency.min=100 latency.max=300\n"
+                                            "20s step latency.min=10\n",
+                                            test->log);
+    HAZY_TEST_ASSERT(result == 0);
+
+    HazyScenarioPlayer player;
+    hazyScenarioPlayerInit(&player, &scenario);
+
+    HazyDirectionConfig in;
+    HazyDirectionConfig out;
+
+    // The scenario starts at the first update
+    HAZY_TEST_ASSERT(hazyScenarioPlayerUpdate(&player, 5000, &in, &out));
+    HAZY_TEST_ASSERT(in.latency.minLatency == 0);
+
+    HAZY_TEST_ASSERT(hazyScenarioPlayerUpdate(&player, 10000, &in, &out));
+    HAZY_TEST_ASSERT(in.latency.minLatency == 50);
+    HAZY_TEST_ASSERT(in.latency.maxLatency == 200);
+    HAZY_TEST_ASSERT(out.latency.maxLatency == 200);
+
+    HAZY_TEST_ASSERT(hazyScenarioPlayerUpdate(&player, 15000, &in, &out));
+    HAZY_TEST_ASSERT(in.latency.minLatency == 100);
+    HAZY_TEST_ASSERT(in.latency.maxLatency == 300);
+
+    // A step keyframe is applied once, when it is reached
+    HAZY_TEST_ASSERT(!hazyScenarioPlayerUpdate(&player, 20000, &in, &out));
+    HAZY_TEST_ASSERT(hazyScenarioPlayerUpdate(&player, 25000, &in, &out));
+    HAZY_TEST_ASSERT(in.latency.minLatency == 10);
+    HAZY_TEST_ASSERT(in.latency.maxLatency == 300);
+    HAZY_TEST_ASSERT(!hazyScenarioPlayerUpdate(&player, 26000, &in, &out));
+}
+
+/// Runs a scenario that drops everything for one second, and checks which packets got through
+static void testDeliveredOnVirtualClock(HazyTest* test)
+{
+    HazyScenario scenario;
+    int result = hazyScenarioInitFromString(&scenario, &test->imprint.tagAllocator.info,
+                                            "0 step preset=good decider.drop=0 decider.outOfOrder=0 "
+                                            "decider.duplicate=0 decider.tamper=0 latency.min=40 latency.max=40 "
+                                            "latency.jitter=0 burst.duration=0\n"
+                                            "1s step decider.original=0 decider.drop=1\n"
+                                            "2s step decider.original=1 decider.drop=0\n",
+                                            test->log);
+    HAZY_TEST_ASSERT(result == 0);
+
+    HazyConfig config = {hazyTestDirectionConfig(40), hazyTestDirectionConfig(40)};
+    hazySetConfig(&test->hazy, config);
+    hazyReset(&test->hazy);
+    hazySetSeed(&test->hazy, 42);
+    hazySetScenario(&test->hazy, &scenario);
+
+    static uint32_t sequences[400];
+    size_t count = 0;
+    uint32_t written = 0;
+    for (MonotonicTimeMs now = 1000; now < 4100; ++now) {
+        hazyUpdateAt(&test->hazy, now);
+        if (now % 10 == 0 && now < 4000) {
+            HAZY_TEST_ASSERT(hazyTestWrite(&test->hazy, written, 100, now) >= 0);
+            written++;
+        }
+        hazyTestReadSend(&test->hazy, sequences, &count, 400, now);
+    }
+
+    // 100 packets per second, and the second one in the middle was dropped
+    HAZY_TEST_ASSERT(written == 300);
+    HAZY_TEST_ASSERT(count == 200);
+    HAZY_TEST_ASSERT(test->hazy.out.stats.droppedPacketCount == 100);
+    HAZY_TEST_ASSERT(test->hazy.out.stats.droppedPacketCountByCause[HazyTraceDropCauseDecision] == 100);
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t expected = i < 100 ? (uint32_t) i : (uint32_t) i + 100;
+        HAZY_TEST_ASSERT(sequences[i] == expected);
+    }
+
+    // Half of the round trip latency
+    HAZY_TEST_ASSERT(test->hazy.out.stats.maxDeliveredDelayMs == 20);
+
+    hazySetScenario(&test->hazy, 0);
+}
+
+int main(void)
+{
+    static HazyTest test;
+    hazyTestInit(&test, hazyConfigRecommended(), 1, &g_clog);
+
+    testParse(&test);
+    testIllegal(&test);
+    testInterpolation(&test);
+    testDeliveredOnVirtualClock(&test);
+
+    return 0;
+}
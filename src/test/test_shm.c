@@ -0,0 +1,125 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#if !defined _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L // getpid() in C99
+#endif
+
+#include "hazy_test.h"
+#include <hazy/shm.h>
+#include <unistd.h>
+
+clog_config g_clog;
+
+#define TEST_SLOT_COUNT (64)
+
+static void sendSequences(HazyShm* shm, uint32_t firstSequence, uint32_t count)
+{
+    uint8_t data[100];
+    memset(data, 0x5a, sizeof(data));
+    for (uint32_t sequence = firstSequence; sequence < firstSequence + count; ++sequence) {
+        memcpy(data, &sequence, sizeof(sequence));
+        HAZY_TEST_ASSERT(datagramTransportSend(&shm->transport, data, sizeof(data)) == 0);
+    }
+}
+
+static size_t receiveSequences(HazyShm* shm, uint32_t* sequences, size_t capacity)
+{
+    size_t count = 0;
+    uint8_t data[HAZY_TEST_OCTET_CAPACITY];
+    ssize_t octetCount;
+    while ((octetCount = datagramTransportReceive(&shm->transport, data, sizeof(data))) > 0) {
+        HAZY_TEST_ASSERT(octetCount == 100);
+        HAZY_TEST_ASSERT(data[99] == 0x5a);
+        HAZY_TEST_ASSERT(count < capacity);
+        memcpy(&sequences[count++], data, sizeof(uint32_t));
+    }
+    HAZY_TEST_ASSERT(octetCount == 0);
+
+    return count;
+}
+
+/// Both ends in the same process. The impairment is picked so it does not depend on the wall clock.
+static void testRing(HazyTest* test, const char* name)
+{
+    HazyDirectionConfig passthrough = hazyTestDirectionConfig(0);
+    static HazyShm server;
+    static HazyShm client;
+
+    HAZY_TEST_ASSERT(hazyShmOpen(&client, name, &test->imprint.slabAllocator.info, passthrough, test->log) == -3);
+    HAZY_TEST_ASSERT(hazyShmCreate(&server, name, 48, 1200, &test->imprint.slabAllocator.info, passthrough,
+                                   test->log) == -2);
+    HAZY_TEST_ASSERT(hazyShmCreate(&server, name, TEST_SLOT_COUNT, 1200, &test->imprint.slabAllocator.info,
+                                   passthrough, test->log) == 0);
+    HAZY_TEST_ASSERT(hazyShmOpen(&client, name, &test->imprint.slabAllocator.info, passthrough, test->log) == 0);
+
+    // Too large for a slot
+    uint8_t large[1201];
+    memset(large, 0, sizeof(large));
+    HAZY_TEST_ASSERT(datagramTransportSend(&client.transport, large, sizeof(large)) < 0);
+
+    // A full ring drops the newest datagrams, like a full socket receive buffer
+    static uint32_t sequences[4 * TEST_SLOT_COUNT];
+    sendSequences(&client, 0, TEST_SLOT_COUNT + 10);
+    HAZY_TEST_ASSERT(client.ringFullDropCount == 10);
+    HAZY_TEST_ASSERT(client.sendDirection.stats.droppedPacketCountByCause[HazyTraceDropCauseReceiveBuffer] == 10);
+    HAZY_TEST_ASSERT(receiveSequences(&server, sequences, 4 * TEST_SLOT_COUNT) == TEST_SLOT_COUNT);
+    for (uint32_t i = 0; i < TEST_SLOT_COUNT; ++i) {
+        HAZY_TEST_ASSERT(sequences[i] == i);
+    }
+
+    // The ring wraps around
+    for (uint32_t round = 0; round < 10; ++round) {
+        sendSequences(&client, round * 40, 40);
+        HAZY_TEST_ASSERT(receiveSequences(&server, sequences, 4 * TEST_SLOT_COUNT) == 40);
+        HAZY_TEST_ASSERT(sequences[0] == round * 40 && sequences[39] == round * 40 + 39);
+    }
+
+    // The other way, with drops decided by the seeded direction of the server
+    HazyDirectionConfig lossy = hazyTestDirectionConfig(0);
+    lossy.decider.originalChance = 3;
+    lossy.decider.dropChance = 1;
+    hazyDirectionSetConfig(&server.sendDirection, lossy);
+    hazyDirectionSetSeed(&server.sendDirection, 17);
+    size_t receivedCount = 0;
+    for (uint32_t round = 0; round < 4; ++round) {
+        sendSequences(&server, round * 50, 50);
+        receivedCount += receiveSequences(&client, sequences + receivedCount, 4 * TEST_SLOT_COUNT - receivedCount);
+    }
+    const HazyDirectionStats* stats = &server.sendDirection.stats;
+    HAZY_TEST_ASSERT(stats->writtenPacketCount == 200);
+    HAZY_TEST_ASSERT(stats->deliveredPacketCount == receivedCount);
+    HAZY_TEST_ASSERT(stats->droppedPacketCount + receivedCount == 200);
+    HAZY_TEST_ASSERT(stats->droppedPacketCount > 25 && stats->droppedPacketCount < 75);
+    for (size_t i = 1; i < receivedCount; ++i) {
+        HAZY_TEST_ASSERT(sequences[i - 1] < sequences[i]);
+    }
+
+    // Delayed datagrams stay in the direction until they are due
+    HazyDirectionConfig delayed = hazyTestDirectionConfig(100);
+    hazyDirectionSetConfig(&client.sendDirection, delayed);
+    sendSequences(&client, 1000, 20);
+    HAZY_TEST_ASSERT(receiveSequences(&server, sequences, 4 * TEST_SLOT_COUNT) == 0);
+    hazyShmUpdate(&client, monotonicTimeMsNow() + 1000);
+    HAZY_TEST_ASSERT(receiveSequences(&server, sequences, 4 * TEST_SLOT_COUNT) == 20);
+    HAZY_TEST_ASSERT(sequences[0] == 1000 && sequences[19] == 1019);
+
+    hazyShmClose(&client);
+    hazyShmClose(&server);
+
+    // The creator removes the segment
+    HAZY_TEST_ASSERT(hazyShmOpen(&client, name, &test->imprint.slabAllocator.info, passthrough, test->log) == -3);
+}
+
+int main(void)
+{
+    static HazyTest test;
+    hazyTestInit(&test, hazyConfigRecommended(), 1, &g_clog);
+
+    char name[32];
+    snprintf(name, sizeof(name), "/hazy-test-%ld", (long) getpid());
+    testRing(&test, name);
+
+    return 0;
+}
@@ -0,0 +1,156 @@
+/*---------------------------------------------------------------------------------------------
+ *  Copyright (c) Peter Bjorklund. All rights reserved.
+ *  Licensed under the MIT License. See LICENSE in the project root for license information.
+ *--------------------------------------------------------------------------------------------*/
+#include "hazy_test.h"
+
+clog_config g_clog;
+
+#define TEST_EVENT_CAPACITY (4096)
+
+typedef struct TestEvents {
+    HazyTraceEvent events[TEST_EVENT_CAPACITY];
+    size_t count;
+    size_t callCount;
+} TestEvents;
+
+static void collect(void* userData, const HazyTraceEvent* events, size_t eventCount)
+{
+    TestEvents* self = userData;
+    HAZY_TEST_ASSERT(self->count + eventCount <= TEST_EVENT_CAPACITY);
+    memcpy(&self->events[self->count], events, eventCount * sizeof(HazyTraceEvent));
+    self->count += eventCount;
+    self->callCount++;
+}
+
+static void addEvent(HazyTrace* trace, uint32_t sequence)
+{
+    HazyTraceEvent event;
+    memset(&event, 0, sizeof(event));
+    event.sequence = sequence;
+    hazyTraceAdd(trace, &event);
+}
+
+/// The ring keeps the oldest events when it is full, and is drained in order across the wrap
+static void testRing(HazyTest* test)
+{
+    HazyTrace trace;
+    HAZY_TEST_ASSERT(hazyTraceInit(&trace, &test->imprint.tagAllocator.info, 100) < 0);
+    HAZY_TEST_ASSERT(hazyTraceInit(&trace, &test->imprint.tagAllocator.info, 8) == 0);
+
+    for (uint32_t i = 0; i < 10; ++i) {
+        addEvent(&trace, i);
+    }
+    HAZY_TEST_ASSERT(trace.lostEventCount == 2);
+
+    static TestEvents drained;
+    drained.count = 0;
+    HAZY_TEST_ASSERT(hazyTraceDrain(&trace, collect, &drained) == 8);
+    HAZY_TEST_ASSERT(drained.count == 8);
+    for (uint32_t i = 0; i < 8; ++i) {
+        HAZY_TEST_ASSERT(drained.events[i].sequence == i);
+    }
+
+    for (uint32_t i = 100; i < 105; ++i) {
+        addEvent(&trace, i);
+    }
+    HAZY_TEST_ASSERT(hazyTraceDrain(&trace, collect, &drained) == 5);
+
+    // Starts in the middle of the ring, so the drain is split in two calls at the wrap
+    for (uint32_t i = 200; i < 206; ++i) {
+        addEvent(&trace, i);
+    }
+    size_t callCount = drained.callCount;
+    HAZY_TEST_ASSERT(hazyTraceDrain(&trace, collect, &drained) == 6);
+    HAZY_TEST_ASSERT(drained.callCount == callCount + 2);
+    HAZY_TEST_ASSERT(hazyTraceDrain(&trace, collect, &drained) == 0);
+    HAZY_TEST_ASSERT(drained.count == 19);
+    for (uint32_t i = 0; i < 6; ++i) {
+        HAZY_TEST_ASSERT(drained.events[13 + i].sequence == 200 + i);
+    }
+    HAZY_TEST_ASSERT(trace.lostEventCount == 2);
+}
+
+/// Every packet gets a decision event, and then either a deliver or a drop event
+static void testPacketEvents(HazyTest* test)
+{
+    HazyTrace trace;
+    HAZY_TEST_ASSERT(hazyTraceInit(&trace, &test->imprint.tagAllocator.info, TEST_EVENT_CAPACITY) == 0);
+
+    HazyConfig config = {hazyTestDirectionConfig(20), hazyTestDirectionConfig(20)};
+    config.out.decider.originalChance = 3;
+    config.out.decider.dropChance = 1;
+    hazySetConfig(&test->hazy, config);
+    hazyReset(&test->hazy);
+    hazySetSeed(&test->hazy, 11);
+    memset(&test->hazy.out.stats, 0, sizeof(test->hazy.out.stats));
+    hazySetTrace(&test->hazy, &trace);
+
+    static uint32_t sequences[400];
+    size_t count = 0;
+    for (MonotonicTimeMs now = 500; now < 2600; ++now) {
+        hazyUpdateAt(&test->hazy, now);
+        if (now % 5 == 0 && now < 2500) {
+            HAZY_TEST_ASSERT(hazyTestWrite(&test->hazy, (uint32_t) (now - 500) / 5, 60, now) >= 0);
+        }
+        hazyTestReadSend(&test->hazy, sequences, &count, 400, now);
+    }
+    hazySetTrace(&test->hazy, 0);
+
+    static TestEvents drained;
+    drained.count = 0;
+    hazyTraceDrain(&trace, collect, &drained);
+    HAZY_TEST_ASSERT(trace.lostEventCount == 0);
+
+    static int32_t decisions[400];
+    size_t decisionCount = 0;
+    size_t deliverCount = 0;
+    size_t dropCount = 0;
+    for (size_t i = 0; i < drained.count; ++i) {
+        const HazyTraceEvent* event = &drained.events[i];
+        HAZY_TEST_ASSERT(event->directionId == HAZY_TRACE_DIRECTION_OUT);
+        if (i > 0) {
+            HAZY_TEST_ASSERT(event->timeMs >= drained.events[i - 1].timeMs);
+        }
+        switch ((HazyTraceEventType) event->type) {
+            case HazyTraceEventTypeDecision:
+                // The packet sequence in the direction is the order they were written in
+                HAZY_TEST_ASSERT(event->sequence == decisionCount);
+                HAZY_TEST_ASSERT(event->octetCount == 60);
+                decisions[decisionCount++] = event->value;
+                break;
+            case HazyTraceEventTypeDeliver:
+                HAZY_TEST_ASSERT(decisions[event->sequence] == HazyDecisionOriginal);
+                HAZY_TEST_ASSERT(sequences[deliverCount] == event->sequence);
+                HAZY_TEST_ASSERT(event->value == 10);
+                deliverCount++;
+                break;
+            case HazyTraceEventTypeDrop:
+                HAZY_TEST_ASSERT(decisions[event->sequence] == HazyDecisionDrop);
+                HAZY_TEST_ASSERT(event->value == HazyTraceDropCauseDecision);
+                dropCount++;
+                break;
+            case HazyTraceEventTypeEnqueue:
+            case HazyTraceEventTypeDropBurstPhase:
+            case HazyTraceEventTypeLatencyPhase:
+                break;
+        }
+    }
+
+    HAZY_TEST_ASSERT(decisionCount == 400);
+    HAZY_TEST_ASSERT(deliverCount == count);
+    HAZY_TEST_ASSERT(deliverCount + dropCount == 400);
+    HAZY_TEST_ASSERT(dropCount == test->hazy.out.stats.droppedPacketCount);
+    HAZY_TEST_ASSERT(dropCount > 60 && dropCount < 140);
+}
+
+int main(void)
+{
+    static HazyTest test;
+    hazyTestInit(&test, hazyConfigRecommended(), 1, &g_clog);
+
+    testRing(&test);
+    testPacketEvents(&test);
+
+    return 0;
+}